@@ -29,6 +29,7 @@
 #include "lima/SimplePipe.h"
 
 #include <numeric>
+#include <sched.h>
 
 namespace lima 
 {
@@ -534,6 +535,102 @@ struct GlobalCPUAffinity {
 
 typedef std::map<PixelDepth, GlobalCPUAffinity> PixelDepthCPUAffinityMap;
 
+enum SchedPolicy {
+	SchedDefault = -1,
+	SchedOther = SCHED_OTHER,
+	SchedFIFO = SCHED_FIFO,
+	SchedRR = SCHED_RR,
+	SchedBatch = SCHED_BATCH,
+	SchedIdle = SCHED_IDLE,
+};
+
+// SchedDefault policy and default (zero) CPU mask: keep the current value
+struct ThreadSchedParams {
+	SchedPolicy policy;
+	int priority;
+	CPUAffinity cpu_affinity;
+
+	ThreadSchedParams(SchedPolicy p = SchedDefault, int prio = 0,
+			  CPUAffinity a = CPUAffinity())
+		: policy(p), priority(prio), cpu_affinity(a)
+	{}
+};
+
+inline
+bool operator ==(const ThreadSchedParams& a, const ThreadSchedParams& b)
+{
+	return ((a.policy == b.policy) && (a.priority == b.priority) &&
+		(a.cpu_affinity.getZeroDefaultMask() ==
+		 b.cpu_affinity.getZeroDefaultMask()));
+}
+
+inline
+bool operator !=(const ThreadSchedParams& a, const ThreadSchedParams& b)
+{
+	return !(a == b);
+}
+
+struct ThreadInfo {
+	std::string name;
+	pid_t tid;
+	ThreadSchedParams sched_params;
+};
+
+typedef std::vector<ThreadInfo> ThreadInfoList;
+
+// Threads created by the plugin (receiver port threads, native listeners,
+// AcqThread), identified by name: the name is also given to the kernel
+// (top -H, ps -L). The scheduling of each thread is its creator default,
+// with the CPU affinity from the PixelDepthCPUAffinityMap, overridden by
+// the user parameters, which are kept by name across thread re-creation
+class ThreadRegistry
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "ThreadRegistry", "SlsDetector");
+ public:
+	ThreadRegistry();
+	~ThreadRegistry();
+
+	void registerThread(std::string name, pid_t tid,
+			    ThreadSchedParams def_params);
+	// only if name is still registered with tid
+	void unregisterThread(std::string name, pid_t tid);
+
+	void setThreadCPUAffinity(std::string name, CPUAffinity cpu_affinity);
+
+	void setThreadSchedParams(std::string name, ThreadSchedParams params);
+	void getThreadSchedParams(std::string name, ThreadSchedParams& params);
+
+	// current kernel values
+	void getThreadInfoList(ThreadInfoList& info_list);
+	// threads with CPU affinity set from the PixelDepthCPUAffinityMap
+	ProcList getAffinityTIDList();
+
+	static void getTaskSchedParams(pid_t tid, ThreadSchedParams& params);
+
+ private:
+	enum ApplyFlags {
+		ApplySched = 1, ApplyAffinity = 2,
+	};
+
+	struct Entry {
+		pid_t tid;
+		ThreadSchedParams def_params;
+		bool affinity_set;
+	};
+
+	typedef std::map<std::string, Entry> EntryMap;
+	typedef std::map<std::string, ThreadSchedParams> ParamsMap;
+
+	ThreadSchedParams getEffectiveParams(const std::string& name,
+					     const Entry& entry);
+	void apply(const std::string& name, pid_t tid,
+		   const ThreadSchedParams& params, int flags);
+
+	Mutex m_mutex;
+	EntryMap m_entry_map;
+	ParamsMap m_user_params_map;
+};
+
 class GlobalCPUAffinityMgr 
 {
 	DEB_CLASS_NAMESPC(DebModCamera, "GlobalCPUAffinityMgr", 
@@ -637,6 +734,9 @@ std::ostream& operator <<(std::ostream& os, const RecvCPUAffinity& a);
 std::ostream& operator <<(std::ostream& os, const RecvCPUAffinityList& l);
 std::ostream& operator <<(std::ostream& os, const GlobalCPUAffinity& a);
 std::ostream& operator <<(std::ostream& os, const PixelDepthCPUAffinityMap& m);
+std::ostream& operator <<(std::ostream& os, SchedPolicy policy);
+std::ostream& operator <<(std::ostream& os, const ThreadSchedParams& p);
+std::ostream& operator <<(std::ostream& os, const ThreadInfo& i);
 
 } // namespace SlsDetector
 
@@ -33,14 +33,51 @@
 #include "lima/HwMaxImageSizeCallback.h"
 #include "lima/Event.h"
 
-#include <queue>
-
 namespace lima 
 {
 
 namespace SlsDetector
 {
 
+// Finished frame ranges passed by the port threads to the AcqThread, one
+// queue per port. Created by Camera::prepareAcq and shared with the ports,
+// it outlives the AcqThread until the next acquisition
+class FinishedFrameQueues
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "FinishedFrameQueues", "SlsDetector");
+
+public:
+	FinishedFrameQueues(Camera *cam, int nb_ports, int nb_buffers,
+			    WaitPolicy wait_policy);
+
+	// called from the port threads, does not take the lock.
+	// Reports a CamOverrun if the AcqThread is more than the 
+	// buffer size behind
+	void queueFrames(int port_idx, const FrameRangeSpan& finished);
+
+	// AcqThread side
+	int getSeq()
+	{ return m_event.getSeq(); }
+	bool wait(int seq, double timeout)
+	{ return m_event.wait(seq, timeout); }
+	void signal()
+	{ m_event.signal(); }
+	void drain(FrameRangeList& finished_list);
+
+	// only the first one is reported, Lima stops the acquisition
+	void reportOverrun(const std::string& msg);
+
+private:
+	typedef SPSCQueue<FrameRange> Queue;
+	typedef std::vector<AutoPtr<Queue> > QueueList;
+
+	Camera *m_cam;
+	QueueList m_queue_list;
+	WaitEvent m_event;
+	std::atomic<bool> m_overrun;
+};
+
+
 class Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGen
 {
 	DEB_CLASS_NAMESPC(DebModCamera, "Camera", "SlsDetector");
@@ -90,6 +127,19 @@ public:
 	void setRawMode(bool  raw_mode);
 	void getRawMode(bool& raw_mode);
 
+	// receiver FIFO slots placed in the Lima buffers (raw mode only),
+	// if supported by the receiver
+	void setRecvDirectPlacement(bool  direct_placement);
+	void getRecvDirectPlacement(bool& direct_placement);
+
+	// NativeRecvEngine: the data ports (N:rx_udpport[2] in the config)
+	// are received by the plugin instead of the slsReceiver listeners,
+	// which are not started.
+	// XdpRecvEngine: same with AF_XDP sockets on the NIC queues of the 
+	// N:rx_udpip interface, if compiled with SLSDETECTOR_ENABLE_AF_XDP
+	void setRecvEngine(RecvEngine  recv_engine);
+	void getRecvEngine(RecvEngine& recv_engine);
+
 	State getState();
 	void waitState(State state);
 	State waitNotState(State state);
@@ -123,6 +173,13 @@ public:
 	void setSkipFrameFreq(FrameType  skip_frame_freq);
 	void getSkipFrameFreq(FrameType& skip_frame_freq);
 
+	// frame_queue_size: 0=nb_buffers
+	void setFrameQueueSize(int  frame_queue_size);
+	void getFrameQueueSize(int& frame_queue_size);
+	void setFrameQueueWaitPolicy(WaitPolicy  wait_policy);
+	void getFrameQueueWaitPolicy(WaitPolicy& wait_policy);
+	void getFrameQueueHighWatermarkList(IntList& watermark_list);
+
 	// setDAC: sub_mod_idx: 0-N=sub_module, -1=all
 	void setDAC(int sub_mod_idx, DACIndex dac_idx, int  val, 
 		    bool milli_volt = false);
@@ -148,6 +205,14 @@ public:
 			     IntList& bad_frame_list);
 	void getBadFrameList(int port_idx, IntList& bad_frame_list);
 
+	// frames received with missing packets, filled with 0xff
+	int getNbPartialFrames(int port_idx);
+	int getNbLostPackets(int port_idx);
+
+	// detector header of a frame still in the Lima buffer ring
+	void getFrameMetaData(int port_idx, FrameType frame, 
+			      FrameMetaData& meta_data);
+
 	void prepareAcq();
 	void startAcq();
 	void stopAcq();
@@ -163,9 +228,14 @@ public:
 	GlobalCPUAffinityMgr::ProcessingFinishedEvent *
 		getProcessingFinishedEvent();
 
+	void getThreadInfoList(ThreadInfoList& info_list);
+	void setThreadSchedParams(std::string name, ThreadSchedParams params);
+	void getThreadSchedParams(std::string name, ThreadSchedParams& params);
+
 private:
 	typedef std::map<int, int> RecvPortMap;
-	typedef std::queue<int> FrameQueue;
+	typedef std::map<int, IntList> RecvUdpPortMap;
+	typedef std::map<int, std::string> RecvUdpIpMap;
 	typedef std::vector<AutoPtr<Receiver> > RecvList;
 	typedef std::vector<Receiver::Port *> RecvPortList;
 
@@ -177,6 +247,8 @@ private:
 		std::string config_file_name;
 		NameList host_name_list;
 		RecvPortMap recv_port_map;
+		RecvUdpPortMap recv_udp_port_map;
+		RecvUdpIpMap recv_udp_ip_map;
 		AppInputData(std::string cfg_fname);
 		void parseConfigFile();
 	};
@@ -187,8 +259,8 @@ private:
 				  "SlsDetector");
 	public:
 		AcqThread(Camera *cam);
+		virtual ~AcqThread();
 
-		void queueFinishedFrame(FrameType frame);
 		virtual void start();
 		void stop(bool wait);
 
@@ -213,14 +285,19 @@ private:
 		void stopAcq();
 		void cleanUp();
 
+		void drainFinishedQueues();
+
 		Camera *m_cam;
 		Cond& m_cond;
-		State& m_state;
-		FrameQueue m_frame_queue;
+		std::atomic<State>& m_state;
+		FinishedFrameQueuesPtr m_finished_queues;
+		FrameRangeList m_finished_list;
+		SeqFilter m_seq_filter;
 	};
 
 	friend class Model;
 	friend class Receiver;
+	friend class FinishedFrameQueues;
 	friend class GlobalCPUAffinityMgr;
 
 	void setModel(Model *model);
@@ -241,6 +318,17 @@ private:
 
 	State getEffectiveState();
 
+	bool isStopping()
+	{ return (m_state == Stopping); }
+
+	// the receivers accept frames, the AcqThread processes them
+	bool isAcqRunning()
+	{
+		State state = m_state;
+		return ((state == Starting) || (state == Running) || 
+			(state == StopReq));
+	}
+
 	StdBufferCbMgr *getBufferCbMgr()
 	{ return &m_buffer_ctrl_obj->getBuffer(); }
 
@@ -249,15 +337,16 @@ private:
 	void createReceivers();
 
 	bool checkLostPackets();
+	double checkLateFrames();
 	FrameType getLastReceivedFrame();
 
 	void waitLastSkippedFrame();
 	void processLastSkippedFrame(int port_idx);
 
-	void getSortedBadFrameList(IntList first_idx, IntList last_idx,
-				   IntList& bad_frame_list );
-	void getSortedBadFrameList(IntList& bad_frame_list)
-	{ getSortedBadFrameList(IntList(), IntList(), bad_frame_list); }
+	void getSortedBadFrameSet(IntList first_idx, IntList last_idx,
+				  FrameRangeSet& bad_frame_set);
+	void getSortedBadFrameSet(FrameRangeSet& bad_frame_set)
+	{ getSortedBadFrameSet(IntList(), IntList(), bad_frame_set); }
 
 	template <class T>
 	void putNbCmd(const std::string& cmd, T val, int idx = -1)
@@ -286,6 +375,7 @@ private:
 	Cond m_cond;
 	AutoPtr<AppInputData> m_input_data;
 	AutoPtr<slsDetectorUsers> m_det;
+	ThreadRegistry m_thread_registry;
 	FrameMap m_frame_map;
 	int m_recv_nb_ports;
 	RecvList m_recv_list;
@@ -304,14 +394,18 @@ private:
 	PixelDepth m_pixel_depth;
 	ImageType m_image_type;
 	bool m_raw_mode;
-	State m_state;
+	bool m_recv_direct_placement;
+	RecvEngine m_recv_engine;
+	std::atomic<State> m_state;
 	double m_new_frame_timeout;
 	double m_abort_sleep_time;
 	bool m_tol_lost_packets;
 	FrameArray m_prev_ifa;
+	LostFrameDetector m_lost_frame_detector;
 	TimeRangesChangedCallback *m_time_ranges_cb;
 	PixelDepthCPUAffinityMap m_cpu_affinity_map;
 	GlobalCPUAffinityMgr m_global_cpu_affinity_mgr;
+	FinishedFrameQueuesPtr m_finished_queues;
 	AutoPtr<AcqThread> m_acq_thread;
 };
 
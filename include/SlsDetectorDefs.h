@@ -28,8 +28,14 @@
 #include "lima/Debug.h"
 #include "lima/RegExUtils.h"
 #include "lima/Timestamp.h"
+#include "lima/AutoObj.h"
+#include "lima/ThreadUtils.h"
 
 #include <set>
+#include <deque>
+#include <atomic>
+#include <ctime>
+#include <algorithm>
 
 namespace lima 
 {
@@ -248,8 +254,18 @@ enum PixelDepth {
 	PixelDepth32 = 32,
 };
 
+enum WaitPolicy {
+	BlockWait, BusyWait,
+};
+
+enum RecvEngine {
+	SlsRecvEngine, NativeRecvEngine, XdpRecvEngine,
+};
+
 std::ostream& operator <<(std::ostream& os, State state);
 std::ostream& operator <<(std::ostream& os, Type type);
+std::ostream& operator <<(std::ostream& os, WaitPolicy policy);
+std::ostream& operator <<(std::ostream& os, RecvEngine engine);
 
 
 typedef uint64_t FrameType;
@@ -261,6 +277,8 @@ typedef std::set<int> SortedIntList;
 typedef std::vector<FrameType> FrameArray;
 typedef IntList ProcList;
 
+const int CacheLineSize = 64;
+
 std::ostream& operator <<(std::ostream& os, const StringList& l);
 std::ostream& operator <<(std::ostream& os, const SortedIntList& l);
 std::ostream& operator <<(std::ostream& os, const FrameArray& a);
@@ -269,6 +287,125 @@ typedef PrettyList<IntList> PrettyIntList;
 typedef PrettyList<SortedIntList> PrettySortedList;
 
 
+// Contiguous sub-range of a std::vector, referenced by index so it remains
+// valid while the vector grows. Allows handing pre-allocated data around
+// without copying
+template <class T>
+class ListSpan
+{
+ public:
+	typedef std::vector<T> List;
+	typedef const T *const_iterator;
+
+	ListSpan() : m_list(NULL), m_offset(0), m_size(0) {}
+	ListSpan(const List& l, int offset, int size = 0)
+		: m_list(&l), m_offset(offset), m_size(size) {}
+
+	const_iterator begin() const
+	{ return m_size ? &(*m_list)[m_offset] : NULL; }
+	const_iterator end() const
+	{ return begin() + m_size; }
+
+	const T& operator [](int i) const
+	{ return (*m_list)[m_offset + i]; }
+
+	int size() const
+	{ return m_size; }
+	bool empty() const
+	{ return (m_size == 0); }
+
+	void grow(int n = 1)
+	{ m_size += n; }
+
+ private:
+	const List *m_list;
+	int m_offset;
+	int m_size;
+};
+
+template <class T>
+std::ostream& operator <<(std::ostream& os, const ListSpan<T>& s)
+{
+	os << "[";
+	typename ListSpan<T>::const_iterator it, end = s.end();
+	for (it = s.begin(); it != end; ++it)
+		os << ((it == s.begin()) ? "" : ",") << *it;
+	return os << "]";
+}
+
+struct FrameRange {
+	FrameType first;
+	int nb;
+
+	FrameRange(FrameType f = 0, int n = 0) : first(f), nb(n) {}
+
+	FrameType end() const
+	{ return first + nb; }
+};
+
+typedef std::vector<FrameRange> FrameRangeList;
+typedef ListSpan<FrameRange> FrameRangeSpan;
+
+std::ostream& operator <<(std::ostream& os, const FrameRange& r);
+
+
+// Set of frames stored as sorted, disjoint ranges, with the number of
+// frames before each range: membership and index look-ups are O(log n) 
+// on the ranges. Frames are normally added in increasing order, 
+// and bad frames come in runs
+class FrameRangeSet
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "FrameRangeSet", "SlsDetector");
+
+ public:
+	typedef std::vector<const FrameRangeSet *> SetList;
+
+	FrameRangeSet() : m_nb_frames(0) {}
+
+	void clear();
+	void add(FrameType first, FrameType nb = 1);
+	void remove(FrameType frame);
+
+	bool empty() const
+	{ return m_range_list.empty(); }
+	FrameType getNbFrames() const
+	{ return m_nb_frames; }
+	int getNbRanges() const
+	{ return m_range_list.size(); }
+	const FrameRangeList& getRangeList() const
+	{ return m_range_list; }
+
+	bool contains(FrameType frame) const;
+
+	// frames with index in [first_idx, last_idx)
+	void getSubSet(FrameType first_idx, FrameType last_idx, 
+		       FrameRangeSet& sub_set) const;
+	void getFrameList(FrameType first_idx, FrameType last_idx, 
+			  IntList& frame_list) const;
+	void getFrameList(IntList& frame_list) const
+	{ getFrameList(0, m_nb_frames, frame_list); }
+
+	// k-way merge (union) of sorted sets
+	static void merge(const SetList& set_list, FrameRangeSet& merged);
+
+ private:
+	// first must not be before the last range
+	void append(FrameType first, FrameType end);
+	// replaces the ranges [first_idx, end_idx) with the nb_r in r, 
+	// updating the number of frames before the following ones
+	void replaceRanges(int first_idx, int end_idx, 
+			   const FrameRange *r, int nb_r);
+	int findIndexRange(FrameType idx) const;
+
+	FrameRangeList m_range_list;
+	FrameArray m_prev_frames_list;
+	FrameType m_nb_frames;
+};
+
+// only the first and last ranges of large sets are printed
+std::ostream& operator <<(std::ostream& os, const FrameRangeSet& s);
+
+
 struct TimeRanges {
 	TimeRanges() :
 		min_exp_time(-1.), 
@@ -378,23 +515,75 @@ FrameType getLatestFrame(const FrameArray& l);
 FrameType getOldestFrame(const FrameArray& l);
 
 
+// HDR-like histogram in fixed memory: linear up to 2 * NbSubBins, then 
+// NbSubBins bins per power of two, i.e. a constant 1/NbSubBins relative 
+// resolution up to 2^MaxValueBits
+class LogLinearHistogram
+{
+ public:
+	enum {
+		SubBinBits = 5,
+		NbSubBins = 1 << SubBinBits,
+		MaxValueBits = 31,
+		NbBins = (MaxValueBits - SubBinBits + 1) * NbSubBins,
+	};
+	typedef std::vector<uint64_t> CountList;
+
+	static int getBinIdx(uint64_t val)
+	{
+		val = std::min(val, (uint64_t(1) << MaxValueBits) - 1);
+		if (val < NbSubBins)
+			return val;
+		int msb = 63 - __builtin_clzll(val);
+		int sub = (val >> (msb - SubBinBits)) - NbSubBins;
+		return (msb - SubBinBits + 1) * NbSubBins + sub;
+	}
+
+	static uint64_t getBinLow(int idx)
+	{
+		if (idx < NbSubBins)
+			return idx;
+		uint64_t sub = idx % NbSubBins + NbSubBins;
+		return sub << (idx / NbSubBins - 1);
+	}
+
+	static uint64_t getBinHigh(int idx)
+	{ return getBinLow(idx + 1); }
+
+	LogLinearHistogram() : count(NbBins, 0) {}
+
+	void reset()
+	{ std::fill(count.begin(), count.end(), 0); }
+
+	void add(uint64_t val)
+	{ ++count[getBinIdx(val)]; }
+
+	LogLinearHistogram& operator +=(const LogLinearHistogram& o);
+
+	uint64_t getNbValues() const;
+	// highest value below which p percent of the values fall
+	double getPercentile(double p) const;
+
+	CountList count;
+};
+
+
 struct SimpleStat {
-	typedef std::map<int, int> Histogram;
+	// sparse export: bin low value -> count
+	typedef std::map<int, uint64_t> Histogram;
 
+	// include the histogram when printing
 	static void setDoHist(bool do_hist);
 	static bool getDoHist();
 
 	double xmin, xmax, xacc, xacc2;
 	int xn;
 	double factor;
-	mutable Mutex lock;
-	Histogram hist;
-	int hist_bin;
+	LogLinearHistogram hist;
 
-	SimpleStat(double f = 1, int b = 5);
+	SimpleStat(double f = 1);
 	void reset();
-	void add(double x, bool do_hist = false);
-	SimpleStat& operator =(const SimpleStat& o);
+	void add(double x);
 	SimpleStat& operator += (const SimpleStat& o);
 
 	int n() const;
@@ -402,6 +591,12 @@ struct SimpleStat {
 	double max() const;
 	double ave() const;
 	double std() const;
+	double percentile(double p) const;
+
+	Histogram getHistogram() const;
+
+	static uint64_t histValue(double x)
+	{ return (x > 0) ? uint64_t(x + 0.5) : 0; }
 
 private:
 	static bool DoHist;
@@ -411,6 +606,40 @@ std::ostream& operator <<(std::ostream& os, const SimpleStat::Histogram& s);
 std::ostream& operator <<(std::ostream& os, const SimpleStat& s);
 
 
+// Single-writer SimpleStat: add() is lock-free, getSnapshot() can be called
+// from any thread without blocking the writer (seqlock)
+class SimpleStatRecorder
+{
+ public:
+	SimpleStatRecorder(double f = 1);
+
+	void reset();
+	void add(double x);
+	void getSnapshot(SimpleStat& s) const;
+
+ private:
+	typedef std::atomic<double> AtomicDouble;
+	typedef std::atomic<uint64_t> AtomicCount;
+
+	void beginWrite();
+	void endWrite();
+
+	alignas(CacheLineSize) std::atomic<unsigned int> m_seq;
+	AtomicDouble m_xmin, m_xmax, m_xacc, m_xacc2;
+	std::atomic<int> m_xn;
+	double m_factor;
+	AtomicCount m_hist_count[LogLinearHistogram::NbBins];
+};
+
+// CLOCK_MONOTONIC in ns, served by the vDSO without a syscall
+inline int64_t getMonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
 class Camera;
 
 class TimeRangesChangedCallback {
@@ -429,6 +658,123 @@ class TimeRangesChangedCallback {
 };
 
 
+// Sequence-based wake-up event: consumers read the sequence before checking
+// their condition and wait while it did not change. With BlockWait the 
+// waiter sleeps in a futex, the producer only enters the kernel if someone 
+// is actually waiting. BusyWait spins (to be used on isolated CPUs)
+class WaitEvent
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "WaitEvent", "SlsDetector");
+
+ public:
+	WaitEvent(WaitPolicy policy = BlockWait);
+
+	void setPolicy(WaitPolicy policy)
+	{ m_policy = policy; }
+	WaitPolicy getPolicy()
+	{ return m_policy; }
+
+	int getSeq()
+	{ return m_seq.load(std::memory_order_seq_cst); }
+
+	// returns false on timeout
+	bool wait(int seq, double timeout = -1);
+	void signal();
+
+ private:
+	std::atomic<int> m_seq;
+	std::atomic<int> m_nb_waiters;
+	WaitPolicy m_policy;
+};
+
+
+// Single-producer, single-consumer ring buffer. The indices are published
+// with acquire/release semantics and live in different cache lines.
+// Waiting, if needed, is up to the user (see WaitEvent)
+template <class T>
+class SPSCQueue
+{
+ public:
+	typedef std::vector<T> List;
+
+	SPSCQueue(int size = 1000)
+		: m_size(0), m_write_idx(0), m_high_watermark(0), m_read_idx(0)
+	{ setSize(size); }
+
+	// not thread-safe: both producer and consumer must be idle
+	void setSize(int size)
+	{
+		m_size = std::max(size, 1) + 1;
+		m_array.resize(m_size);
+		clear();
+	}
+	int getSize() const
+	{ return m_size - 1; }
+
+	void clear()
+	{
+		m_write_idx.store(0, std::memory_order_relaxed);
+		m_read_idx.store(0, std::memory_order_relaxed);
+		m_high_watermark.store(0, std::memory_order_relaxed);
+	}
+
+	bool empty() const
+	{
+		int read_idx = m_read_idx.load(std::memory_order_relaxed);
+		int write_idx = m_write_idx.load(std::memory_order_acquire);
+		return (write_idx == read_idx);
+	}
+
+	// producer side: returns false if the queue is full
+	bool push(const T& data)
+	{
+		int write_idx = m_write_idx.load(std::memory_order_relaxed);
+		int read_idx = m_read_idx.load(std::memory_order_acquire);
+		int next_idx = index(write_idx + 1);
+		if (next_idx == read_idx)
+			return false;
+		m_array[write_idx] = data;
+		m_write_idx.store(next_idx, std::memory_order_release);
+
+		int level = index(next_idx - read_idx + m_size);
+		if (level > m_high_watermark.load(std::memory_order_relaxed))
+			m_high_watermark.store(level, 
+					       std::memory_order_relaxed);
+		return true;
+	}
+
+	// consumer side: appends all the available data to l
+	bool pop_all(List& l)
+	{
+		int read_idx = m_read_idx.load(std::memory_order_relaxed);
+		int write_idx = m_write_idx.load(std::memory_order_acquire);
+		if (write_idx == read_idx)
+			return false;
+		bool two_steps = (read_idx > write_idx);
+		int end_idx = two_steps ? m_size : write_idx;
+		typename List::const_iterator b = m_array.begin();
+		l.insert(l.end(), b + read_idx, b + end_idx);
+		if (two_steps)
+			l.insert(l.end(), b, b + write_idx);
+		m_read_idx.store(write_idx, std::memory_order_release);
+		return true;
+	}
+
+	int getHighWatermark() const
+	{ return m_high_watermark.load(std::memory_order_relaxed); }
+
+ private:
+	int index(int i) const
+	{ return i % m_size; }
+
+	List m_array;
+	int m_size;
+	alignas(CacheLineSize) std::atomic<int> m_write_idx;
+	std::atomic<int> m_high_watermark;
+	alignas(CacheLineSize) std::atomic<int> m_read_idx;
+};
+
+
 class FrameMap
 {
 	DEB_CLASS_NAMESPC(DebModCamera, "FrameMap", "SlsDetector");
@@ -439,10 +785,14 @@ class FrameMap
 		DEB_CLASS_NAMESPC(DebModCamera, "Item", "SlsDetector");
 	
 	public:
+		// finished frames are reported as ranges, stored in
+		// the Item and valid until the next pollFrameFinished
 		struct FinishInfo {
 			FrameType first_lost;
 			int nb_lost;
-			SortedIntList finished;
+			// lost frame finally received, -1 if none
+			FrameType recovered;
+			FrameRangeSpan finished;
 		};
 		typedef std::vector<FinishInfo> FinishInfoList;
 	
@@ -451,46 +801,83 @@ class FrameMap
 	
 		void checkFinishedFrame(FrameType frame);
 		void frameFinished(FrameType frame, bool no_check, bool valid);
-		FinishInfoList pollFrameFinished();
+		const FinishInfoList& pollFrameFinished();
 		void stopPollFrameFinished();
+
+		// A frame declared lost can still be received if not yet
+		// finished by all the items: it is held while written and
+		// finished again when released
+		bool holdLateFrame(FrameType frame);
+		void releaseLateFrame(FrameType frame, bool valid);
+
+		int getQueueHighWatermark()
+		{ return m_frame_queue.getHighWatermark(); }
+
+		FrameType getLastPushedFrame()
+		{ return m_last_pushed_frame; }
+
+		// lost (or invalid) frames are marked as bad in the FrameMap
+		// before being finished
+		bool isBadFrame(FrameType frame) const
+		{ return m_map->isBadItem(m_idx, frame); }
 	
 	private:
 		friend class FrameMap;
 	
-		typedef std::pair<int, bool> FrameData;
+		typedef std::pair<FrameType, bool> FrameData;
 		typedef std::vector<FrameData> FrameDataList;
 	
+		// Receiver callback -> port thread queue
 		class FrameQueue 
 		{
+			DEB_CLASS_NAMESPC(DebModCamera, "FrameQueue", 
+					  "SlsDetector");
 		public:
 			FrameQueue(int size = 1000);
-			void clear();
+
+			void setSize(int size)
+			{ m_queue.setSize(size); }
+			int getSize()
+			{ return m_queue.getSize(); }
+
+			void setWaitPolicy(WaitPolicy policy)
+			{ m_event.setPolicy(policy); }
+
+			void clear()
+			{ m_queue.clear(); }
 			void push(FrameData data);
-			FrameDataList pop_all();
+			// waits for data (or stop), fills the caller buffer
+			void pop_all(FrameDataList& data_list);
 			void stop();
+
+			int getHighWatermark()
+			{ return m_queue.getHighWatermark(); }
 	
 		private:
-			int index(int i)
-			{ return i % m_size; }
-	
-			FrameDataList m_array;
-			int m_size;
-			volatile int m_write_idx;
-			volatile int m_read_idx;
-			volatile bool m_stopped;
+			SPSCQueue<FrameData> m_queue;
+			std::atomic<bool> m_stopped;
+			WaitEvent m_event;
 		};
 	
-		friend bool SlsDetector::operator <(FrameData a, FrameData b);
-	
-		void setFrameMap(FrameMap *map);
+		void setFrameMap(FrameMap *map, int idx);
+		void setQueueConfig(int size, WaitPolicy policy);
 		void clear();
+		void markBadFrames(FrameType frame, bool valid);
 	
 		FrameMap *m_map;
+		int m_idx;
 		FrameQueue m_frame_queue;
+		FrameDataList m_data_list;
+		FinishInfoList m_finfo_list;
+		FrameRangeList m_finished_list;
 		FrameType m_last_pushed_frame;
+		// decremented frames, shared with holdLateFrame
+		Mutex m_poll_mutex;
 		FrameType m_last_frame;
+		// frames marked bad, cleared when their buffer is reused
+		std::deque<FrameType> m_bad_mark_list;
 	};
-	typedef std::vector<Item> ItemList;
+	typedef std::vector<AutoPtr<Item> > ItemList;
 
 	
 	FrameMap();
@@ -499,10 +886,22 @@ class FrameMap
 	void setBufferSize(int buffer_size);
 	void clear();
 
+	// items can be aggregated in groups (e.g. per receiver) before
+	// the global count, limiting the cache lines shared among them
+	void setItemGroupSize(int item_group_size);
+	void getItemGroupSize(int& item_group_size);
+
+	// 0: follow the buffer size
+	void setQueueSize(int queue_size);
+	void getQueueSize(int& queue_size);
+	void setQueueWaitPolicy(WaitPolicy  policy);
+	void getQueueWaitPolicy(WaitPolicy& policy);
+
 	Item& getItem(int item)
-	{ return m_item_list[item]; }
+	{ return *m_item_list[item]; }
 
 	FrameArray getItemFrameArray() const;
+	IntList getItemQueueHighWatermarkList() const;
 
 	FrameType getLastItemFrame() const
 	{ return getLatestFrame(getItemFrameArray()); }
@@ -510,93 +909,268 @@ class FrameMap
 	FrameType getLastFinishedFrame() const
 	{ return getOldestFrame(getItemFrameArray()); }
 
+	int getNbItems() const
+	{ return m_nb_items; }
+
+	int getBufferSize() const
+	{ return m_buffer_size; }
+
+	// items that declared a finished frame bad: a single look-up in
+	// the per-buffer mask, valid until the buffer is reused
+	bool hasBadItems(FrameType frame) const;
+	bool isBadItem(int item, FrameType frame) const;
+	void getBadItemList(FrameType frame, IntList& bad_item_list) const;
+
  private:
 	friend class Item;
 
-	struct AtomicCounter {
-		int count;
-		Mutex mutex;
+	// Each counter lives in its own cache line: consecutive frames
+	// are finished concurrently by different port threads
+	struct alignas(CacheLineSize) AtomicCounter {
+		std::atomic<int> count;
+
+		AtomicCounter() : count(0)
+		{}
+		AtomicCounter(const AtomicCounter& o) 
+			: count(o.count.load(std::memory_order_relaxed))
+		{}
 	
 		void set(int reset)
-		{ count = reset; }
+		{ count.store(reset, std::memory_order_relaxed); }
 	
+		// the last decrement re-arms the counter: no other item 
+		// can access it until the buffer index wraps around
 		bool dec_test_and_reset(int reset)
 		{
-			mutex.lock();
-			bool zero = (--count == 0);
+			std::memory_order order = std::memory_order_acq_rel;
+			int prev = count.fetch_sub(1, order);
+			bool zero = (prev == 1);
 			if (zero)
 				set(reset);
-			mutex.unlock();
 			return zero;
 		}
+
+		// undoes a decrement, unless the count was re-armed
+		bool inc_if_pending(int reset)
+		{
+			std::memory_order order = std::memory_order_acq_rel;
+			int val = count.load(std::memory_order_acquire);
+			while (true) {
+				// zero: being re-armed
+				if (val == 0) {
+					val = count.load(std::memory_order_acquire);
+					continue;
+				}
+				if (val == reset)
+					return false;
+				if (count.compare_exchange_weak(val, val + 1, 
+								order))
+					return true;
+			}
+		}
 	};
 	typedef std::vector<AtomicCounter> CounterList;
+	typedef std::vector<CounterList> CounterListList;
+
+	// each item only writes its own bit, and only for bad frames
+	struct AtomicMask {
+		std::atomic<uint64_t> bits;
+
+		AtomicMask() : bits(0)
+		{}
+		AtomicMask(const AtomicMask& o) 
+			: bits(o.bits.load(std::memory_order_relaxed))
+		{}
+	};
+	typedef std::vector<AtomicMask> MaskList;
+
+	static const int MaskWordBits = 64;
+
+	AtomicMask& getBadItemWord(int item, FrameType frame);
+	const AtomicMask *getBadItemMask(FrameType frame) const
+	{ return &m_bad_item_mask[(frame % m_buffer_size) * m_mask_words]; }
+	void setBadItem(int item, FrameType frame, bool bad);
+	void updateBadItemMask();
+
+	int getGroupNbItems(int group) const;
+	bool decFrameCount(int item, FrameType frame);
+	bool holdFrameCount(int item, FrameType frame, bool dec_done);
+	void resetCounters();
+
+	int getEffectiveQueueSize() const;
+	void updateItemQueues();
 	
 	int m_nb_items;
+	int m_item_group_size;
+	int m_nb_groups;
 	int m_buffer_size;
+	int m_queue_size;
+	WaitPolicy m_queue_wait_policy;
 	CounterList m_frame_item_count_list;
+	CounterListList m_frame_group_count_list;
+	int m_mask_words;
+	MaskList m_bad_item_mask;
 	ItemList m_item_list;
 };
 
 std::ostream& operator <<(std::ostream& os, const FrameMap& m);
 
 
-class SeqFilter {
+// Early lost frame detection on the FrameMap item frames: the next frame
+// of a port is declared lost when the other ports are more than a lag
+// threshold ahead and the port did not progress for that many frame 
+// periods. The threshold follows the skew observed among the progressing
+// ports. If all the ports stopped for the stop timeout, the late ones are
+// declared lost up to the latest frame
+class LostFrameDetector
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "LostFrameDetector", "SlsDetector");
+
  public:
-	struct Range {
-		int first;
-		int nb;
+	typedef std::pair<int, FrameType> PortFrame;
+	typedef std::vector<PortFrame> PortFrameList;
 
-		Range()
-		{
-			reset();
-		}
+	LostFrameDetector();
 
-		void reset(int new_first = 0)
-		{
-			first = new_first;
-			nb = 0;
-		}
+	// 0 disables the detection
+	void setFramePeriod(double  frame_period);
+	void getFramePeriod(double& frame_period);
 
-		int end()
-		{
-			return first + nb;
-		}
+	bool isActive() const
+	{ return (m_frame_period > 0); }
 
-		bool tryExtend(int val)
-		{
-			bool ok = (val == end());
-			if (ok)
-				nb++;
-			return ok;
-		}
+	// min. time without progress on any port before declaring all the
+	// late ones lost, in the order of the new frame timeout
+	void setStopTimeout(double  stop_timeout);
+	void getStopTimeout(double& stop_timeout);
+
+	void reset(int nb_ports);
+
+	// returns the (port, last lost frame) to declare
+	void check(const FrameArray& ifa, Timestamp now, 
+		   PortFrameList& lost_list);
+
+	// max. time until the next check, -1 if no port is late
+	double getCheckTimeout() const;
+
+	int getLagThreshold() const;
+	double getStallTime() const;
+
+ private:
+	struct PortData {
+		FrameType frame;
+		Timestamp t;
 	};
 
-	void addVal(int new_val)
-	{
-		SortedIntList& w = m_waiting;
-		if (!m_seq_range.tryExtend(new_val)) {
-			w.insert(new_val);
-		} else {
-			while (!w.empty()) {
-				SortedIntList::iterator wit = w.begin();
-				if (!m_seq_range.tryExtend(*wit))
-					break;
-				w.erase(wit);
-			}
-		}
-	}
+	static const int MinLagThreshold;
+	static const double MinStallTime;
+	static const double SkewDecay;
+
+	double m_frame_period;
+	double m_stop_timeout;
+	std::vector<PortData> m_port_list;
+	FrameType m_latest;
+	Timestamp m_latest_t;
+	double m_skew;
+	bool m_late_ports;
+};
 
-	Range getSeqRange() 
-	{
-		Range ret = m_seq_range;
-		m_seq_range.reset(m_seq_range.end());
-		return ret;
-	}
+
+// Reorder window: frames are marked in a bitmap as they arrive, in any
+// order, and the contiguous run starting at the next expected frame is
+// extracted a 64-bit word at a time. Frames cannot arrive further than 
+// the window size ahead of the next expected one
+class SeqFilter 
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "SeqFilter", "SlsDetector");
+
+ public:
+	SeqFilter(int size = 0);
+
+	void setSize(int size);
+	int getSize() const
+	{ return m_size; }
+
+	void reset(FrameType first = 0);
+
+	// false if out of the window: the consumer is more than size 
+	// frames behind, the values are not added
+	bool addVal(FrameType new_val);
+	bool addRange(const FrameRange& range);
+
+	bool hasSeqRange() const
+	{ return m_size && (m_word_list[wordIdx(m_next)] & bitMask(m_next)); }
+
+	FrameRange getSeqRange();
+
+ private:
+	typedef uint64_t Word;
+	typedef std::vector<Word> WordList;
+	static const int WordBits = 64;
+
+	int wordIdx(FrameType frame) const
+	{ return (frame % m_size) / WordBits; }
+	static Word bitMask(FrameType frame)
+	{ return Word(1) << (frame % WordBits); }
+
+	bool checkVal(FrameType val, int nb = 1);
+
+	int m_size;
+	FrameType m_next;
+	WordList m_word_list;
+};
+
+// Detector header of a received port frame
+struct FrameMetaData {
+	// detector timestamps: 10 MHz clock
+	static const double TimestampUnit;
+
+	FrameType det_frame;
+	uint64_t bunch_id;
+	uint64_t timestamp;
+	uint16_t mod_id;
+	uint16_t x, y, z;
+	uint32_t debug;
+	uint32_t recv_packets;
+
+	FrameMetaData();
+};
+
+std::ostream& operator <<(std::ostream& os, const FrameMetaData& md);
+
+// Per-port FrameMetaData ring, one slot per Lima buffer, allocated in 
+// setSize. Single writer (the port thread); the readers do not block it:
+// each slot is protected by a seqlock and validated by its frame
+class FrameMetaDataRing
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "FrameMetaDataRing", "SlsDetector");
+
+ public:
+	FrameMetaDataRing();
+
+	void setSize(int size);
+	int getSize() const
+	{ return m_slot_list.size(); }
+
+	void clear();
+	void put(FrameType frame, const FrameMetaData& md);
+	// false if the frame was not received or was overwritten
+	bool get(FrameType frame, FrameMetaData& md) const;
 
  private:
-	Range m_seq_range;
-	SortedIntList m_waiting;
+	static const int NbWords = sizeof(FrameMetaData) / sizeof(uint64_t);
+
+	struct Slot {
+		std::atomic<unsigned int> seq;
+		std::atomic<FrameType> frame;
+		std::atomic<uint64_t> word[NbWords];
+
+		Slot();
+		Slot(const Slot& o);
+	};
+	typedef std::vector<Slot> SlotList;
+
+	SlotList m_slot_list;
 };
 
 struct Stats {
@@ -604,6 +1178,8 @@ struct Stats {
 	SimpleStat new_finish;
 	SimpleStat cb_exec;
 	SimpleStat recv_exec;
+	// from the detector timestamps: period std. dev. is the jitter
+	SimpleStat det_period;
 	Stats();
 	void reset();
 	Stats& operator +=(const Stats& o);
@@ -611,6 +1187,17 @@ struct Stats {
 
 std::ostream& operator <<(std::ostream& os, const Stats& s);
 
+struct StatsRecorder {
+	SimpleStatRecorder cb_period;
+	SimpleStatRecorder new_finish;
+	SimpleStatRecorder cb_exec;
+	SimpleStatRecorder recv_exec;
+	SimpleStatRecorder det_period;
+	StatsRecorder();
+	void reset();
+	void getSnapshot(Stats& s) const;
+};
+
 
 typedef RegEx::SingleMatchType SingleMatch;
 typedef RegEx::FullMatchType FullMatch;
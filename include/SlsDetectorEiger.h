@@ -24,9 +24,13 @@
 #define __SLS_DETECTOR_EIGER_H
 
 #include "SlsDetectorCamera.h"
+#include "SlsDetectorStreamCopy.h"
 
 #include "processlib/LinkTask.h"
 
+#include <cmath>
+#include <map>
+
 
 namespace lima 
 {
@@ -47,10 +51,20 @@ class Eiger : public Model
 
 	typedef Defs::ClockDiv ClockDiv;
 
+	typedef std::vector<double> BorderFactor;
+	typedef std::vector<BorderFactor> BorderFactorList;
+
 	enum ParallelMode {
 		NonParallel, Parallel, Safe,
 	};
 
+	// LinkTaskCorr: all the corrections on the full frame in the Lima 
+	// processing task. RecvPortCorr: the port regions are corrected 
+	// (and bad frames filled) in the Receiver port threads
+	enum CorrMode {
+		LinkTaskCorr, RecvPortCorr,
+	};
+
 	class Correction : public LinkTask
 	{
 		DEB_CLASS_NAMESPC(DebModCamera, "Eiger::Correction", 
@@ -63,6 +77,251 @@ class Eiger : public Model
 		Eiger *m_eiger;
 	};
 
+	// Chip border pixel correction of a full (non-raw) frame, done in
+	// one row-oriented pass. For each pixel the operation sequence of the
+	// former column/row walks is kept: border cols, border rows (factors),
+	// inter-chip cols and inter-chip rows, so the output is identical.
+	// The operations on a pixel only depend on its own column, or on the 
+	// chip column next to the gap it fills, so a half-module can also be 
+	// corrected by column windows, each one by a different thread
+	template <class T>
+	class BorderPixelCorr
+	{
+	public:
+		void prepare(int width, int mod_height, 
+			     const std::vector<int>& inter_lines,
+			     const BorderFactorList& f)
+		{
+			m_width = width;
+			m_mod_height = mod_height;
+			m_inter_lines = inter_lines;
+			int nb_modules = m_inter_lines.size();
+			m_mod_offset.resize(nb_modules);
+			m_scale.resize(nb_modules);
+			for (int i = 0, offset = 0; i < nb_modules; ++i) {
+				m_mod_offset[i] = offset;
+				offset += (mod_height + m_inter_lines[i]) * width;
+				m_scale[i].resize(2);
+				m_scale[i][0].set(f[i][0]);
+				m_scale[i][1].set(f[i][1]);
+			}
+			m_copy_func = StreamCopy::getCopyFunc();
+		}
+
+		void correctFrame(void *ptr) const
+		{ correctFrame(ptr, NULL); }
+
+		// out-of-place: each src row is corrected in a row buffer, 
+		// which is then streamed to dest
+		void correctFrame(void *dest, const void *src) const
+		{
+			std::vector<T> row_buffer(src ? m_width : 0);
+			Cursor c;
+			c.d = static_cast<T *>(dest);
+			c.s = static_cast<const T *>(src);
+			c.buffer = src ? &row_buffer[0] : NULL;
+			int nb_modules = m_inter_lines.size();
+			for (int i = 0; i < nb_modules; ++i) {
+				correctModule(c, m_scale[i]);
+				for (int j = 0; j < m_inter_lines[i]; ++j) {
+					T *r = loadRow(c);
+					correctRow(r, NULL, 0, m_width);
+					storeRow(c, r);
+				}
+			}
+			if (src)
+				StreamCopy::fence();
+		}
+
+		// in-place correction of the columns [c0, c1) of the top 
+		// (or bottom) half of a module, including the inter-chip 
+		// row it fills
+		void correctHalfModule(void *ptr, int mod, bool top, 
+				       int c0, int c1) const
+		{
+			const ScaleList& scale = m_scale[mod];
+			const int last = m_mod_height - 1;
+			const int n = c1 - c0;
+			T *d = static_cast<T *>(ptr) + m_mod_offset[mod];
+			if (top) {
+				for (int i = 0; i < ChipSize; ++i, d += m_width) {
+					const Scale *f = (i < 2) ? &scale[i] : NULL;
+					correctRow(d, f, c0, c1);
+				}
+				T *r = d - m_width;
+				halveRow(r + c0, n);
+				memcpy(d + c0, r + c0, n * sizeof(T));
+				return;
+			}
+			d += (ChipSize + ChipGap) * m_width;
+			correctRow(d, NULL, c0, c1);
+			halveRow(d + c0, n);
+			memcpy(d - m_width + c0, d + c0, n * sizeof(T));
+			d += m_width;
+			for (int i = ChipSize + ChipGap + 1; i <= last; ++i, 
+							     d += m_width) {
+				const Scale *f = NULL;
+				if (i >= last - 1)
+					f = &scale[last - i];
+				correctRow(d, f, c0, c1);
+			}
+		}
+
+	private:
+		// Exact T(x / f): bit shift for integer powers of two, 
+		// look-up table for 8/16-bit pixels, division otherwise
+		class Scale
+		{
+		public:
+			void set(double f)
+			{
+				m_f = f;
+				m_lut.clear();
+				int e;
+				bool pow2 = (frexp(f, &e) == 0.5);
+				m_shift = (pow2 && (e >= 1) && (e <= Bits)) ? 
+								e - 1 : -1;
+				if ((m_shift >= 0) || (sizeof(T) > 2))
+					return;
+				m_lut.resize(size_t(1) << Bits);
+				for (unsigned int x = 0; x < m_lut.size(); ++x)
+					m_lut[x] = T(x / f);
+			}
+
+			void apply(T *d, int n) const
+			{
+				if (m_shift == 0)
+					return;
+				if (m_shift > 0) {
+					for (int i = 0; i < n; ++i)
+						d[i] >>= m_shift;
+				} else if (!m_lut.empty()) {
+					const T *lut = &m_lut[0];
+					for (int i = 0; i < n; ++i)
+						d[i] = lut[d[i]];
+				} else {
+					for (int i = 0; i < n; ++i)
+						d[i] = T(d[i] / m_f);
+				}
+			}
+
+		private:
+			static const int Bits = sizeof(T) * 8;
+			double m_f;
+			int m_shift;
+			std::vector<T> m_lut;
+		};
+
+		typedef std::vector<Scale> ScaleList;
+
+		static void halveRow(T *d, int n)
+		{
+			for (int i = 0; i < n; ++i)
+				d[i] /= 2;
+		}
+
+		// Row position in dest and src. In place (s == NULL) rows are
+		// corrected in dest, otherwise in the row buffer
+		struct Cursor {
+			T *d;
+			const T *s;
+			T *buffer;
+		};
+
+		T *loadRow(Cursor& c) const
+		{
+			if (!c.s)
+				return c.d;
+			memcpy(c.buffer, c.s, m_width * sizeof(T));
+			c.s += m_width;
+			return c.buffer;
+		}
+
+		void writeRow(const Cursor& c, T *d, const T *r) const
+		{
+			if (r == d)
+				return;
+			else if (c.s)
+				m_copy_func((char *) d, (const char *) r, 
+					    m_width * sizeof(T));
+			else
+				memcpy(d, r, m_width * sizeof(T));
+		}
+
+		void storeRow(Cursor& c, const T *r) const
+		{
+			writeRow(c, c.d, r);
+			c.d += m_width;
+		}
+
+		void skipRows(Cursor& c, int nb_rows) const
+		{
+			c.d += nb_rows * m_width;
+			if (c.s)
+				c.s += nb_rows * m_width;
+		}
+
+		// border cols, border row factor and inter-chip cols, 
+		// restricted to [c0, c1). A gap col is filled by the window
+		// holding its source chip col
+		void correctRow(T *d, const Scale *scale, int c0, int c1) const
+		{
+			if (c0 == 0)
+				d[0] /= 2;
+			if (c1 == m_width)
+				d[m_width - 1] /= 2;
+			if (scale)
+				scale->apply(d + c0, c1 - c0);
+			int c = ChipSize;
+			for (int i = 0; i < HalfModuleChips - 1; ++i) {
+				if ((c - 1 >= c0) && (c - 1 < c1))
+					d[c] = d[c - 1] /= 2;
+				if ((c + 2 >= c0) && (c + 2 < c1))
+					d[c + 1] = d[c + 2] /= 2;
+				c += ChipSize + ChipGap;
+			}
+		}
+
+		void correctModule(Cursor& c, const ScaleList& scale) const
+		{
+			const int last = m_mod_height - 1;
+			// top half chips
+			for (int i = 0; i < ChipSize; ++i) {
+				const Scale *f = (i < 2) ? &scale[i] : NULL;
+				T *r = loadRow(c);
+				correctRow(r, f, 0, m_width);
+				if (i == ChipSize - 1) {
+					// inter-chip row: replicate halved border
+					halveRow(r, m_width);
+					writeRow(c, c.d + m_width, r);
+				}
+				storeRow(c, r);
+			}
+			skipRows(c, ChipGap);
+			// bottom half chips
+			T *r = loadRow(c);
+			correctRow(r, NULL, 0, m_width);
+			halveRow(r, m_width);
+			writeRow(c, c.d - m_width, r);
+			storeRow(c, r);
+			for (int i = ChipSize + ChipGap + 1; i <= last; ++i) {
+				const Scale *f = NULL;
+				if (i >= last - 1)
+					f = &scale[last - i];
+				r = loadRow(c);
+				correctRow(r, f, 0, m_width);
+				storeRow(c, r);
+			}
+		}
+
+		int m_width;
+		int m_mod_height;
+		std::vector<int> m_inter_lines;
+		std::vector<int> m_mod_offset;
+		std::vector<ScaleList> m_scale;
+		StreamCopy::CopyFunc m_copy_func;
+	};
+
 	Eiger(Camera *cam);
 	~Eiger();
 	
@@ -89,6 +348,9 @@ class Eiger : public Model
 	void setParallelMode(ParallelMode  mode);
 	void getParallelMode(ParallelMode& mode);
 
+	void setCorrMode(CorrMode  corr_mode);
+	void getCorrMode(CorrMode& corr_mode);
+
 	void setFixedClockDiv(bool  fixed_clock_div);
 	void getFixedClockDiv(bool& fixed_clock_div);
 	void setClockDiv(ClockDiv  clock_div);
@@ -106,37 +368,55 @@ class Eiger : public Model
 	void setThresholdEnergy(int  thres);
 	void getThresholdEnergy(int& thres);
 
- protected:
-	virtual void updateImageSize();
-
-	virtual bool checkSettings(Settings settings);
-
-	virtual int getRecvPorts();
-
-	virtual void prepareAcq();
-	virtual void processRecvFileStart(int port_idx, uint32_t dsize);
-	virtual void processRecvPort(int port_idx, FrameType frame, char *dptr,
-				     uint32_t dsize, char *bptr);
-
- private:
-	friend class Correction;
-	friend class CorrBase;
-
 	class RecvPortGeometry
 	{
 		DEB_CLASS_NAMESPC(DebModCamera, "Eiger::RecvPortGeometry", 
 				  "SlsDetector");
 	public:
-		RecvPortGeometry(Eiger *eiger, int recv_idx, int port);
+		// acquisition parameters of the geometry, independent of the
+		// Camera so the port copy can also be driven offline
+		struct Config {
+			FrameDim recv_frame_dim;
+			bool raw;
+			bool expand4;
+			// RecvPortCorr: keep the port data in the cache
+			bool read_back;
+			IntList inter_mod_gap;
+			Config() : raw(false), expand4(false), read_back(false)
+			{}
+		};
 
-		void prepareAcq();
+		RecvPortGeometry(int recv_idx, int port);
+
+		void prepareAcq(const Config& cfg);
 		void processRecvFileStart(uint32_t dsize);
 		void processRecvPort(FrameType frame, char *dptr, char *bptr);
 
-		void expandPixelDepth4(FrameType frame, char *ptr);
+		// -1 if the port data is not contiguous in the image
+		int getDirectOffset();
 
 	private:
-		Eiger *m_eiger;
+		typedef void (RecvPortGeometry::*CopyPortFunc)(char *dest,
+							       char *src);
+		typedef void (RecvPortGeometry::*FillPortFunc)(char *dest,
+							       int val);
+		struct PortFuncs {
+			int scw;
+			int dcw;
+			CopyPortFunc copy;
+			FillPortFunc fill;
+		};
+
+		static const PortFuncs PortFuncList[];
+
+		void setPortFuncs(bool read_back);
+
+		// 0 in SCW/DCW means run-time chip widths and 4-bit expansion
+		template <int SCW, int DCW, bool E4>
+		void copyPort(char *dest, char *src);
+		template <int SCW, int DCW, bool E4>
+		void fillPort(char *dest, int val);
+
 		int m_port;
 		bool m_top_half_recv;
 		bool m_port_idx;
@@ -147,8 +427,34 @@ class Eiger : public Model
 		int m_scw;			// source chip width
 		int m_dcw;			// dest chip width
 		int m_pchips;
+		bool m_expand4;
+		StreamCopy::CopyFunc m_copy_func;
+		StreamCopy::FillFunc m_fill_func;
+		StreamCopy::Expand4Func m_expand4_func;
+		CopyPortFunc m_copy_port;
+		FillPortFunc m_fill_port;
 	};
 
+ protected:
+	virtual void updateImageSize();
+
+	virtual bool checkSettings(Settings settings);
+
+	virtual int getRecvPorts();
+
+	virtual void prepareAcq();
+	virtual void processRecvFileStart(int port_idx, uint32_t dsize);
+	virtual void processRecvPort(int port_idx, FrameType frame, char *dptr,
+				     uint32_t dsize, char *bptr);
+	virtual bool isRecvPortCorrActive();
+	virtual int getRecvPacketLen();
+	virtual uint32_t getRecvPortDataSize();
+	virtual int getRecvPortDirectOffset(int port_idx);
+
+ private:
+	friend class Correction;
+	friend class CorrBase;
+
 	typedef std::vector<AutoPtr<RecvPortGeometry> > PortGeometryList;
 
 	class CorrBase
@@ -164,6 +470,17 @@ class Eiger : public Model
 
 		virtual void prepareAcq();
 		virtual void correctFrame(FrameType frame, void *ptr) = 0;
+		// out-of-place correction: copy from src and correct dest 
+		// in one pass. Returns false if the frame was left untouched
+		// (dest not written), so the next correction does the copy
+		virtual bool copyCorrectFrame(FrameType frame, void *dest,
+					      const void *src, int size);
+		// RecvPortCorr mode: correct the region of port_idx, 
+		// called from its thread
+		virtual void correctRecvPort(int /*port_idx*/, 
+					     FrameType /*frame*/,
+					     char * /*bptr*/)
+		{}
 
 	protected:
 		friend class Eiger;
@@ -177,41 +494,71 @@ class Eiger : public Model
 
 	typedef std::vector<CorrBase *> CorrList;
 
-	class BadRecvFrameCorr : public CorrBase
+	// Recycled NUMA-local buffers for the out-of-place corrections.
+	// Each node keeps its own free list, filled with memory allocated
+	// on it. The pool is deleted when released and all the buffers 
+	// returned by Lima
+	class BufferPool : public Buffer::Callback
 	{
-		DEB_CLASS_NAMESPC(DebModCamera, "Eiger::BadRecvFrameCorr", 
+		DEB_CLASS_NAMESPC(DebModCamera, "Eiger::BufferPool", 
 				  "SlsDetector");
 	public:
-		BadRecvFrameCorr(Eiger *eiger);
+		BufferPool();
 
-		virtual void prepareAcq();
-		virtual void correctFrame(FrameType frame, void *ptr);
+		Buffer *getBuffer(int size);
+		void release();
 
-	protected:
-		struct BadFrameData {
-			int last_idx;
-			IntList bad_frame_list;
-			void reset();
+		virtual void destroy(void *ptr);
+
+	private:
+		struct Block {
+			int size;
+			int node;
 		};
+		typedef std::vector<void *> PtrList;
+		typedef std::map<void *, Block> BlockMap;
+
+		static const int MaxNodeFreeBuffers;
+
+		virtual ~BufferPool();
+
+		AutoMutex lock()
+		{ return AutoMutex(m_mutex); }
+
+		static int getCurrentNode();
+		void *allocBlock(int size, int node);
+		void freeBlock(void *ptr);
+		void clearFreeList();
 
-		Camera *m_cam;
-		int m_nb_ports;
-		std::vector<BadFrameData> m_bfd_list;
+		Mutex m_mutex;
+		int m_size;
+		std::vector<PtrList> m_free_list;
+		BlockMap m_block_map;
+		bool m_released;
 	};
 
-	class PixelDepth4Corr : public CorrBase
+	class BadRecvFrameCorr : public CorrBase
 	{
-		DEB_CLASS_NAMESPC(DebModCamera, "Eiger::PixelDepth4Corr", 
+		DEB_CLASS_NAMESPC(DebModCamera, "Eiger::BadRecvFrameCorr", 
 				  "SlsDetector");
 	public:
-		PixelDepth4Corr(Eiger *eiger);
+		BadRecvFrameCorr(Eiger *eiger);
 
+		virtual void prepareAcq();
 		virtual void correctFrame(FrameType frame, void *ptr);
+		virtual bool copyCorrectFrame(FrameType frame, void *dest,
+					      const void *src, int size);
 
 	protected:
-		PortGeometryList& m_port_geom_list;
+		void updateBadPortList(FrameType frame);
+		void fillBadPorts(FrameType frame, void *ptr);
+
+		IntList m_bad_port_list;
 	};
 
+	// The inter-module gaps never receive data: they are cleared once
+	// in all the buffers of the ring in prepareAcq, not on every frame.
+	// Kept out of m_corr_list
 	class InterModGapCorr : public CorrBase
 	{
 		DEB_CLASS_NAMESPC(DebModCamera, "Eiger::InterModGapCorr", 
@@ -225,6 +572,9 @@ class Eiger : public Model
 	protected:
 		typedef std::pair<int, int> Block;
 		typedef std::vector<Block> BlockList;
+
+		void clearGaps(char *ptr, StreamCopy::FillFunc fill);
+
 		BlockList m_gap_list;
 	};
 
@@ -240,98 +590,48 @@ class Eiger : public Model
 		{
 			CorrBase::prepareAcq();
 
-			m_f.resize(m_nb_eiger_modules);
-			std::vector<BorderFactor>::iterator it = m_f.begin();
+			BorderFactorList f(m_nb_eiger_modules);
+			BorderFactorList::iterator it = f.begin();
 			for (int i = 0; i < m_nb_eiger_modules; ++i, ++it) {
 				it->resize(2);
 				(*it)[0] = m_eiger->getBorderCorrFactor(i, 0);
 				(*it)[1] = m_eiger->getBorderCorrFactor(i, 1);
 			}
-		}
-
-		virtual void correctFrame(FrameType frame, void *ptr)
-		{
-			correctBorderCols(ptr);
-			correctBorderRows(ptr);
-			correctInterChipCols(ptr);
-			correctInterChipRows(ptr);
-		}
-
-	private:
-		typedef std::vector<double> BorderFactor;
 
-		static void correctInterChipLine(T *d, int offset, int nb_iter, 
-						 int step) 
-		{
-			for (int i = 0; i < nb_iter; ++i, d += step)
-				d[0] = d[offset] /= 2;
-		}
-
-		static void correctBorderLine(T *d, int nb_iter, int step,
-					      double f) 
-		{
-			for (int i = 0; i < nb_iter; ++i, d += step)
-				d[0] /= f;
-		}
-
-		void correctInterChipCols(void *ptr)
-		{
 			int width = m_frame_size.getWidth();
-			int height= m_frame_size.getHeight();
-			T *d = static_cast<T *>(ptr);
-			for (int i = 0; i < HalfModuleChips - 1; ++i) {
-				d += ChipSize;
-				correctInterChipLine(d++, -1, height, width);
-				correctInterChipLine(d++, 1, height, width);
-			}
+			int mod_height = m_mod_frame_dim.getSize().getHeight();
+			m_corr.prepare(width, mod_height, m_inter_lines, f);
+			m_port_width = width / RecvPorts;
 		}
 
-		void correctInterChipRows(void *ptr)
+		virtual void correctFrame(FrameType /*frame*/, void *ptr)
 		{
-			int width = m_frame_size.getWidth();
-			int mod_height = m_mod_frame_dim.getSize().getHeight();
-			T *p = static_cast<T *>(ptr);
-			for (int i = 0; i < m_nb_eiger_modules; ++i) {
-				T *d = p + ChipSize * width;
-				correctInterChipLine(d, -width, width, 1);
-				d += width;
-				correctInterChipLine(d, width, width, 1);
-				if (i == m_nb_eiger_modules - 1)
-					continue;
-				p += (mod_height + m_inter_lines[i]) * width;
-			}
+			m_corr.correctFrame(ptr);
 		}
 
-		void correctBorderCols(void *ptr)
+		virtual bool copyCorrectFrame(FrameType /*frame*/, void *dest,
+					      const void *src, int /*size*/)
 		{
-			int width = m_frame_size.getWidth();
-			int height= m_frame_size.getHeight();
-			T *d = static_cast<T *>(ptr);
-			correctBorderLine(d, height, width, 2);
-			d += width - 1;
-			correctBorderLine(d, height, width, 2);
+			m_corr.correctFrame(dest, src);
+			return true;
 		}
 
-		void correctBorderRows(void *ptr)
+		virtual void correctRecvPort(int port_idx, 
+					     FrameType /*frame*/, char *bptr)
 		{
-			int width = m_frame_size.getWidth();
-			int mod_height = m_mod_frame_dim.getSize().getHeight();
-			T *p = static_cast<T *>(ptr);
-			for (int i = 0; i < m_nb_eiger_modules; ++i) {
-				double f0 = m_f[i][0], f1 = m_f[i][1];
-				T *d = p;
-				correctBorderLine(d, width, 1, f0);
-				d += width;
-				correctBorderLine(d, width, 1, f1);
-				d += (mod_height - 1 - 2) * width;
-				correctBorderLine(d, width, 1, f1);
-				d += width;
-				correctBorderLine(d, width, 1, f0);
-				p += (mod_height + m_inter_lines[i]) * width;
-			}
+			int recv_idx = port_idx / RecvPorts;
+			int port = port_idx % RecvPorts;
+			int c0 = port * m_port_width;
+			int c1 = (port == RecvPorts - 1) ? 
+					m_frame_size.getWidth() : 
+					c0 + m_port_width;
+			m_corr.correctHalfModule(bptr, recv_idx / 2, 
+						 (recv_idx % 2 == 0), c0, c1);
 		}
 
-		std::vector<BorderFactor> m_f;
+	private:
+		BorderPixelCorr<T> m_corr;
+		int m_port_width;
 	};
 
 	bool isPixelDepth4()
@@ -347,11 +647,13 @@ class Eiger : public Model
 	void getRecvFrameDim(FrameDim& frame_dim, bool raw, bool geom);
 
 	CorrBase *createBadRecvFrameCorr();
-	CorrBase *createPixelDepth4Corr();
 	CorrBase *createChipBorderCorr(ImageType image_type);
 	CorrBase *createInterModGapCorr();
 
 	void addCorr(CorrBase *corr);
+	void addRecvPortCorr(CorrBase *corr);
+	// only prepareAcq is called, no per-frame correction
+	void addPrepareCorr(CorrBase *corr);
 	void removeCorr(CorrBase *corr);
 	void removeAllCorr();
 
@@ -380,13 +682,19 @@ class Eiger : public Model
 	static const LinScale ChipRealReadout;
 
 	FrameDim m_recv_frame_dim;
+	CorrMode m_corr_mode;
+	int m_recv_packet_len;
 	CorrList m_corr_list;
+	CorrList m_port_corr_list;
+	CorrList m_prepare_corr_list;
 	PortGeometryList m_port_geom_list;
+	BufferPool *m_buffer_pool;
 	bool m_fixed_clock_div;
 	ClockDiv m_clock_div;
 };
 
 std::ostream& operator <<(std::ostream& os, Eiger::ParallelMode mode);
+std::ostream& operator <<(std::ostream& os, Eiger::CorrMode mode);
 
 } // namespace SlsDetector
 
@@ -81,6 +81,13 @@ class Model
 	void putCmd(const std::string& s, int idx = -1);
 	std::string getCmd(const std::string& s, int idx = -1);
 
+	// Lima buffer ring, valid after Camera::prepareAcq
+	int getNbBuffers();
+	char *getFrameBufferPtr(FrameType frame_nb);
+	// ports that declared a finished frame bad
+	void getBadPortList(FrameType frame, IntList& bad_port_list);
+	bool isTenGigabitEthernetEnabled();
+
 	virtual bool checkSettings(Settings settings) = 0;
 
 	virtual int getRecvPorts() = 0;
@@ -88,8 +95,25 @@ class Model
 	virtual void prepareAcq() = 0;
 	virtual void processRecvFileStart(int port_idx, uint32_t dsize) = 0;
 	// TODO: add file finished callback
+	// the missing packets of partial frames are received filled 
+	// with 0xff, and processed (masked) as such
 	virtual void processRecvPort(int port_idx, FrameType frame, char *dptr, 
 				     uint32_t dsize, char *bptr) = 0;
+	// if active, lost frames are also passed to processRecvPort, 
+	// with a NULL dptr, from the port thread
+	virtual bool isRecvPortCorrActive()
+	{ return false; }
+	// data length of the receiver packets, 0 if unknown: 
+	// no partial frame detection
+	virtual int getRecvPacketLen()
+	{ return 0; }
+	// size of the port frame data sent by the detector, 0 if unknown
+	virtual uint32_t getRecvPortDataSize()
+	{ return 0; }
+	// offset in the Lima buffer where the port data can be received
+	// as is (direct placement), -1 if it must be copied
+	virtual int getRecvPortDirectOffset(int /*port_idx*/)
+	{ return -1; }
 
  private:
 	friend class Camera;
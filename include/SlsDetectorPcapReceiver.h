@@ -0,0 +1,135 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef __SLS_DETECTOR_PCAP_RECEIVER_H
+#define __SLS_DETECTOR_PCAP_RECEIVER_H
+
+#include "SlsDetectorUdpReceiver.h"
+
+namespace lima
+{
+
+namespace SlsDetector
+{
+
+// Sequential reader of the IPv4/UDP packets in a pcap or pcapng capture
+// (Ethernet, VLAN, Linux cooked or raw IP link types). The file is mapped
+// in memory: packet payloads point into it. Truncated (snaplen) and
+// fragmented packets are skipped
+class PcapFile
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "PcapFile", "SlsDetector");
+
+ public:
+	struct Packet {
+		double time;
+		uint32_t dst_ip;	// host byte order
+		int udp_port;
+		const char *data;
+		int len;
+	};
+
+	PcapFile(std::string fname);
+	~PcapFile();
+
+	// false at end of file
+	bool next(Packet& packet);
+	void rewind();
+
+	int getNbSkippedPackets()
+	{ return m_nb_skipped; }
+
+ private:
+	enum Format { Pcap, PcapNg };
+
+	struct Interface {
+		int link_type;
+		double time_unit;
+	};
+	typedef std::vector<Interface> InterfaceList;
+
+	uint16_t get16(const char *p);
+	uint32_t get32(const char *p);
+	void readFileHeader();
+	bool nextPcapNgRecord(const char *& p, int& len, int& link_type,
+			      double& time);
+	void readInterface(const char *b, uint32_t block_len);
+	bool decodePacket(const char *p, int len, int link_type,
+			  Packet& packet);
+
+	std::string m_fname;
+	const char *m_map;
+	size_t m_size;
+	Format m_format;
+	bool m_swap;
+	size_t m_first_offset;
+	size_t m_offset;
+	int m_link_type;
+	double m_time_unit;
+	double m_last_time;
+	InterfaceList m_if_list;
+	int m_nb_skipped;
+};
+
+
+// Replay of the packets sent to a detector data port in a capture,
+// through the same frame assembly as the native receivers. time_scale
+// gives the replay timing: 1 for the original one, 2 twice slower,
+// 0 as fast as possible
+class PcapPortReceiver : public PortPacketReceiver
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "PcapPortReceiver", "SlsDetector");
+
+ public:
+	PcapPortReceiver(FrameHandler *handler, std::string fname,
+			 int udp_port, double time_scale = 1,
+			 int nb_packets = 64);
+	virtual ~PcapPortReceiver();
+
+	virtual int poll(double timeout);
+
+	// all the port packets were replayed
+	bool isFinished()
+	{ return m_finished; }
+	void rewind();
+
+ private:
+	bool readNext();
+
+	PcapFile m_file;
+	int m_udp_port;
+	double m_time_scale;
+	int m_nb_packets;
+	bool m_finished;
+	bool m_pending;
+	PcapFile::Packet m_packet;
+	double m_t0;
+	double m_capture_t0;
+};
+
+
+} // namespace SlsDetector
+
+} // namespace lima
+
+
+#endif // __SLS_DETECTOR_PCAP_RECEIVER_H
@@ -25,8 +25,12 @@
 
 #include "SlsDetectorModel.h"
 #include "SlsDetectorCPUAffinity.h"
+#include "SlsDetectorXdpReceiver.h"
 #include "slsReceiverUsers.h"
 
+#include <atomic>
+#include <memory>
+
 namespace lima 
 {
 
@@ -34,6 +38,8 @@ namespace SlsDetector
 {
 
 class Camera;
+class FinishedFrameQueues;
+typedef std::shared_ptr<FinishedFrameQueues> FinishedFrameQueuesPtr;
 
 class Receiver 
 {
@@ -45,11 +51,47 @@ public:
 
 	void start();
 	void setNbPorts(int nb_ports);
+	// data ports and IP address, used by the Native/XdpRecvEngine
+	void setUdpPortList(const IntList& udp_port_list);
+	void setUdpIp(std::string udp_ip);
 
 	void prepareAcq();
+	// after Model::prepareAcq, without the Camera lock
+	void prepareNativePorts();
 
 	void setCPUAffinity(const RecvCPUAffinity& recv_affinity);
 
+	// Direct placement: the final place of a port frame in the Lima 
+	// buffers, where the receiver FIFO slot can be mapped. NULL if the 
+	// frame must be received in a FIFO slot and copied
+	char *getPortFrameBuffer(int port, FrameType det_frame);
+
+	// Local stand-in for the slsReceiver port FIFO, for testing: 
+	// frames are received in place when possible, otherwise in its slots
+	class LocalFifo 
+	{
+		DEB_CLASS_NAMESPC(DebModCamera, "Receiver::LocalFifo", 
+				  "SlsDetector");
+	public:
+		LocalFifo(Receiver *recv, int port, uint32_t slot_size, 
+			  int nb_slots = 4);
+
+		void receive(const FrameMetaData& md, const char *data, 
+			     uint32_t dsize);
+
+		int getNbDirectFrames()
+		{ return m_nb_direct_frames; }
+
+	private:
+		Receiver *m_recv;
+		int m_port;
+		uint32_t m_slot_size;
+		int m_nb_slots;
+		int m_next_slot;
+		int m_nb_direct_frames;
+		std::vector<char> m_slot_mem;
+	};
+
 private:
 	friend class Camera;
 
@@ -59,13 +101,20 @@ private:
 				  "SlsDetector");
 	public:
 		struct Stats {
-			SlsDetector::Stats stats;
-			Timestamp last_t0;
-			Timestamp last_t1;
+			StatsRecorder stats;
+			int64_t last_t0;
+			int64_t last_t1;
+			FrameType last_det_frame;
+			uint64_t last_det_timestamp;
+			Stats() : last_t0(0), last_t1(0), last_det_frame(-1),
+				  last_det_timestamp(0)
+			{}
 			void reset()
 			{
 				stats.reset();
-				last_t0 = last_t1 = Timestamp();
+				last_t0 = last_t1 = 0;
+				last_det_frame = -1;
+				last_det_timestamp = 0;
 			}
 		};
 	
@@ -73,36 +122,58 @@ private:
 
 		pid_t getThreadID()
 		{ return m_thread.getThreadID(); }
+		std::string getThreadName();
 		
 		void prepareAcq();
 
 		void processFileStart(uint32_t dsize);
-		void processFrame(FrameType frame, char *dptr, uint32_t dsize);
+		void processFrame(FrameType frame, char *dptr, uint32_t dsize,
+				  const FrameMetaData& md);
+		void declareLostFrames(FrameType last_lost);
 
 		bool isBadFrame(FrameType frame);
+
+		int getNbLateFrames()
+		{ return m_nb_late_frames.load(std::memory_order_relaxed); }
+
+		int getNbPartialFrames()
+		{ return m_nb_partial_frames.load(std::memory_order_relaxed); }
+
+		int getNbLostPackets()
+		{ return m_nb_lost_packets.load(std::memory_order_relaxed); }
 	
 		int getNbBadFrames()
 		{
 			AutoMutex l = lock();
-			return m_bad_frame_list.size();
+			return m_bad_frame_set.getNbFrames();
 		}
 	
 		void getBadFrameList(int first_idx, int last_idx, IntList& bfl)
 		{
 			AutoMutex l = lock();
-			IntList::const_iterator b = m_bad_frame_list.begin();
-			bfl.assign(b + first_idx, b + last_idx);
+			m_bad_frame_set.getFrameList(first_idx, last_idx, bfl);
+		}
+
+		void getBadFrameSet(int first_idx, int last_idx, 
+				    FrameRangeSet& bfs)
+		{
+			AutoMutex l = lock();
+			m_bad_frame_set.getSubSet(first_idx, last_idx, bfs);
 		}
 		
-		Stats& getStats()
-		{ return m_stats; }
+		void getStats(SlsDetector::Stats& stats)
+		{ m_stats.stats.getSnapshot(stats); }
+
+		bool getFrameMetaData(FrameType frame, FrameMetaData& md)
+		{ return m_meta_data_ring.get(frame, md); }
+
+		char *getDirectFrameBuffer(FrameType frame);
 
 	private:
 		friend class Receiver;
 
 		typedef FrameMap::Item::FinishInfo FinishInfo;
 		typedef FrameMap::Item::FinishInfoList FinishInfoList;
-		typedef std::vector<FinishInfo> FinishInfoArray;
 		
 		class Thread : public lima::Thread
 		{
@@ -130,18 +201,85 @@ private:
 		void pollFrameFinished();
 		void stopPollFrameFinished();
 		void processFinishInfo(const FinishInfo& finfo);
+		void writeFrame(FrameType frame, char *dptr, uint32_t dsize);
+		// called with m_frame_mutex, or while m_write_frame is set
+		void fillLostFrames(FrameType frame, bool valid);
+		void pushFinishedFrame(FrameType frame, bool valid);
 		
 		Camera *m_cam;
 		Model *m_model;
 		int m_port_idx;
 		Mutex m_mutex;
+		Mutex m_frame_mutex;
 		FrameMap::Item *m_frame_map_item;
-		IntList m_bad_frame_list;
+		// written by the receiver thread, read without lock
+		std::atomic<int> m_nb_late_frames;
+		std::atomic<int> m_nb_partial_frames;
+		std::atomic<int> m_nb_lost_packets;
+		// direct buffer given to the receiver, not finished yet
+		FrameType m_direct_frame;
+		// written by processFrame without the lock, not finished yet
+		FrameType m_write_frame;
+		FrameRangeSet m_bad_frame_set;
+		// current acquisition, protected by m_mutex
+		FinishedFrameQueuesPtr m_finished_queues;
+		FrameMetaDataRing m_meta_data_ring;
 		Stats m_stats;
 		Thread m_thread;
 	};
 	typedef std::vector<AutoPtr<Port> > PortList;
 
+	// Native/XdpRecvEngine port: PortPacketReceiver driven by its own 
+	// thread, frames are passed to portCallback as slsReceiver does
+	class NativePort : public PortPacketReceiver::FrameHandler
+	{
+		DEB_CLASS_NAMESPC(DebModCamera, "Receiver::NativePort", 
+				  "SlsDetector");
+	public:
+		NativePort(Receiver& recv, int port, int udp_port);
+		virtual ~NativePort();
+
+		pid_t getThreadID()
+		{ return m_thread.getThreadID(); }
+		std::string getThreadName();
+
+		void prepareAcq(uint32_t frame_size, int packet_len);
+		void getCounters(PortPacketReceiver::Counters& counters);
+
+		virtual char *getFrameBuffer(FrameType det_frame);
+		virtual void frameReceived(const FrameMetaData& md, 
+					   char *dptr, uint32_t dsize);
+
+	private:
+		class Thread : public lima::Thread
+		{
+			DEB_CLASS_NAMESPC(DebModCamera, 
+					  "Receiver::NativePort::Thread", 
+					  "SlsDetector");
+		public:
+			Thread(NativePort& port);
+			virtual ~Thread();
+
+			virtual void start();
+
+		protected:
+			virtual void threadFunction();
+
+		private:
+			NativePort& m_port;
+			volatile bool m_end;
+		};
+
+		void pollPackets();
+
+		Receiver& m_recv;
+		int m_port;
+		Mutex m_mutex;
+		AutoPtr<PortPacketReceiver> m_packet_recv;
+		Thread m_thread;
+	};
+	typedef std::vector<AutoPtr<NativePort> > NativePortList;
+
 	static int fileStartCallback(char *fpath, char *fname, 
 				     FrameType fidx, uint32_t dsize, 
 				     void *priv);
@@ -162,9 +300,19 @@ private:
 
 	int fileStartCallback(char *fpath, char *fname, uint64_t fidx, 
 			      uint32_t dsize);
-	void portCallback(FrameType det_frame, int port, char *dptr, 
+	void portCallback(int port, const FrameMetaData& md, char *dptr, 
 			  uint32_t dsize);
 
+	// false if the detector frame is skipped
+	bool getLimaFrame(FrameType det_frame, FrameType& lima_frame);
+
+	void updateNativePorts();
+	PortPacketReceiver *createPacketReceiver(NativePort *port, 
+						 int port_idx, int udp_port);
+	std::string getUdpNetDev();
+	IntList getXdpQueueList(const std::string& net_dev, int port_idx);
+	void applyNativeCPUAffinity();
+
 	void getNodeMaskList(const CPUAffinityList& listener,
 			     const CPUAffinityList& writer,
 			     slsReceiverUsers::NodeMaskList& fifo_node_mask,
@@ -176,6 +324,11 @@ private:
 	Args m_args;
 	AutoPtr<slsReceiverUsers> m_recv;
 	PortList m_port_list;
+	IntList m_udp_port_list;
+	std::string m_udp_ip;
+	RecvEngine m_native_engine;
+	NativePortList m_native_port_list;
+	CPUAffinityList m_native_aff_list;
 }; 
 
 
@@ -0,0 +1,84 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+#ifndef __SLS_DETECTOR_STREAM_COPY_H
+#define __SLS_DETECTOR_STREAM_COPY_H
+
+#include "SlsDetectorDefs.h"
+
+namespace lima 
+{
+
+namespace SlsDetector
+{
+
+/*
+ * Bulk copy/fill kernels for data that the writing core does not read back,
+ * like the image buffers filled by the Receiver port threads. The SIMD
+ * versions use non-temporal (streaming) stores, so fence() must be called
+ * before the data is published to another thread. The best level supported
+ * by the CPU is selected at run time, unless forced with setLevel.
+ */
+
+class StreamCopy
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "StreamCopy", "SlsDetector");
+
+public:
+	enum Level {
+		Auto, Std, SSE2, AVX2, AVX512,
+	};
+	typedef std::vector<Level> LevelList;
+
+	typedef void (*CopyFunc)(char *dest, const char *src, int len);
+	typedef void (*FillFunc)(char *dest, int val, int len);
+	// 4-bit pixel expansion, len is the packed (source) size
+	typedef void (*Expand4Func)(char *dest, const char *src, int len);
+
+	static bool isSupported(Level level);
+	static Level getBestLevel();
+	static void getSupportedLevelList(LevelList& level_list);
+
+	static void setLevel(Level  level);
+	static void getLevel(Level& level);
+
+	static CopyFunc getCopyFunc(Level level = Auto);
+	static FillFunc getFillFunc(Level level = Auto);
+	static Expand4Func getExpand4Func(Level level = Auto);
+
+	static void fence();
+
+private:
+	static Level checkLevel(Level level);
+
+	static std::atomic<Level> s_level;
+};
+
+std::ostream& operator <<(std::ostream& os, StreamCopy::Level level);
+
+
+} // namespace SlsDetector
+
+} // namespace lima
+
+#endif // __SLS_DETECTOR_STREAM_COPY_H
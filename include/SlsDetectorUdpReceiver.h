@@ -0,0 +1,173 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+#ifndef __SLS_DETECTOR_UDP_RECEIVER_H
+#define __SLS_DETECTOR_UDP_RECEIVER_H
+
+#include "SlsDetectorDefs.h"
+
+#include <sys/socket.h>
+
+namespace lima
+{
+
+namespace SlsDetector
+{
+
+// Eiger UDP data packet header, v2 (firmware >= 20)
+struct PacketHeader {
+	uint64_t frame;
+	uint32_t exp_len;
+	uint32_t packet;
+	uint64_t bunch_id;
+	uint64_t timestamp;
+	uint16_t mod_id;
+	uint16_t x, y, z;
+	uint32_t debug;
+	uint16_t rr_nb;
+	uint8_t det_type;
+	uint8_t version;
+} __attribute__((packed));
+
+static_assert(sizeof(PacketHeader) == 48, "Invalid PacketHeader size");
+
+
+// Assembly of the port frames from the detector packets, independent of 
+// how the packets are received. The packet payloads are placed at their 
+// offset (packet number) in the port frame, which can be the final Lima 
+// buffer. Frames are delivered to the FrameHandler when complete, or 
+// incomplete (missing packets filled with 0xff) when a newer frame starts 
+// or on flush
+class PortPacketReceiver
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "PortPacketReceiver", "SlsDetector");
+
+ public:
+	class FrameHandler
+	{
+	public:
+		virtual ~FrameHandler() {}
+		// destination of a port frame, NULL for an internal slot
+		virtual char *getFrameBuffer(FrameType det_frame) = 0;
+		virtual void frameReceived(const FrameMetaData& md,
+					   char *dptr, uint32_t dsize) = 0;
+	};
+
+	struct Counters {
+		uint64_t nb_packets;
+		uint64_t nb_frames;
+		uint64_t nb_partial_frames;
+		uint64_t nb_lost_packets;
+		uint64_t nb_late_packets;
+		uint64_t nb_invalid_packets;
+		Counters();
+	};
+
+	PortPacketReceiver(FrameHandler *handler);
+	virtual ~PortPacketReceiver();
+
+	void prepareAcq(uint32_t frame_size, int packet_len);
+
+	// receives the available packets, waiting up to timeout:
+	// returns the number of packets
+	virtual int poll(double timeout) = 0;
+	// the current frame is delivered, even if incomplete
+	void flush();
+
+	void getCounters(Counters& counters)
+	{ counters = m_counters; }
+
+ protected:
+	// packet (header + payload) split in several fragments
+	void processPacket(const iovec *frag, int nb_frags);
+	void processPacket(const char *p, int len);
+
+	void countInvalidPacket()
+	{ ++m_counters.nb_invalid_packets; }
+
+ private:
+	void startFrame(FrameType det_frame, const PacketHeader& h);
+	void finishFrame();
+
+	FrameHandler *m_handler;
+	uint32_t m_frame_size;
+	int m_packet_len;
+	int m_frame_packets;
+	std::vector<char> m_slot;
+	std::vector<uint64_t> m_packet_mask;
+
+	FrameType m_frame;
+	bool m_frame_done;
+	char *m_frame_ptr;
+	int m_recv_packets;
+	FrameMetaData m_md;
+	Counters m_counters;
+};
+
+std::ostream& operator <<(std::ostream& os,
+			  const PortPacketReceiver::Counters& c);
+
+
+// Native receiver of a detector data port: one SO_REUSEPORT socket read
+// with recvmmsg, with UDP GRO when available
+class UdpPortReceiver : public PortPacketReceiver
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "UdpPortReceiver", "SlsDetector");
+
+ public:
+	// udp_port 0: ephemeral port, see getUdpPort
+	UdpPortReceiver(FrameHandler *handler, int udp_port,
+			std::string addr = "0.0.0.0", int nb_msgs = 16);
+	virtual ~UdpPortReceiver();
+
+	int getUdpPort()
+	{ return m_udp_port; }
+	bool isGROActive()
+	{ return m_gro; }
+
+	virtual int poll(double timeout);
+
+ private:
+	// GRO can coalesce up to 64 KB in a single message
+	static const int MsgBufferLen = 64 * 1024;
+
+	void openSocket(const std::string& addr);
+	void processMsg(const char *p, int len, int seg_len);
+
+	int m_udp_port;
+	int m_fd;
+	bool m_gro;
+	int m_nb_msgs;
+	std::vector<char> m_msg_buffer;
+	std::vector<mmsghdr> m_msg_list;
+	std::vector<iovec> m_iov_list;
+	std::vector<char> m_ctrl_buffer;
+};
+
+
+} // namespace SlsDetector
+
+} // namespace lima
+
+
+#endif // __SLS_DETECTOR_UDP_RECEIVER_H
@@ -0,0 +1,85 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+
+#ifndef __SLS_DETECTOR_XDP_RECEIVER_H
+#define __SLS_DETECTOR_XDP_RECEIVER_H
+
+#include "SlsDetectorUdpReceiver.h"
+
+namespace lima
+{
+
+namespace SlsDetector
+{
+
+// AF_XDP receiver of a detector data port: one UMEM and XSK socket per 
+// NIC Rx queue of the network device, the payloads are copied from the 
+// UMEM straight to the port frame. The flow of the data port must be 
+// steered to the given queues (ethtool -N ... action <queue>): other 
+// traffic arriving on them is dropped. Zero-copy driver mode is tried 
+// first, falling back to copy and to generic (SKB) mode, which also 
+// works on veth devices. Requires compilation with SLSDETECTOR_AF_XDP
+class XdpPortReceiver : public PortPacketReceiver
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "XdpPortReceiver", "SlsDetector");
+
+ public:
+	enum Mode {
+		ZeroCopyMode, DriverCopyMode, GenericMode,
+	};
+
+	XdpPortReceiver(FrameHandler *handler, int udp_port, 
+			std::string net_dev, const IntList& queue_list);
+	virtual ~XdpPortReceiver();
+
+	static bool isAvailable();
+
+	Mode getMode()
+	{ return m_mode; }
+
+	virtual int poll(double timeout);
+
+ private:
+	struct Queue;
+	typedef std::vector<AutoPtr<Queue> > QueueList;
+
+	int processQueue(Queue& q);
+	void processFrame(iovec *frag, int nb_frags);
+
+	int m_udp_port;
+	std::string m_net_dev;
+	Mode m_mode;
+	QueueList m_queue_list;
+	std::vector<iovec> m_frag_list;
+};
+
+std::ostream& operator <<(std::ostream& os, XdpPortReceiver::Mode mode);
+
+
+} // namespace SlsDetector
+
+} // namespace lima
+
+
+#endif // __SLS_DETECTOR_XDP_RECEIVER_H
@@ -1641,6 +1641,14 @@ void GlobalCPUAffinityMgr::recvFinished()
 		filter = SystemCPUAffinityMgr::MatchAffinity;
 		m_lima_tids = SystemCPUAffinityMgr::getThreadList(filter,
 								m_curr.lima);
+		// the receiver threads keep their own affinity
+		ThreadRegistry& registry = m_cam->m_thread_registry;
+		ProcList recv_tids = registry.getAffinityTIDList();
+		ProcList::const_iterator it, end = recv_tids.end();
+		for (it = recv_tids.begin(); it != end; ++it)
+			m_lima_tids.erase(remove(m_lima_tids.begin(),
+						 m_lima_tids.end(), *it),
+					  m_lima_tids.end());
 		DEB_ALWAYS() << "Lima TIDs: " << PrettyIntList(m_lima_tids);
 		CPUAffinity lima_affinity = m_curr.lima | recv_all;
 		DEB_ALWAYS() << "Allowing Lima to run on Recv CPUs: " 
@@ -1709,6 +1717,225 @@ void GlobalCPUAffinityMgr::cleanUp()
 	m_state = Ready;
 }
 
+ThreadRegistry::ThreadRegistry()
+{
+	DEB_CONSTRUCTOR();
+}
+
+ThreadRegistry::~ThreadRegistry()
+{
+	DEB_DESTRUCTOR();
+}
+
+void ThreadRegistry::registerThread(string name, pid_t tid,
+				    ThreadSchedParams def_params)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(name, tid, def_params);
+
+	// the kernel truncates the thread names to 15 characters
+	string comm_fname = CPUAffinity::getTaskProcDir(tid, true) + "comm";
+	ofstream comm_file(comm_fname.c_str());
+	if (comm_file)
+		comm_file << name.substr(0, 15) << flush;
+	if (!comm_file)
+		DEB_WARNING() << "Could not set thread " << tid << " name "
+			      << "to " << name;
+
+	AutoMutex l(m_mutex);
+	Entry entry = {tid, def_params, false};
+	try {
+		// keep the current scheduling if no default is given
+		if (def_params.policy == SchedDefault) {
+			ThreadSchedParams curr;
+			getTaskSchedParams(tid, curr);
+			entry.def_params.policy = curr.policy;
+			entry.def_params.priority = curr.priority;
+		}
+		ThreadSchedParams params = getEffectiveParams(name, entry);
+		int flags = ApplySched;
+		if (params.cpu_affinity.getZeroDefaultMask())
+			flags |= ApplyAffinity;
+		apply(name, tid, params, flags);
+	} catch (Exception& e) {
+		DEB_ERROR() << "Could not set thread " << name << " "
+			    << "scheduling: " << e;
+	}
+	m_entry_map[name] = entry;
+}
+
+void ThreadRegistry::unregisterThread(string name, pid_t tid)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(name, tid);
+
+	AutoMutex l(m_mutex);
+	EntryMap::iterator it = m_entry_map.find(name);
+	if ((it != m_entry_map.end()) && (it->second.tid == tid))
+		m_entry_map.erase(it);
+}
+
+void ThreadRegistry::setThreadCPUAffinity(string name, 
+					  CPUAffinity cpu_affinity)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(name, cpu_affinity);
+
+	AutoMutex l(m_mutex);
+	EntryMap::iterator it = m_entry_map.find(name);
+	if (it == m_entry_map.end())
+		THROW_HW_ERROR(Error) << "Thread " << name << " not registered";
+	Entry& entry = it->second;
+	entry.def_params.cpu_affinity = cpu_affinity;
+	entry.affinity_set = true;
+	ThreadSchedParams params = getEffectiveParams(name, entry);
+	apply(name, entry.tid, params, ApplyAffinity);
+}
+
+void ThreadRegistry::setThreadSchedParams(string name, 
+					  ThreadSchedParams params)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(name, params);
+
+	if (params.policy != SchedDefault) {
+		int min_prio = sched_get_priority_min(params.policy);
+		int max_prio = sched_get_priority_max(params.policy);
+		if ((min_prio < 0) || (max_prio < 0))
+			THROW_HW_ERROR(InvalidValue) << "Invalid " 
+						     << DEB_VAR1(params.policy);
+		if ((params.priority < min_prio) || 
+		    (params.priority > max_prio))
+			THROW_HW_ERROR(InvalidValue) << "Invalid " 
+						     << params.policy << " "
+						     << "priority " 
+						     << params.priority << ": "
+						     << "must be in [" 
+						     << min_prio << ", " 
+						     << max_prio << "]";
+	}
+
+	AutoMutex l(m_mutex);
+	// kept for the next thread registered with the same name
+	m_user_params_map[name] = params;
+	EntryMap::iterator it = m_entry_map.find(name);
+	if (it == m_entry_map.end())
+		return;
+	Entry& entry = it->second;
+	ThreadSchedParams eff_params = getEffectiveParams(name, entry);
+	int flags = ApplySched;
+	if (entry.affinity_set || params.cpu_affinity.getZeroDefaultMask())
+		flags |= ApplyAffinity;
+	apply(name, entry.tid, eff_params, flags);
+}
+
+void ThreadRegistry::getThreadSchedParams(string name, 
+					  ThreadSchedParams& params)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(name);
+
+	AutoMutex l(m_mutex);
+	ParamsMap::const_iterator it = m_user_params_map.find(name);
+	params = (it != m_user_params_map.end()) ? it->second : 
+						   ThreadSchedParams();
+	DEB_RETURN() << DEB_VAR1(params);
+}
+
+void ThreadRegistry::getThreadInfoList(ThreadInfoList& info_list)
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l(m_mutex);
+	info_list.clear();
+	EntryMap::const_iterator it, end = m_entry_map.end();
+	for (it = m_entry_map.begin(); it != end; ++it) {
+		ThreadInfo info;
+		info.name = it->first;
+		info.tid = it->second.tid;
+		getTaskSchedParams(info.tid, info.sched_params);
+		info_list.push_back(info);
+	}
+}
+
+ProcList ThreadRegistry::getAffinityTIDList()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l(m_mutex);
+	ProcList tid_list;
+	EntryMap::const_iterator it, end = m_entry_map.end();
+	for (it = m_entry_map.begin(); it != end; ++it)
+		if (it->second.affinity_set)
+			tid_list.push_back(it->second.tid);
+	DEB_RETURN() << DEB_VAR1(PrettyIntList(tid_list));
+	return tid_list;
+}
+
+void ThreadRegistry::getTaskSchedParams(pid_t tid, ThreadSchedParams& params)
+{
+	DEB_STATIC_FUNCT();
+	DEB_PARAM() << DEB_VAR1(tid);
+
+	int policy = sched_getscheduler(tid);
+	struct sched_param param;
+	cpu_set_t cpu_set;
+	if ((policy < 0) || (sched_getparam(tid, &param) != 0) ||
+	    (sched_getaffinity(tid, sizeof(cpu_set), &cpu_set) != 0))
+		THROW_HW_ERROR(Error) << "Error reading task " << tid << " "
+				      << "scheduling: " << strerror(errno);
+
+	uint64_t mask = 0;
+	for (unsigned int i = 0; i < sizeof(mask) * 8; ++i)
+		if (CPU_ISSET(i, &cpu_set))
+			mask |= uint64_t(1) << i;
+	policy &= ~SCHED_RESET_ON_FORK;
+	params = ThreadSchedParams(SchedPolicy(policy), param.sched_priority,
+				   CPUAffinity(mask));
+	DEB_RETURN() << DEB_VAR1(params);
+}
+
+ThreadSchedParams ThreadRegistry::getEffectiveParams(const string& name,
+						     const Entry& entry)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(name);
+
+	ThreadSchedParams params = entry.def_params;
+	ParamsMap::const_iterator it = m_user_params_map.find(name);
+	if (it != m_user_params_map.end()) {
+		const ThreadSchedParams& user = it->second;
+		if (user.policy != SchedDefault) {
+			params.policy = user.policy;
+			params.priority = user.priority;
+		}
+		if (user.cpu_affinity.getZeroDefaultMask())
+			params.cpu_affinity = user.cpu_affinity;
+	}
+	DEB_RETURN() << DEB_VAR1(params);
+	return params;
+}
+
+void ThreadRegistry::apply(const string& name, pid_t tid, 
+			   const ThreadSchedParams& params, int flags)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR4(name, tid, params, flags);
+
+	if ((flags & ApplySched) && (params.policy != SchedDefault)) {
+		struct sched_param param;
+		param.sched_priority = params.priority;
+		if (sched_setscheduler(tid, params.policy, &param) != 0)
+			THROW_HW_ERROR(Error) << "Could not set thread " 
+					      << name << " " << params.policy
+					      << " priority " 
+					      << params.priority << ": "
+					      << strerror(errno);
+	}
+	if (flags & ApplyAffinity)
+		params.cpu_affinity.applyToTask(tid, false);
+}
+
 ostream& lima::SlsDetector::operator <<(ostream& os, const CPUAffinity& a)
 {
 	return os << hex << "0x" << setw(CPUAffinity::getNbHexDigits())
@@ -1787,3 +2014,32 @@ lima::SlsDetector::operator <<(ostream& os, const PixelDepthCPUAffinityMap& m)
 	return os << "]";
 }
 
+ostream& lima::SlsDetector::operator <<(ostream& os, SchedPolicy policy)
+{
+	const char *name = "Unknown";
+	switch (policy) {
+	case SchedDefault:	name = "Default";	break;
+	case SchedOther:	name = "Other";		break;
+	case SchedFIFO:		name = "FIFO";		break;
+	case SchedRR:		name = "RR";		break;
+	case SchedBatch:	name = "Batch";		break;
+	case SchedIdle:		name = "Idle";		break;
+	}
+	return os << name;
+}
+
+ostream& lima::SlsDetector::operator <<(ostream& os, const ThreadSchedParams& p)
+{
+	os << "<";
+	os << "policy=" << p.policy << ", priority=" << p.priority << ", "
+	   << "cpu_affinity=" << p.cpu_affinity;
+	return os << ">";
+}
+
+ostream& lima::SlsDetector::operator <<(ostream& os, const ThreadInfo& i)
+{
+	os << "<";
+	os << "name=" << i.name << ", tid=" << i.tid << ", " 
+	   << "sched_params=" << i.sched_params;
+	return os << ">";
+}
@@ -81,6 +81,39 @@ void Camera::AppInputData::parseConfigFile()
 			recv_port_map[id] = rx_tcpport;
 			continue;
 		}
+
+		re = "([0-9]+):rx_udpport(2?)";
+		if (re.match(s, full_match)) {
+			istringstream is(full_match[1]);
+			int id;
+			is >> id;
+			if (id < 0)
+				THROW_HW_FATAL(InvalidValue) << 
+					"Invalid detector id: " << id;
+			string p = full_match[2];
+			unsigned int port = p.empty() ? 0 : 1;
+			int rx_udpport;
+			config_file >> rx_udpport;
+			IntList& udp_port_list = recv_udp_port_map[id];
+			if (udp_port_list.size() <= port)
+				udp_port_list.resize(port + 1);
+			udp_port_list[port] = rx_udpport;
+			continue;
+		}
+
+		re = "([0-9]+):rx_udpip";
+		if (re.match(s, full_match)) {
+			istringstream is(full_match[1]);
+			int id;
+			is >> id;
+			if (id < 0)
+				THROW_HW_FATAL(InvalidValue) << 
+					"Invalid detector id: " << id;
+			string rx_udpip;
+			config_file >> rx_udpip;
+			recv_udp_ip_map[id] = rx_udpip;
+			continue;
+		}
 	}
 }
 
@@ -97,10 +130,77 @@ Camera::AcqThread::ExceptionCleanUp::~ExceptionCleanUp()
 	thread->cleanUp();
 }
 
+FinishedFrameQueues::FinishedFrameQueues(Camera *cam, int nb_ports, 
+					 int nb_buffers, WaitPolicy wait_policy)
+	: m_cam(cam), m_event(wait_policy), m_overrun(false)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR2(nb_ports, nb_buffers);
+
+	for (int i = 0; i < nb_ports; ++i)
+		m_queue_list.push_back(new Queue(nb_buffers));
+}
+
+void FinishedFrameQueues::queueFrames(int port_idx, 
+				      const FrameRangeSpan& finished)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(port_idx, finished);
+
+	// each range has at least one frame: a full queue means that more
+	// than nb_buffers finished frames were not processed
+	Queue& queue = *m_queue_list[port_idx];
+	FrameRangeSpan::const_iterator it, end = finished.end();
+	for (it = finished.begin(); it != end; ++it) {
+		if (queue.push(*it))
+			continue;
+		ostringstream err_msg;
+		err_msg << "AcqThread overrun: finished queue full: "
+			<< "port_idx=" << port_idx << ", frames=" << *it;
+		reportOverrun(err_msg.str());
+		break;
+	}
+	m_event.signal();
+}
+
+void FinishedFrameQueues::drain(FrameRangeList& finished_list)
+{
+	DEB_MEMBER_FUNCT();
+	QueueList::iterator it, end = m_queue_list.end();
+	for (it = m_queue_list.begin(); it != end; ++it)
+		(*it)->pop_all(finished_list);
+}
+
+void FinishedFrameQueues::reportOverrun(const string& msg)
+{
+	DEB_MEMBER_FUNCT();
+	if (m_overrun.exchange(true))
+		return;
+	Event::Code err_code = Event::CamOverrun;
+	Event *event = new Event(Hardware, Event::Error, Event::Camera, 
+				 err_code, msg);
+	DEB_EVENT(*event) << DEB_VAR1(*event);
+	m_cam->reportEvent(event);
+}
+
 Camera::AcqThread::AcqThread(Camera *cam)
-	: m_cam(cam), m_cond(m_cam->m_cond), m_state(m_cam->m_state)
+	: m_cam(cam), m_cond(m_cam->m_cond), m_state(m_cam->m_state),
+	  m_finished_queues(m_cam->m_finished_queues),
+	  m_seq_filter(m_cam->m_frame_map.getBufferSize())
 {
 	DEB_CONSTRUCTOR();
+
+	int nb_buffers = m_cam->m_frame_map.getBufferSize();
+	int nb_ports = m_cam->getTotNbPorts();
+	m_finished_list.reserve(nb_ports * nb_buffers);
+}
+
+Camera::AcqThread::~AcqThread()
+{
+	DEB_DESTRUCTOR();
+	if (hasStarted())
+		m_cam->m_thread_registry.unregisterThread("slsAcq", 
+							  getThreadID());
 }
 
 void Camera::AcqThread::start()
@@ -110,11 +210,10 @@ void Camera::AcqThread::start()
 	m_state = Starting;
 	Thread::start();
 
-	struct sched_param param;
-	param.sched_priority = sched_get_priority_min(SCHED_RR);
-	int ret = pthread_setschedparam(m_thread, SCHED_RR, &param);
-	if (ret != 0)
-		DEB_ERROR() << "Could not set AcqThread real-time priority!!";
+	int prio = sched_get_priority_min(SCHED_RR);
+	ThreadSchedParams def_params(SchedRR, prio);
+	m_cam->m_thread_registry.registerThread("slsAcq", getThreadID(), 
+						def_params);
 
 	while (m_state != Running)
 		m_cond.wait();
@@ -125,6 +224,7 @@ void Camera::AcqThread::stop(bool wait)
 	DEB_MEMBER_FUNCT();
 	m_state = StopReq;
 	m_cond.broadcast();
+	m_finished_queues->signal();
 	while (wait && (m_state != Stopped) && (m_state != Idle))
 		m_cond.wait();
 }
@@ -147,36 +247,45 @@ void Camera::AcqThread::threadFunction()
 	DEB_TRACE() << DEB_VAR1(m_state);
 	m_cond.broadcast();
 
-	SeqFilter seq_filter;
 	bool had_frames = false;
 	bool cont_acq = true;
 	bool acq_end = false;
-	do {
-		while ((m_state != StopReq) && m_frame_queue.empty()) {
-			if (!m_cond.wait(m_cam->m_new_frame_timeout)) {
-				AutoMutexUnlock u(l);
-				m_cam->checkLostPackets();
-			}
-		}
-		if (!m_frame_queue.empty()) {
-			FrameType frame = m_frame_queue.front();
-			m_frame_queue.pop();
-			DEB_TRACE() << DEB_VAR1(frame);
-			seq_filter.addVal(frame);
-			SeqFilter::Range frames = seq_filter.getSeqRange();
-			if (frames.nb > 0) {
-				AutoMutexUnlock u(l);
-				int f = frames.first;
-				do {
-					DEB_TRACE() << DEB_VAR1(f);
-					Status status = newFrameReady(f);
-					cont_acq = status.first;
-					acq_end = status.second;
-					had_frames = true;
-				} while ((++f != frames.end()) && cont_acq);
+	{
+		AutoMutexUnlock u(l);
+		double timeout = m_cam->m_new_frame_timeout;
+		Timestamp idle_t0 = Timestamp::now();
+		do {
+			int seq = m_finished_queues->getSeq();
+			drainFinishedQueues();
+			if (!m_seq_filter.hasSeqRange()) {
+				if (m_state == StopReq)
+					break;
+				// late ports are checked before the full timeout
+				double wait_timeout = timeout;
+				double check_timeout = m_cam->checkLateFrames();
+				if (check_timeout >= 0)
+					wait_timeout = min(wait_timeout, 
+							   check_timeout);
+				if (m_finished_queues->wait(seq, wait_timeout)) {
+					idle_t0 = Timestamp::now();
+				} else if (Timestamp::now() - idle_t0 >= timeout) {
+					m_cam->checkLostPackets();
+					idle_t0 = Timestamp::now();
+				}
+				continue;
 			}
-		}
-	} while ((m_state != StopReq) && cont_acq);
+			FrameRange frames = m_seq_filter.getSeqRange();
+			DEB_TRACE() << DEB_VAR1(frames);
+			FrameType f = frames.first;
+			do {
+				DEB_TRACE() << DEB_VAR1(f);
+				Status status = newFrameReady(f);
+				cont_acq = status.first;
+				acq_end = status.second;
+				had_frames = true;
+			} while ((++f != frames.end()) && cont_acq);
+		} while ((m_state != StopReq) && cont_acq);
+	}
 	State prev_state = m_state;
 
 	if (acq_end && m_cam->m_skip_frame_freq) {
@@ -190,10 +299,24 @@ void Camera::AcqThread::threadFunction()
 		AutoMutexUnlock u(l);
 		stopAcq();
 
-		IntList bfl;
-		m_cam->getSortedBadFrameList(bfl);
-		DEB_ALWAYS() << "bad_frames=" << bfl.size() << ": "
-			     << PrettyIntList(bfl);
+		FrameRangeSet bfs;
+		m_cam->getSortedBadFrameSet(bfs);
+		DEB_ALWAYS() << "bad_frames=" << bfs;
+
+		int nb_late_frames = 0;
+		RecvPortList port_list = m_cam->getRecvPortList();
+		RecvPortList::iterator it, end = port_list.end();
+		for (it = port_list.begin(); it != end; ++it)
+			nb_late_frames += (*it)->getNbLateFrames();
+		if (nb_late_frames > 0)
+			DEB_WARNING() << "late frames (declared lost): " 
+				      << nb_late_frames;
+
+		int nb_partial_frames = m_cam->getNbPartialFrames(-1);
+		if (nb_partial_frames > 0)
+			DEB_WARNING() << "partial frames: " << nb_partial_frames
+				      << ", lost packets: " 
+				      << m_cam->getNbLostPackets(-1);
 
 		Stats stats;
 		m_cam->getStats(stats);
@@ -212,13 +335,21 @@ void Camera::AcqThread::threadFunction()
 	m_cond.broadcast();
 }
 
-void Camera::AcqThread::queueFinishedFrame(FrameType frame)
+void Camera::AcqThread::drainFinishedQueues()
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR1(frame);
-	AutoMutex l = m_cam->lock();
-	m_frame_queue.push(frame);
-	m_cond.broadcast();
+	m_finished_list.clear();
+	m_finished_queues->drain(m_finished_list);
+	FrameRangeList::const_iterator it, end = m_finished_list.end();
+	for (it = m_finished_list.begin(); it != end; ++it) {
+		if (m_seq_filter.addRange(*it))
+			continue;
+		ostringstream err_msg;
+		err_msg << "AcqThread overrun: finished frames " << *it 
+			<< " beyond " << m_seq_filter.getSize() 
+			<< " buffers";
+		m_finished_queues->reportOverrun(err_msg.str());
+	}
 }
 
 void Camera::AcqThread::cleanUp()
@@ -256,9 +387,13 @@ void Camera::AcqThread::cleanUp()
 void Camera::AcqThread::startAcq()
 {
 	DEB_MEMBER_FUNCT();
-	DEB_TRACE() << "calling startReceiver";
 	slsDetectorUsers *det = m_cam->m_det;
-	det->startReceiver();
+	// the Native/XdpRecvEngine own the data ports: the slsReceiver
+	// listeners must not bind rx_udpport
+	if (m_cam->m_recv_engine == SlsRecvEngine) {
+		DEB_TRACE() << "calling startReceiver";
+		det->startReceiver();
+	}
 	DEB_TRACE() << "calling startAcquisition";
 	det->startAcquisition();
 }
@@ -276,8 +411,10 @@ void Camera::AcqThread::stopAcq()
 		double milli_sec = (Timestamp::now() - t0) * 1e3;
 		DEB_TRACE() << "Abort -> Idle: " << DEB_VAR1(milli_sec);
 	}
-	DEB_TRACE() << "calling stopReceiver";
-	det->stopReceiver();
+	if (m_cam->m_recv_engine == SlsRecvEngine) {
+		DEB_TRACE() << "calling stopReceiver";
+		det->stopReceiver();
+	}
 }
 
 Camera::AcqThread::Status Camera::AcqThread::newFrameReady(FrameType frame)
@@ -304,6 +441,8 @@ Camera::Camera(string config_fname)
 	  m_pixel_depth(PixelDepth16), 
 	  m_image_type(Bpp16), 
 	  m_raw_mode(false),
+	  m_recv_direct_placement(false),
+	  m_recv_engine(SlsRecvEngine),
 	  m_state(Idle),
 	  m_new_frame_timeout(0.5),
 	  m_abort_sleep_time(0.1),
@@ -400,6 +539,7 @@ void Camera::setModel(Model *model)
 	m_recv_nb_ports = m_model->getRecvPorts();
 	int nb_ports = getTotNbPorts();
 	m_frame_map.setNbItems(nb_ports);
+	m_frame_map.setItemGroupSize(m_recv_nb_ports);
 
 	RecvList::iterator it, end = m_recv_list.end();
 	for (it = m_recv_list.begin(); it != end; ++it)
@@ -465,6 +605,14 @@ void Camera::createReceivers()
 		DEB_TRACE() << "  " << host_name << ": " << DEB_VAR1(rx_port);
 
 		AutoPtr<Receiver> recv_obj = new Receiver(this, idx, rx_port);
+		const RecvUdpPortMap& udp_map = m_input_data->recv_udp_port_map;
+		RecvUdpPortMap::const_iterator uit = udp_map.find(id);
+		if (uit != udp_map.end())
+			recv_obj->setUdpPortList(uit->second);
+		const RecvUdpIpMap& ip_map = m_input_data->recv_udp_ip_map;
+		RecvUdpIpMap::const_iterator iit = ip_map.find(id);
+		if (iit != ip_map.end())
+			recv_obj->setUdpIp(iit->second);
 		m_recv_list.push_back(recv_obj);
 	}
 }
@@ -552,6 +700,43 @@ void Camera::getSkipFrameFreq(FrameType& skip_frame_freq)
 	DEB_RETURN() << DEB_VAR1(skip_frame_freq);
 }
 
+void Camera::setFrameQueueSize(int frame_queue_size)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(frame_queue_size);
+	waitState(Idle);
+	m_frame_map.setQueueSize(frame_queue_size);
+}
+
+void Camera::getFrameQueueSize(int& frame_queue_size)
+{
+	DEB_MEMBER_FUNCT();
+	m_frame_map.getQueueSize(frame_queue_size);
+	DEB_RETURN() << DEB_VAR1(frame_queue_size);
+}
+
+void Camera::setFrameQueueWaitPolicy(WaitPolicy wait_policy)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(wait_policy);
+	waitState(Idle);
+	m_frame_map.setQueueWaitPolicy(wait_policy);
+}
+
+void Camera::getFrameQueueWaitPolicy(WaitPolicy& wait_policy)
+{
+	DEB_MEMBER_FUNCT();
+	m_frame_map.getQueueWaitPolicy(wait_policy);
+	DEB_RETURN() << DEB_VAR1(wait_policy);
+}
+
+void Camera::getFrameQueueHighWatermarkList(IntList& watermark_list)
+{
+	DEB_MEMBER_FUNCT();
+	watermark_list = m_frame_map.getItemQueueHighWatermarkList();
+	DEB_RETURN() << DEB_VAR1(PrettyIntList(watermark_list));
+}
+
 void Camera::setExpTime(double exp_time)
 {
 	DEB_MEMBER_FUNCT();
@@ -726,11 +911,47 @@ void Camera::getRawMode(bool& raw_mode)
 	DEB_RETURN() << DEB_VAR1(raw_mode);
 }
 
+void Camera::setRecvDirectPlacement(bool direct_placement)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(direct_placement);
+	m_recv_direct_placement = direct_placement;
+}
+
+void Camera::getRecvDirectPlacement(bool& direct_placement)
+{
+	DEB_MEMBER_FUNCT();
+	direct_placement = m_recv_direct_placement;
+	DEB_RETURN() << DEB_VAR1(direct_placement);
+}
+
+void Camera::setRecvEngine(RecvEngine recv_engine)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(recv_engine);
+	if (getState() != Idle)
+		THROW_HW_ERROR(Error) << "Camera is not idle";
+	if ((recv_engine == XdpRecvEngine) && !XdpPortReceiver::isAvailable())
+		THROW_HW_ERROR(NotSupported) << "AF_XDP support not compiled";
+	m_recv_engine = recv_engine;
+}
+
+void Camera::getRecvEngine(RecvEngine& recv_engine)
+{
+	DEB_MEMBER_FUNCT();
+	recv_engine = m_recv_engine;
+	DEB_RETURN() << DEB_VAR1(recv_engine);
+}
+
 State Camera::getState()
 {
 	DEB_MEMBER_FUNCT();
-	AutoMutex l = lock();
-	State state = getEffectiveState();
+	// only the Stopped -> Idle transition needs the lock
+	State state = m_state;
+	if (state == Stopped) {
+		AutoMutex l = lock();
+		state = getEffectiveState();
+	}
 	DEB_RETURN() << DEB_VAR1(state);
 	return state;
 }
@@ -793,6 +1014,17 @@ void Camera::prepareAcq()
 		m_frame_map.setBufferSize(nb_buffers);
 		m_frame_map.clear();
 		m_prev_ifa.clear();
+		bool early_check = (m_tol_lost_packets && 
+				    ((m_trig_mode == Defs::Auto) || 
+				     (m_trig_mode == Defs::BurstTrigger)));
+		m_lost_frame_detector.setFramePeriod(early_check ? 
+						     m_frame_period : 0);
+		m_lost_frame_detector.setStopTimeout(m_new_frame_timeout);
+		m_lost_frame_detector.reset(getTotNbPorts());
+		WaitPolicy wait_policy;
+		m_frame_map.getQueueWaitPolicy(wait_policy);
+		m_finished_queues.reset(new FinishedFrameQueues(
+				  this, getTotNbPorts(), nb_buffers, wait_policy));
 		RecvList::iterator it, end = m_recv_list.end();
 		for (it = m_recv_list.begin(); it != end; ++it)
 			(*it)->prepareAcq();
@@ -804,6 +1036,9 @@ void Camera::prepareAcq()
 	}
 
 	m_model->prepareAcq();
+	RecvList::iterator it, end = m_recv_list.end();
+	for (it = m_recv_list.begin(); it != end; ++it)
+		(*it)->prepareNativePorts();
 	m_global_cpu_affinity_mgr.prepareAcq();
 
 	resetFramesCaught();
@@ -877,22 +1112,58 @@ bool Camera::checkLostPackets()
 	}
 	for (int i = 0; i < nb_ports; ++i) {
 		if (ifa[i] != last_frame)
-			port_list[i]->processFrame(last_frame, NULL, 0);
+			port_list[i]->declareLostFrames(last_frame);
 	}
 	if (DEB_CHECK_ANY(DebTypeWarning)) {
 		IntList last_bad(nb_ports);
 		for (int i = 0; i < nb_ports; ++i)
 			last_bad[i] = port_list[i]->getNbBadFrames();
-		IntList bfl;
-		getSortedBadFrameList(first_bad, last_bad, bfl);
-		DEB_WARNING() << "bad_frames=" << bfl.size() << ": " 
-			      << PrettyIntList(bfl);
+		FrameRangeSet bfs;
+		getSortedBadFrameSet(first_bad, last_bad, bfs);
+		DEB_WARNING() << "bad_frames=" << bfs;
 	}
 
 	DEB_RETURN() << DEB_VAR1(false);
 	return false;
 }
 
+double Camera::checkLateFrames()
+{
+	DEB_MEMBER_FUNCT();
+
+	LostFrameDetector& d = m_lost_frame_detector;
+	if (!d.isActive())
+		return -1;
+
+	FrameArray ifa = m_frame_map.getItemFrameArray();
+	LostFrameDetector::PortFrameList lost_list;
+	d.check(ifa, Timestamp::now(), lost_list);
+	if (!lost_list.empty()) {
+		RecvPortList port_list = getRecvPortList();
+		int nb_ports = port_list.size();
+		IntList first_bad(nb_ports);
+		for (int i = 0; i < nb_ports; ++i) 
+			first_bad[i] = port_list[i]->getNbBadFrames();
+		LostFrameDetector::PortFrameList::const_iterator it, end;
+		end = lost_list.end();
+		for (it = lost_list.begin(); it != end; ++it)
+			port_list[it->first]->declareLostFrames(it->second);
+		if (DEB_CHECK_ANY(DebTypeWarning)) {
+			IntList last_bad(nb_ports);
+			for (int i = 0; i < nb_ports; ++i)
+				last_bad[i] = port_list[i]->getNbBadFrames();
+			FrameRangeSet bfs;
+			getSortedBadFrameSet(first_bad, last_bad, bfs);
+			DEB_WARNING() << "early bad_frames=" << bfs << ", " 
+				      << DEB_VAR1(d.getLagThreshold());
+		}
+	}
+
+	double check_timeout = d.getCheckTimeout();
+	DEB_RETURN() << DEB_VAR1(check_timeout);
+	return check_timeout;
+}
+
 FrameType Camera::getLastReceivedFrame()
 {
 	DEB_MEMBER_FUNCT();
@@ -1104,9 +1375,9 @@ int Camera::getNbBadFrames(int port_idx)
 		THROW_HW_ERROR(InvalidValue) << DEB_VAR1(port_idx);
 	int nb_bad_frames;
 	if (port_idx == -1) {
-		IntList bfl;
-		getBadFrameList(port_idx, bfl);
-		nb_bad_frames = bfl.size();
+		FrameRangeSet bfs;
+		getSortedBadFrameSet(bfs);
+		nb_bad_frames = bfs.getNbFrames();
 	} else {
 		Receiver::Port *port = getRecvPort(port_idx);
 		nb_bad_frames = port->getNbBadFrames();
@@ -1115,29 +1386,23 @@ int Camera::getNbBadFrames(int port_idx)
 	return nb_bad_frames;
 }
 
-void Camera::getSortedBadFrameList(IntList first_idx, IntList last_idx,
-				   IntList& bad_frame_list)
+void Camera::getSortedBadFrameSet(IntList first_idx, IntList last_idx,
+				  FrameRangeSet& bad_frame_set)
 {
 	bool all = first_idx.empty();
-	IntList bfl;
 	RecvPortList port_list = getRecvPortList();
 	RecvPortList::iterator it = port_list.begin();
 	int nb_ports = port_list.size();
+	vector<FrameRangeSet> port_set_list(nb_ports);
+	FrameRangeSet::SetList set_list;
 	for (int i = 0; i < nb_ports; ++i, ++it) {
 		Receiver::Port *port = *it;
 		int first = all ? 0 : first_idx[i];
 		int last = all ? port->getNbBadFrames() : last_idx[i];
-		IntList l;
-		port->getBadFrameList(first, last, l);
-		bfl.insert(bfl.end(), l.begin(), l.end());
+		port->getBadFrameSet(first, last, port_set_list[i]);
+		set_list.push_back(&port_set_list[i]);
 	}
-	IntList::iterator first = bfl.begin();
-	IntList::iterator last = bfl.end();
-	sort(first, last);
-	bad_frame_list.resize(last - first);
-	IntList::iterator bfl_end, bfl_begin = bad_frame_list.begin();
-	bfl_end = unique_copy(first, last, bfl_begin);
-	bad_frame_list.resize(bfl_end - bfl_begin);
+	FrameRangeSet::merge(set_list, bad_frame_set);
 }
 
 void Camera::getBadFrameList(int port_idx, int first_idx, int last_idx, 
@@ -1158,13 +1423,60 @@ void Camera::getBadFrameList(int port_idx, IntList& bad_frame_list)
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(port_idx);
-	if (port_idx == -1)
-		getSortedBadFrameList(bad_frame_list);
-	else
+	if (port_idx == -1) {
+		FrameRangeSet bfs;
+		getSortedBadFrameSet(bfs);
+		bfs.getFrameList(bad_frame_list);
+	} else
 		getBadFrameList(port_idx, 0, getNbBadFrames(port_idx), 
 				bad_frame_list);
 }
 
+int Camera::getNbPartialFrames(int port_idx)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(port_idx);
+	if ((port_idx < -1) || (port_idx >= getTotNbPorts()))
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR1(port_idx);
+	int nb_partial_frames = 0;
+	RecvPortList port_list = getRecvPortList();
+	for (int i = 0; i < int(port_list.size()); ++i)
+		if ((port_idx == -1) || (i == port_idx))
+			nb_partial_frames += port_list[i]->getNbPartialFrames();
+	DEB_RETURN() << DEB_VAR1(nb_partial_frames);
+	return nb_partial_frames;
+}
+
+int Camera::getNbLostPackets(int port_idx)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(port_idx);
+	if ((port_idx < -1) || (port_idx >= getTotNbPorts()))
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR1(port_idx);
+	int nb_lost_packets = 0;
+	RecvPortList port_list = getRecvPortList();
+	for (int i = 0; i < int(port_list.size()); ++i)
+		if ((port_idx == -1) || (i == port_idx))
+			nb_lost_packets += port_list[i]->getNbLostPackets();
+	DEB_RETURN() << DEB_VAR1(nb_lost_packets);
+	return nb_lost_packets;
+}
+
+void Camera::getFrameMetaData(int port_idx, FrameType frame, 
+			      FrameMetaData& meta_data)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(port_idx, frame);
+	if ((port_idx < 0) || (port_idx >= getTotNbPorts()))
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR1(port_idx);
+	Receiver::Port *port = getRecvPort(port_idx);
+	if (!port->getFrameMetaData(frame, meta_data))
+		THROW_HW_ERROR(Error) << "No meta-data for " 
+				      << DEB_VAR2(port_idx, frame)
+				      << ": not received or overwritten";
+	DEB_RETURN() << DEB_VAR1(meta_data);
+}
+
 void Camera::registerTimeRangesChangedCallback(TimeRangesChangedCallback& cb)
 {
 	DEB_MEMBER_FUNCT();
@@ -1197,11 +1509,14 @@ void Camera::getStats(Stats& stats, int port_idx)
 		stats.reset();
 		RecvPortList port_list = getRecvPortList();
 		RecvPortList::iterator it, end = port_list.end();
-		for (it = port_list.begin(); it != end; ++it)
-			stats += (*it)->getStats().stats;
+		for (it = port_list.begin(); it != end; ++it) {
+			Stats port_stats;
+			(*it)->getStats(port_stats);
+			stats += port_stats;
+		}
 	} else {
 		Receiver::Port *port = getRecvPort(port_idx);
-		stats = port->getStats().stats;
+		port->getStats(stats);
 	}
 	DEB_RETURN() << DEB_VAR1(stats);
 }
@@ -1228,6 +1543,27 @@ ProcessingFinishedEvent *Camera::getProcessingFinishedEvent()
 	return m_global_cpu_affinity_mgr.getProcessingFinishedEvent();
 }
 
+void Camera::getThreadInfoList(ThreadInfoList& info_list)
+{
+	DEB_MEMBER_FUNCT();
+	m_thread_registry.getThreadInfoList(info_list);
+}
+
+void Camera::setThreadSchedParams(string name, ThreadSchedParams params)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(name, params);
+	m_thread_registry.setThreadSchedParams(name, params);
+}
+
+void Camera::getThreadSchedParams(string name, ThreadSchedParams& params)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(name);
+	m_thread_registry.getThreadSchedParams(name, params);
+	DEB_RETURN() << DEB_VAR1(params);
+}
+
 void Camera::setReceiverFifoDepth(int fifo_depth)
 {
 	DEB_MEMBER_FUNCT();
@@ -25,6 +25,10 @@
 
 #include <glob.h>
 #include <cmath>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 using namespace std;
 using namespace lima;
@@ -370,109 +374,191 @@ bool SimpleStat::getDoHist()
 	return DoHist;
 }
 
-SimpleStat::SimpleStat(double f, int b)
-	: factor(f), hist_bin(b)
+LogLinearHistogram& 
+LogLinearHistogram::operator +=(const LogLinearHistogram& o)
+{
+	for (int i = 0; i < NbBins; ++i)
+		count[i] += o.count[i];
+	return *this;
+}
+
+uint64_t LogLinearHistogram::getNbValues() const
+{
+	uint64_t n = 0;
+	for (int i = 0; i < NbBins; ++i)
+		n += count[i];
+	return n;
+}
+
+double LogLinearHistogram::getPercentile(double p) const
+{
+	uint64_t n = getNbValues();
+	if (n == 0)
+		return 0;
+	uint64_t target = std::max(uint64_t(ceil(p / 100 * n)), uint64_t(1));
+	uint64_t acc = 0;
+	int i;
+	for (i = 0; i < NbBins - 1; ++i)
+		if ((acc += count[i]) >= target)
+			break;
+	return getBinHigh(i) - 1;
+}
+
+SimpleStat::SimpleStat(double f)
+	: factor(f)
 {
 	reset();
 }
 
 void SimpleStat::reset()
 {
-	AutoMutex l(lock);
 	xmin = xmax = xacc = xacc2 = 0;
 	xn = 0;
-	hist.clear();
+	hist.reset();
 }
 
-void SimpleStat::add(double x, bool do_hist) {
-	AutoMutex l(lock);
+void SimpleStat::add(double x) {
 	x *= factor;
 	xmin = xn ? std::min(xmin, x) : x;
 	xmax = xn ? std::max(xmax, x) : x;
 	xacc += x;
-	xacc2 += pow(x, 2);
+	xacc2 += x * x;
 	++xn;
-
-	if (!(do_hist || DoHist))
-		return;
-
-	int i = x;
-	i -= i % hist_bin;
-	Histogram::iterator it = hist.find(i);
-	if (it == hist.end())
-		hist[i] = 1;
-	else
-		it->second++;
-}
-
-SimpleStat& SimpleStat::operator =(const SimpleStat& o)
-{
-	if (&o == this)
-		return *this;
-
-	AutoMutex l(o.lock);
-	xmin = o.xmin;
-	xmax = o.xmax;
-	xacc = o.xacc;
-	xacc2 = o.xacc2;
-	xn = o.xn;
-	factor = o.factor;
-	hist = o.hist;
-	hist_bin = o.hist_bin;
-	return *this;
+	hist.add(histValue(x));
 }
 
 SimpleStat& SimpleStat::operator +=(const SimpleStat& o)
 {
-	if ((o.factor != factor) || (o.hist_bin != hist_bin))
+	if (o.factor != factor)
 		throw LIMA_HW_EXC(Error, "Cannot add different SimpleStats");
 
-	AutoMutex l(o.lock);
 	xmin = xn ? (o.xn ? std::min(xmin, o.xmin) : xmin) : o.xmin;
-	xmax = xn ? (o.xn ? std::max(xmax, o.xmax) : xmin) : o.xmax;
+	xmax = xn ? (o.xn ? std::max(xmax, o.xmax) : xmax) : o.xmax;
 	xacc += o.xacc;
 	xacc2 += o.xacc2;
 	xn += o.xn;
-	Histogram::const_iterator oit, oend = o.hist.end();
-	for (oit = o.hist.begin(); oit != oend; ++oit) {
-		Histogram::iterator it = hist.find(oit->first);
-		if (it == hist.end())
-			hist[oit->first] = oit->second;
-		else
-			it->second += oit->second;
-	}
+	hist += o.hist;
 
 	return *this;
 }
 
 int SimpleStat::n() const
 { 
-	AutoMutex l(lock);
 	return xn; 
 }
 
 double SimpleStat::min() const
 { 
-	AutoMutex l(lock);
 	return xmin;
 }
 
 double SimpleStat::max() const
 {
-	AutoMutex l(lock);
 	return xmax; 
 }
 
 double SimpleStat::ave() const
 { 
-	AutoMutex l(lock);
 	return xn ? (xacc / xn) : 0; 
 }
 
 double SimpleStat::std() const
 { 
-	AutoMutex l(lock);
-	return xn ? sqrt(xacc2 / xn - pow(ave(), 2)) : 0; 
+	if (!xn)
+		return 0;
+	double a = ave();
+	return sqrt(std::max(xacc2 / xn - a * a, 0.0)); 
+}
+
+double SimpleStat::percentile(double p) const
+{
+	if (!xn)
+		return 0;
+	double val = hist.getPercentile(p);
+	return std::max(std::min(val, xmax), xmin);
+}
+
+SimpleStat::Histogram SimpleStat::getHistogram() const
+{
+	Histogram h;
+	for (int i = 0; i < LogLinearHistogram::NbBins; ++i)
+		if (hist.count[i])
+			h[LogLinearHistogram::getBinLow(i)] = hist.count[i];
+	return h;
+}
+
+SimpleStatRecorder::SimpleStatRecorder(double f)
+	: m_seq(0), m_factor(f)
+{
+	reset();
+}
+
+void SimpleStatRecorder::beginWrite()
+{
+	unsigned int seq = m_seq.load(memory_order_relaxed);
+	m_seq.store(seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+void SimpleStatRecorder::endWrite()
+{
+	unsigned int seq = m_seq.load(memory_order_relaxed);
+	m_seq.store(seq + 1, memory_order_release);
+}
+
+void SimpleStatRecorder::reset()
+{
+	beginWrite();
+	m_xmin.store(0, memory_order_relaxed);
+	m_xmax.store(0, memory_order_relaxed);
+	m_xacc.store(0, memory_order_relaxed);
+	m_xacc2.store(0, memory_order_relaxed);
+	m_xn.store(0, memory_order_relaxed);
+	for (int i = 0; i < LogLinearHistogram::NbBins; ++i)
+		m_hist_count[i].store(0, memory_order_relaxed);
+	endWrite();
+}
+
+void SimpleStatRecorder::add(double x)
+{
+	x *= m_factor;
+	int xn = m_xn.load(memory_order_relaxed);
+	double xmin = m_xmin.load(memory_order_relaxed);
+	double xmax = m_xmax.load(memory_order_relaxed);
+	double xacc = m_xacc.load(memory_order_relaxed);
+	double xacc2 = m_xacc2.load(memory_order_relaxed);
+	int idx = LogLinearHistogram::getBinIdx(SimpleStat::histValue(x));
+	AtomicCount& count = m_hist_count[idx];
+	uint64_t c = count.load(memory_order_relaxed);
+
+	beginWrite();
+	m_xmin.store(xn ? std::min(xmin, x) : x, memory_order_relaxed);
+	m_xmax.store(xn ? std::max(xmax, x) : x, memory_order_relaxed);
+	m_xacc.store(xacc + x, memory_order_relaxed);
+	m_xacc2.store(xacc2 + x * x, memory_order_relaxed);
+	m_xn.store(xn + 1, memory_order_relaxed);
+	count.store(c + 1, memory_order_relaxed);
+	endWrite();
+}
+
+void SimpleStatRecorder::getSnapshot(SimpleStat& s) const
+{
+	s.factor = m_factor;
+	LogLinearHistogram::CountList& hist_count = s.hist.count;
+	unsigned int seq0, seq1;
+	do {
+		seq0 = m_seq.load(memory_order_acquire);
+		s.xmin = m_xmin.load(memory_order_relaxed);
+		s.xmax = m_xmax.load(memory_order_relaxed);
+		s.xacc = m_xacc.load(memory_order_relaxed);
+		s.xacc2 = m_xacc2.load(memory_order_relaxed);
+		s.xn = m_xn.load(memory_order_relaxed);
+		for (int i = 0; i < LogLinearHistogram::NbBins; ++i)
+			hist_count[i] = m_hist_count[i].load(
+						memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		seq1 = m_seq.load(memory_order_relaxed);
+	} while ((seq0 & 1) || (seq0 != seq1));
 }
 
 FrameType lima::SlsDetector::getLatestFrame(const FrameArray& l)
@@ -526,6 +612,258 @@ ostream& lima::SlsDetector::operator <<(ostream& os, Type type)
 	return os << name;
 }
 
+ostream& lima::SlsDetector::operator <<(ostream& os, WaitPolicy policy)
+{
+	const char *name = "Invalid";
+	switch (policy) {
+	case BlockWait:		name = "BlockWait";	break;
+	case BusyWait:		name = "BusyWait";	break;
+	}
+	return os << name;
+}
+
+ostream& lima::SlsDetector::operator <<(ostream& os, RecvEngine engine)
+{
+	const char *name = "Invalid";
+	switch (engine) {
+	case SlsRecvEngine:	name = "SlsRecvEngine";		break;
+	case NativeRecvEngine:	name = "NativeRecvEngine";	break;
+	case XdpRecvEngine:	name = "XdpRecvEngine";		break;
+	}
+	return os << name;
+}
+
+ostream& lima::SlsDetector::operator <<(ostream& os, const FrameRange& r)
+{
+	os << r.first;
+	if (r.nb != 1)
+		os << "-" << (r.end() - 1);
+	return os;
+}
+
+void FrameRangeSet::clear()
+{
+	m_range_list.clear();
+	m_prev_frames_list.clear();
+	m_nb_frames = 0;
+}
+
+void FrameRangeSet::append(FrameType first, FrameType end)
+{
+	// a range cannot hold more than INT_MAX frames
+	const FrameType max_nb = INT_MAX;
+	if (!m_range_list.empty()) {
+		FrameRange& last = m_range_list.back();
+		if (first <= last.end()) {
+			if (end <= last.end())
+				return;
+			FrameType nb = min(end - last.first, max_nb);
+			m_nb_frames += nb - last.nb;
+			first = last.first + nb;
+			last.nb = nb;
+		}
+	}
+	for (; first < end; first += max_nb) {
+		FrameType nb = min(end - first, max_nb);
+		m_range_list.push_back(FrameRange(first, nb));
+		m_prev_frames_list.push_back(m_nb_frames);
+		m_nb_frames += nb;
+	}
+}
+
+void FrameRangeSet::add(FrameType first, FrameType nb)
+{
+	if (nb == 0)
+		return;
+	if (m_range_list.empty() || (first >= m_range_list.back().first)) {
+		append(first, first + nb);
+		return;
+	}
+
+	// out of order: the ranges overlapping or touching the new one
+	// are merged with it in place
+	DEB_MEMBER_FUNCT();
+	DEB_TRACE() << "Out of order " << DEB_VAR2(first, nb);
+	FrameType end = first + nb;
+	FrameRangeList::iterator b = m_range_list.begin();
+	FrameRangeList::iterator e = m_range_list.end();
+	FrameRangeList::iterator i, j;
+	i = lower_bound(b, e, first, 
+			[](const FrameRange& r, FrameType f) { 
+				return r.end() < f; 
+			});
+	j = upper_bound(i, e, end,
+			[](FrameType f, const FrameRange& r) { 
+				return f < r.first; 
+			});
+	if (i != j) {
+		first = min(first, i->first);
+		end = max(end, (j - 1)->end());
+	}
+	// a range cannot hold more than INT_MAX frames
+	const FrameType max_nb = INT_MAX;
+	FrameRangeList range_list;
+	for (; first < end; first += max_nb) {
+		FrameType nb = min(end - first, max_nb);
+		range_list.push_back(FrameRange(first, nb));
+	}
+	replaceRanges(i - b, j - b, &range_list[0], range_list.size());
+}
+
+void FrameRangeSet::remove(FrameType frame)
+{
+	FrameRangeList::iterator b = m_range_list.begin();
+	FrameRangeList::iterator e = m_range_list.end();
+	FrameRangeList::iterator it;
+	it = upper_bound(b, e, frame,
+			 [](FrameType f, const FrameRange& r) { 
+				 return f < r.first; 
+			 });
+	if ((it == b) || (frame >= (--it)->end()))
+		return;
+
+	// the range containing frame is split in place
+	FrameRange r[2];
+	int nb_r = 0;
+	if (frame > it->first)
+		r[nb_r++] = FrameRange(it->first, frame - it->first);
+	if (frame + 1 < it->end())
+		r[nb_r++] = FrameRange(frame + 1, it->end() - frame - 1);
+	int idx = it - b;
+	replaceRanges(idx, idx + 1, r, nb_r);
+}
+
+void FrameRangeSet::replaceRanges(int first_idx, int end_idx, 
+				  const FrameRange *r, int nb_r)
+{
+	FrameRangeList::iterator b = m_range_list.begin();
+	FrameRangeList::iterator it, end = b + end_idx;
+	for (it = b + first_idx; it != end; ++it)
+		m_nb_frames -= it->nb;
+	for (int k = 0; k < nb_r; ++k)
+		m_nb_frames += r[k].nb;
+
+	int nb_common = min(end_idx - first_idx, nb_r);
+	copy(r, r + nb_common, b + first_idx);
+	if (nb_r > nb_common)
+		m_range_list.insert(b + end_idx, r + nb_common, r + nb_r);
+	else
+		m_range_list.erase(b + first_idx + nb_common, b + end_idx);
+
+	// frames are nearly in order: few ranges follow first_idx
+	int nb_ranges = m_range_list.size();
+	m_prev_frames_list.resize(nb_ranges);
+	for (int k = first_idx; k < nb_ranges; ++k)
+		m_prev_frames_list[k] = !k ? 0 : (m_prev_frames_list[k - 1] + 
+						  m_range_list[k - 1].nb);
+}
+
+bool FrameRangeSet::contains(FrameType frame) const
+{
+	FrameRangeList::const_iterator it, end = m_range_list.end();
+	it = upper_bound(m_range_list.begin(), end, frame,
+			 [](FrameType f, const FrameRange& r) { 
+				 return f < r.first; 
+			 });
+	if (it == m_range_list.begin())
+		return false;
+	return (frame < (--it)->end());
+}
+
+int FrameRangeSet::findIndexRange(FrameType idx) const
+{
+	FrameArray::const_iterator b = m_prev_frames_list.begin();
+	FrameArray::const_iterator it;
+	it = upper_bound(b, m_prev_frames_list.end(), idx);
+	return (it - b) - 1;
+}
+
+void FrameRangeSet::getSubSet(FrameType first_idx, FrameType last_idx, 
+			      FrameRangeSet& sub_set) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(first_idx, last_idx);
+	if ((first_idx > last_idx) || (last_idx > m_nb_frames))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR3(first_idx, last_idx,
+							 m_nb_frames);
+	sub_set.clear();
+	if (first_idx == last_idx)
+		return;
+	int nb_ranges = m_range_list.size();
+	for (int i = findIndexRange(first_idx); i < nb_ranges; ++i) {
+		FrameType prev = m_prev_frames_list[i];
+		if (prev >= last_idx)
+			break;
+		const FrameRange& r = m_range_list[i];
+		FrameType b = max(first_idx, prev) - prev;
+		FrameType e = min(last_idx, prev + r.nb) - prev;
+		sub_set.append(r.first + b, r.first + e);
+	}
+}
+
+void FrameRangeSet::getFrameList(FrameType first_idx, FrameType last_idx, 
+				 IntList& frame_list) const
+{
+	DEB_MEMBER_FUNCT();
+	FrameRangeSet sub_set;
+	getSubSet(first_idx, last_idx, sub_set);
+	frame_list.resize(sub_set.getNbFrames());
+	IntList::iterator l = frame_list.begin();
+	FrameRangeList::const_iterator it, end = sub_set.m_range_list.end();
+	for (it = sub_set.m_range_list.begin(); it != end; ++it)
+		for (FrameType f = it->first; f != it->end(); ++f)
+			*l++ = f;
+}
+
+void FrameRangeSet::merge(const SetList& set_list, FrameRangeSet& merged)
+{
+	DEB_STATIC_FUNCT();
+
+	// min-heap on the first frame of the next range of each set
+	typedef pair<FrameType, int> HeapEntry;
+	typedef greater<HeapEntry> HeapCmp;
+	vector<HeapEntry> heap;
+	IntList next_range(set_list.size(), 0);
+	for (unsigned int i = 0; i < set_list.size(); ++i)
+		if (!set_list[i]->empty())
+			heap.push_back(HeapEntry(set_list[i]->m_range_list[0].first,
+						 i));
+	make_heap(heap.begin(), heap.end(), HeapCmp());
+
+	merged.clear();
+	while (!heap.empty()) {
+		pop_heap(heap.begin(), heap.end(), HeapCmp());
+		int s = heap.back().second;
+		const FrameRangeList& l = set_list[s]->m_range_list;
+		const FrameRange& r = l[next_range[s]++];
+		merged.append(r.first, r.end());
+		if (next_range[s] == int(l.size())) {
+			heap.pop_back();
+			continue;
+		}
+		heap.back().first = l[next_range[s]].first;
+		push_heap(heap.begin(), heap.end(), HeapCmp());
+	}
+}
+
+ostream& lima::SlsDetector::operator <<(ostream& os, const FrameRangeSet& s)
+{
+	const int MaxPrintRanges = 16;
+	const FrameRangeList& l = s.getRangeList();
+	int nb_ranges = l.size();
+	os << "<nb_frames=" << s.getNbFrames() << ", "
+	   << "nb_ranges=" << nb_ranges << ": [";
+	for (int i = 0; i < nb_ranges; ++i) {
+		if ((nb_ranges > MaxPrintRanges) && (i == MaxPrintRanges / 2)) {
+			os << ",...";
+			i = nb_ranges - MaxPrintRanges / 2;
+		}
+		os << (!i ? "" : ",") << l[i];
+	}
+	return os << "]>";
+}
+
 ostream& lima::SlsDetector::operator <<(ostream& os, const StringList& l)
 {
 	os << "[";
@@ -565,7 +903,13 @@ ostream& lima::SlsDetector::operator <<(ostream& os, const SimpleStat& s)
 	os << "<";
 	os << "min=" << int(s.min()) << ", max=" << int(s.max()) << ", "
 	   << "ave=" << int(s.ave()) << ", std=" << int(s.std()) << ", "
-	   << "n=" << s.n() << ", hist=" << s.hist;
+	   << "n=" << s.n() << ", "
+	   << "p50=" << int(s.percentile(50)) << ", "
+	   << "p90=" << int(s.percentile(90)) << ", "
+	   << "p99=" << int(s.percentile(99)) << ", "
+	   << "p99.9=" << int(s.percentile(99.9));
+	if (SimpleStat::getDoHist())
+		os << ", hist=" << s.getHistogram();
 	return os << ">";
 }
 
@@ -583,50 +927,97 @@ TimeRangesChangedCallback::~TimeRangesChangedCallback()
 		m_cam->unregisterTimeRangesChangedCallback(*this);
 }
 
-FrameMap::Item::FrameQueue::FrameQueue(int size) 
-	: m_size(size + 1), m_write_idx(0), m_read_idx(0), m_stopped(false)
+static inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	asm volatile("" ::: "memory");
+#endif
+}
+
+static inline int Futex(atomic<int>& addr, int op, int val, 
+			const struct timespec *ts = NULL)
 {
-	m_array.resize(m_size);
+	int *uaddr = reinterpret_cast<int *>(&addr);
+	return syscall(SYS_futex, uaddr, op, val, ts, NULL, 0);
 }
 
-void FrameMap::Item::FrameQueue::clear()
+WaitEvent::WaitEvent(WaitPolicy policy)
+	: m_seq(0), m_nb_waiters(0), m_policy(policy)
 {
-	m_write_idx = m_read_idx = 0;
+	DEB_CONSTRUCTOR();
+}
+
+bool WaitEvent::wait(int seq, double timeout)
+{
+	if (m_policy == BusyWait) {
+		Timestamp t0 = (timeout >= 0) ? Timestamp::now() : Timestamp();
+		for (int i = 0; m_seq.load(memory_order_acquire) == seq; ++i) {
+			CpuRelax();
+			if ((timeout >= 0) && ((i % 1024) == 0) &&
+			    (Timestamp::now() - t0 >= timeout))
+				return false;
+		}
+		return true;
+	}
+
+	struct timespec ts, *tsp = NULL;
+	if (timeout >= 0) {
+		ts.tv_sec = long(timeout);
+		ts.tv_nsec = long((timeout - ts.tv_sec) * 1e9);
+		tsp = &ts;
+	}
+	// the futex atomically checks that the sequence did not change
+	m_nb_waiters.fetch_add(1);
+	int ret = Futex(m_seq, FUTEX_WAIT_PRIVATE, seq, tsp);
+	bool timed_out = (ret < 0) && (errno == ETIMEDOUT);
+	m_nb_waiters.fetch_sub(1);
+	return !timed_out;
+}
+
+void WaitEvent::signal()
+{
+	m_seq.fetch_add(1);
+	if (m_nb_waiters.load() > 0)
+		Futex(m_seq, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+FrameMap::Item::FrameQueue::FrameQueue(int size) 
+	: m_queue(size), m_stopped(false)
+{
+	DEB_CONSTRUCTOR();
 }
 
 void FrameMap::Item::FrameQueue::push(FrameData data)
 {
-	if (index(m_write_idx + 1) == m_read_idx)
-		throw LIMA_EXC(Hardware, Error, 
-			       "FrameMap::Item::FrameQueue full");
-	m_array[m_write_idx] = data;
-	m_write_idx = index(m_write_idx + 1);
+	DEB_MEMBER_FUNCT();
+	if (!m_queue.push(data))
+		THROW_HW_ERROR(Error) << "FrameMap::Item::FrameQueue full: "
+				      << "size=" << getSize() << ", "
+				      << "consider increasing it";
+	m_event.signal();
 }
 
-FrameMap::Item::FrameDataList FrameMap::Item::FrameQueue::pop_all()
+void FrameMap::Item::FrameQueue::pop_all(FrameDataList& data_list)
 {
-	while ((m_read_idx == m_write_idx) && !m_stopped)
-		Sleep(1e-3);
-	int write_idx = m_write_idx;
-	bool two_steps = (m_read_idx > write_idx);
-	int end_idx = two_steps ? m_size : write_idx;
-	FrameDataList::const_iterator b = m_array.begin();
-	FrameDataList ret(b + m_read_idx, b + end_idx);
-	m_read_idx = index(end_idx);
-	if (two_steps) {
-		ret.insert(ret.end(), b, b + write_idx);
-		m_read_idx = write_idx;
+	data_list.clear();
+	while (true) {
+		int seq = m_event.getSeq();
+		if (m_queue.pop_all(data_list) || m_stopped)
+			break;
+		m_event.wait(seq);
 	}
-	return ret;
 }
 
 void FrameMap::Item::FrameQueue::stop()
 {
 	m_stopped = true;
+	m_event.signal();
 }
 
 FrameMap::Item::Item()
-	: m_map(NULL), m_last_pushed_frame(-1), m_last_frame(-1)
+	: m_map(NULL), m_idx(-1), m_last_pushed_frame(-1), m_last_frame(-1)
 {
 	DEB_CONSTRUCTOR();
 }
@@ -637,10 +1028,20 @@ FrameMap::Item::~Item()
 	stopPollFrameFinished();
 }
 
-void FrameMap::Item::setFrameMap(FrameMap *map)
+void FrameMap::Item::setFrameMap(FrameMap *map, int idx)
 {
 	DEB_MEMBER_FUNCT();
 	m_map = map;
+	m_idx = idx;
+}
+
+void FrameMap::Item::setQueueConfig(int size, WaitPolicy policy)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(size, policy);
+	if (size != m_frame_queue.getSize())
+		m_frame_queue.setSize(size);
+	m_frame_queue.setWaitPolicy(policy);
 }
 
 void FrameMap::Item::clear()
@@ -649,6 +1050,7 @@ void FrameMap::Item::clear()
 	m_frame_queue.clear();
 	m_last_pushed_frame = -1;
 	m_last_frame = -1;
+	m_bad_mark_list.clear();
 }
 
 void FrameMap::Item::checkFinishedFrame(FrameType frame)
@@ -671,39 +1073,85 @@ void FrameMap::Item::frameFinished(FrameType frame, bool no_check, bool valid)
 	if (!no_check)
 		checkFinishedFrame(frame);
 
+	markBadFrames(frame, valid);
 	m_frame_queue.push(FrameData(frame, valid));
 	m_last_pushed_frame = frame;
 }
 
-FrameMap::Item::FinishInfoList FrameMap::Item::pollFrameFinished()
+void FrameMap::Item::markBadFrames(FrameType frame, bool valid)
+{
+	const FrameType buffer_size = m_map->m_buffer_size;
+	FrameType first_bad = m_last_pushed_frame + 1;
+	FrameType end_bad = valid ? frame : (frame + 1);
+
+	// the buffers of old marks are being reused by the new frames
+	std::deque<FrameType>& l = m_bad_mark_list;
+	while (!l.empty() && (l.front() + buffer_size <= frame)) {
+		m_map->setBadItem(m_idx, l.front(), false);
+		l.pop_front();
+	}
+
+	// a valid frame shares its buffer with frame - buffer_size
+	if (frame + 1 - first_bad > buffer_size)
+		first_bad = frame + 1 - buffer_size;
+	for (FrameType f = first_bad; f != end_bad; ++f) {
+		m_map->setBadItem(m_idx, f, true);
+		l.push_back(f);
+	}
+}
+
+const FrameMap::Item::FinishInfoList& FrameMap::Item::pollFrameFinished()
 {
 	DEB_MEMBER_FUNCT();
 
-	FrameDataList data_list = m_frame_queue.pop_all();
+	FrameDataList& data_list = m_data_list;
+	m_frame_queue.pop_all(data_list);
+	AutoMutex l(m_poll_mutex);
+
+	// no allocation once the lists reached their working capacity
+	FinishInfoList& finfo_list = m_finfo_list;
+	FrameRangeList& finished_list = m_finished_list;
+	finfo_list.clear();
+	finished_list.clear();
 
-	FinishInfoList finfo_list;
 	FrameMap& m = *m_map;
 	FrameDataList::const_iterator it, end = data_list.end();
 	for (it = data_list.begin(); it != end; ++it) {
 		FrameType frame = it->first;
 		bool valid = it->second;
 		FinishInfo finfo;
+		finfo.finished = FrameRangeSpan(finished_list,
+						finished_list.size());
+		// released late frame: its count was held
+		if (isValidFrame(m_last_frame) && (frame <= m_last_frame)) {
+			finfo.first_lost = frame;
+			finfo.nb_lost = 0;
+			finfo.recovered = valid ? frame : -1;
+			if (m.decFrameCount(m_idx, frame)) {
+				finished_list.push_back(FrameRange(frame, 1));
+				finfo.finished.grow();
+			}
+			finfo_list.push_back(finfo);
+			continue;
+		}
 		finfo.first_lost = m_last_frame + 1;
 		finfo.nb_lost = frame - finfo.first_lost + (!valid ? 1 : 0);
+		finfo.recovered = -1;
 		for (FrameType f = m_last_frame + 1; f != (frame + 1); ++f) {
-			int idx = f % m.m_buffer_size;
-			AtomicCounter& count = m.m_frame_item_count_list[idx];
-			bool finished = count.dec_test_and_reset(m.m_nb_items);
-			if (finished)
-				finfo.finished.insert(f);
+			if (!m.decFrameCount(m_idx, f))
+				continue;
+			if (finfo.finished.empty() || 
+			    (finished_list.back().end() != f)) {
+				finished_list.push_back(FrameRange(f, 0));
+				finfo.finished.grow();
+			}
+			++finished_list.back().nb;
 		}
 		m_last_frame = frame;
 
-		if (DEB_CHECK_ANY(DebTypeReturn)) {
-			PrettySortedList finished_list(finfo.finished);
+		if (DEB_CHECK_ANY(DebTypeReturn))
 			DEB_RETURN() << DEB_VAR3(finfo.first_lost, 
-						 finfo.nb_lost, finished_list);
-		}
+						 finfo.nb_lost, finfo.finished);
 
 		finfo_list.push_back(finfo);
 	}
@@ -717,9 +1165,39 @@ void FrameMap::Item::stopPollFrameFinished()
 	m_frame_queue.stop();
 }
 
+bool FrameMap::Item::holdLateFrame(FrameType frame)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(m_idx, frame);
+
+	// its buffer is being reused by a newer frame
+	FrameType buffer_size = m_map->m_buffer_size;
+	if (frame + buffer_size <= m_map->getLastItemFrame())
+		return false;
+
+	AutoMutex l(m_poll_mutex);
+	bool dec_done = isValidFrame(m_last_frame) && (frame <= m_last_frame);
+	bool held = m_map->holdFrameCount(m_idx, frame, dec_done);
+	DEB_RETURN() << DEB_VAR2(dec_done, held);
+	return held;
+}
+
+void FrameMap::Item::releaseLateFrame(FrameType frame, bool valid)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(m_idx, frame, valid);
+
+	// published by the frame count decrement in pollFrameFinished
+	if (valid)
+		m_map->setBadItem(m_idx, frame, false);
+	m_frame_queue.push(FrameData(frame, valid));
+}
+
 
 FrameMap::FrameMap()
-	: m_nb_items(0), m_buffer_size(0)
+	: m_nb_items(0), m_item_group_size(1), m_nb_groups(0), 
+	  m_buffer_size(0), m_queue_size(0),
+	  m_queue_wait_policy(BlockWait), m_mask_words(0)
 {
 	DEB_CONSTRUCTOR();
 }
@@ -733,11 +1211,112 @@ void FrameMap::setNbItems(int nb_items)
 
 	m_item_list.resize(nb_items);
 	if (nb_items > m_nb_items) {
+		int queue_size = getEffectiveQueueSize();
 		ItemList::iterator it, end = m_item_list.end();
-		for (it = m_item_list.begin() + m_nb_items; it != end; ++it)
-			it->setFrameMap(this);
+		int idx = m_nb_items;
+		for (it = m_item_list.begin() + idx; it != end; ++it, ++idx) {
+			*it = new Item();
+			(*it)->setFrameMap(this, idx);
+			if (queue_size > 0)
+				(*it)->setQueueConfig(queue_size,
+						      m_queue_wait_policy);
+		}
 	}
 	m_nb_items = nb_items;
+	setItemGroupSize(m_item_group_size);
+	updateBadItemMask();
+}
+
+void FrameMap::setItemGroupSize(int item_group_size)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(item_group_size);
+	if (item_group_size < 1)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(item_group_size);
+
+	m_item_group_size = item_group_size;
+	int nb_groups = (m_nb_items + item_group_size - 1) / item_group_size;
+	bool grouped = (item_group_size > 1) && (nb_groups > 1);
+	m_frame_group_count_list.resize(grouped ? nb_groups : 0);
+	m_nb_groups = grouped ? nb_groups : m_nb_items;
+	CounterListList::iterator it, end = m_frame_group_count_list.end();
+	for (it = m_frame_group_count_list.begin(); it != end; ++it)
+		it->resize(m_buffer_size);
+	resetCounters();
+}
+
+void FrameMap::getItemGroupSize(int& item_group_size)
+{
+	DEB_MEMBER_FUNCT();
+	item_group_size = m_item_group_size;
+	DEB_RETURN() << DEB_VAR1(item_group_size);
+}
+
+int FrameMap::getGroupNbItems(int group) const
+{
+	int first = group * m_item_group_size;
+	return min(m_item_group_size, m_nb_items - first);
+}
+
+bool FrameMap::decFrameCount(int item, FrameType frame)
+{
+	int idx = frame % m_buffer_size;
+	if (!m_frame_group_count_list.empty()) {
+		int group = item / m_item_group_size;
+		CounterList& group_count_list = m_frame_group_count_list[group];
+		int group_items = getGroupNbItems(group);
+		if (!group_count_list[idx].dec_test_and_reset(group_items))
+			return false;
+	}
+	AtomicCounter& count = m_frame_item_count_list[idx];
+	return count.dec_test_and_reset(m_nb_groups);
+}
+
+// A late frame takes back the item count: if the item did not decrement
+// it yet, the frame cannot finish before. Otherwise the decrement is 
+// undone if the (group) count did not reach zero
+bool FrameMap::holdFrameCount(int item, FrameType frame, bool dec_done)
+{
+	int idx = frame % m_buffer_size;
+	AtomicCounter& count = m_frame_item_count_list[idx];
+	if (m_frame_group_count_list.empty()) {
+		if (!dec_done)
+			count.count.fetch_add(1, std::memory_order_acq_rel);
+		return !dec_done || count.inc_if_pending(m_nb_groups);
+	}
+
+	int group = item / m_item_group_size;
+	AtomicCounter& group_count = m_frame_group_count_list[group][idx];
+	if (!dec_done) {
+		group_count.count.fetch_add(1, std::memory_order_acq_rel);
+		return true;
+	}
+	if (group_count.inc_if_pending(getGroupNbItems(group)))
+		return true;
+	if (!count.inc_if_pending(m_nb_groups))
+		return false;
+	// the group had finished: only this item is pending again
+	group_count.set(1);
+	return true;
+}
+
+void FrameMap::resetCounters()
+{
+	DEB_MEMBER_FUNCT();
+	CounterList::iterator it, end;
+	CounterList& count_list = m_frame_item_count_list;
+	end = count_list.end();
+	for (it = count_list.begin(); it != end; ++it)
+		it->set(m_nb_groups);
+	int nb_groups = m_frame_group_count_list.size();
+	for (int g = 0; g < nb_groups; ++g) {
+		CounterList& group_count_list = m_frame_group_count_list[g];
+		int group_items = getGroupNbItems(g);
+		end = group_count_list.end();
+		for (it = group_count_list.begin(); it != end; ++it)
+			it->set(group_items);
+	}
 }
 
 void FrameMap::setBufferSize(int buffer_size)
@@ -748,7 +1327,116 @@ void FrameMap::setBufferSize(int buffer_size)
 		return;
 
 	m_frame_item_count_list.resize(buffer_size);
+	CounterListList::iterator it, end = m_frame_group_count_list.end();
+	for (it = m_frame_group_count_list.begin(); it != end; ++it)
+		it->resize(buffer_size);
 	m_buffer_size = buffer_size;
+	updateItemQueues();
+	updateBadItemMask();
+}
+
+void FrameMap::updateBadItemMask()
+{
+	DEB_MEMBER_FUNCT();
+	m_mask_words = (m_nb_items + MaskWordBits - 1) / MaskWordBits;
+	m_bad_item_mask.clear();
+	m_bad_item_mask.resize(m_buffer_size * m_mask_words);
+	DEB_TRACE() << DEB_VAR1(m_mask_words);
+}
+
+FrameMap::AtomicMask& FrameMap::getBadItemWord(int item, FrameType frame)
+{
+	int idx = frame % m_buffer_size;
+	return m_bad_item_mask[idx * m_mask_words + item / MaskWordBits];
+}
+
+void FrameMap::setBadItem(int item, FrameType frame, bool bad)
+{
+	// published to the readers by the frame count release/acquire
+	std::memory_order order = std::memory_order_relaxed;
+	uint64_t bit = uint64_t(1) << (item % MaskWordBits);
+	AtomicMask& word = getBadItemWord(item, frame);
+	if (bad)
+		word.bits.fetch_or(bit, order);
+	else
+		word.bits.fetch_and(~bit, order);
+}
+
+bool FrameMap::hasBadItems(FrameType frame) const
+{
+	const AtomicMask *mask = getBadItemMask(frame);
+	for (int i = 0; i < m_mask_words; ++i)
+		if (mask[i].bits.load(std::memory_order_relaxed))
+			return true;
+	return false;
+}
+
+bool FrameMap::isBadItem(int item, FrameType frame) const
+{
+	const AtomicMask *mask = getBadItemMask(frame);
+	uint64_t bits = mask[item / MaskWordBits].bits.load();
+	return (bits >> (item % MaskWordBits)) & 1;
+}
+
+void FrameMap::getBadItemList(FrameType frame, IntList& bad_item_list) const
+{
+	bad_item_list.clear();
+	const AtomicMask *mask = getBadItemMask(frame);
+	for (int i = 0; i < m_mask_words; ++i) {
+		uint64_t bits = mask[i].bits.load(std::memory_order_relaxed);
+		for (; bits; bits &= bits - 1)
+			bad_item_list.push_back(i * MaskWordBits + 
+						__builtin_ctzll(bits));
+	}
+}
+
+void FrameMap::setQueueSize(int queue_size)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(queue_size);
+	if (queue_size < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(queue_size);
+	m_queue_size = queue_size;
+	updateItemQueues();
+}
+
+void FrameMap::getQueueSize(int& queue_size)
+{
+	DEB_MEMBER_FUNCT();
+	queue_size = m_queue_size;
+	DEB_RETURN() << DEB_VAR1(queue_size);
+}
+
+void FrameMap::setQueueWaitPolicy(WaitPolicy policy)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(policy);
+	m_queue_wait_policy = policy;
+	updateItemQueues();
+}
+
+void FrameMap::getQueueWaitPolicy(WaitPolicy& policy)
+{
+	DEB_MEMBER_FUNCT();
+	policy = m_queue_wait_policy;
+	DEB_RETURN() << DEB_VAR1(policy);
+}
+
+int FrameMap::getEffectiveQueueSize() const
+{
+	return m_queue_size ? m_queue_size : m_buffer_size;
+}
+
+void FrameMap::updateItemQueues()
+{
+	DEB_MEMBER_FUNCT();
+	int queue_size = getEffectiveQueueSize();
+	if (queue_size == 0)
+		return;
+	ItemList::iterator it, end = m_item_list.end();
+	for (it = m_item_list.begin(); it != end; ++it)
+		(*it)->setQueueConfig(queue_size, m_queue_wait_policy);
 }
 
 void FrameMap::clear()
@@ -756,11 +1444,9 @@ void FrameMap::clear()
 	DEB_MEMBER_FUNCT();
 	ItemList::iterator it, end = m_item_list.end();
 	for (it = m_item_list.begin(); it != end; ++it)
-		it->clear();
-	CounterList& count_list = m_frame_item_count_list;
-	CounterList::iterator cit, cend = count_list.end();
-	for (cit = count_list.begin(); cit != cend; ++cit)
-		cit->set(m_nb_items);
+		(*it)->clear();
+	resetCounters();
+	updateBadItemMask();
 }
 
 FrameArray FrameMap::getItemFrameArray() const
@@ -768,10 +1454,19 @@ FrameArray FrameMap::getItemFrameArray() const
 	FrameArray frame_array;
 	ItemList::const_iterator it, end = m_item_list.end();
 	for (it = m_item_list.begin(); it != end; ++it)
-		frame_array.push_back(it->m_last_frame);
+		frame_array.push_back((*it)->m_last_frame);
 	return frame_array;
 }
 
+IntList FrameMap::getItemQueueHighWatermarkList() const
+{
+	IntList watermark_list;
+	ItemList::const_iterator it, end = m_item_list.end();
+	for (it = m_item_list.begin(); it != end; ++it)
+		watermark_list.push_back((*it)->getQueueHighWatermark());
+	return watermark_list;
+}
+
 ostream& lima::SlsDetector::operator <<(ostream& os, const FrameMap& m)
 {
 	os << "<";
@@ -781,8 +1476,337 @@ ostream& lima::SlsDetector::operator <<(ostream& os, const FrameMap& m)
 	return os << ">";
 }
 
+const int LostFrameDetector::MinLagThreshold = 4;
+const double LostFrameDetector::MinStallTime = 1e-3;
+const double LostFrameDetector::SkewDecay = 0.999;
+
+LostFrameDetector::LostFrameDetector()
+	: m_frame_period(0), m_stop_timeout(0)
+{
+	DEB_CONSTRUCTOR();
+	reset(0);
+}
+
+void LostFrameDetector::setFramePeriod(double frame_period)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(frame_period);
+	if (frame_period < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(frame_period);
+	m_frame_period = frame_period;
+}
+
+void LostFrameDetector::getFramePeriod(double& frame_period)
+{
+	DEB_MEMBER_FUNCT();
+	frame_period = m_frame_period;
+	DEB_RETURN() << DEB_VAR1(frame_period);
+}
+
+void LostFrameDetector::setStopTimeout(double stop_timeout)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(stop_timeout);
+	if (stop_timeout < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(stop_timeout);
+	m_stop_timeout = stop_timeout;
+}
+
+void LostFrameDetector::getStopTimeout(double& stop_timeout)
+{
+	DEB_MEMBER_FUNCT();
+	stop_timeout = m_stop_timeout;
+	DEB_RETURN() << DEB_VAR1(stop_timeout);
+}
+
+void LostFrameDetector::reset(int nb_ports)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(nb_ports);
+	PortData data;
+	data.frame = -1;
+	data.t = Timestamp::now();
+	m_port_list.assign(nb_ports, data);
+	m_latest = -1;
+	m_latest_t = data.t;
+	m_skew = 0;
+	m_late_ports = false;
+}
+
+int LostFrameDetector::getLagThreshold() const
+{
+	return max(MinLagThreshold, int(ceil(2 * m_skew)) + 1);
+}
+
+double LostFrameDetector::getStallTime() const
+{
+	return max(MinStallTime, getLagThreshold() * m_frame_period);
+}
+
+double LostFrameDetector::getCheckTimeout() const
+{
+	return (isActive() && m_late_ports) ? getStallTime() : -1;
+}
+
+void LostFrameDetector::check(const FrameArray& ifa, Timestamp now, 
+			      PortFrameList& lost_list)
+{
+	DEB_MEMBER_FUNCT();
+
+	lost_list.clear();
+	m_late_ports = false;
+	FrameType latest = getLatestFrame(ifa);
+	if (!isActive() || !isValidFrame(latest))
+		return;
+	if (latest != m_latest) {
+		m_latest = latest;
+		m_latest_t = now;
+	}
+
+	// skew sampled on the ports that progressed since the last check
+	int nb_ports = m_port_list.size();
+	FrameType skew = 0;
+	for (int i = 0; i < nb_ports; ++i) {
+		PortData& p = m_port_list[i];
+		if (ifa[i] == p.frame)
+			continue;
+		p.frame = ifa[i];
+		p.t = now;
+		if (isValidFrame(p.frame))
+			skew = max(skew, latest - p.frame);
+	}
+	m_skew = max(double(skew), m_skew * SkewDecay);
+
+	int threshold = getLagThreshold();
+	double stall_time = getStallTime();
+	double stop_time = max(m_stop_timeout, stall_time);
+	bool all_stopped = (now - m_latest_t >= stop_time);
+	for (int i = 0; i < nb_ports; ++i) {
+		const PortData& p = m_port_list[i];
+		FrameType lag = isValidFrame(p.frame) ? latest - p.frame : 
+							latest + 1;
+		if (lag == 0)
+			continue;
+		m_late_ports = true;
+		if (now - p.t < stall_time)
+			continue;
+		if (all_stopped)
+			lost_list.push_back(PortFrame(i, latest));
+		else if (lag > FrameType(threshold))
+			lost_list.push_back(PortFrame(i, latest - threshold));
+	}
+
+	if (!lost_list.empty())
+		DEB_TRACE() << DEB_VAR4(latest, threshold, stall_time, 
+					lost_list.size());
+}
+
+SeqFilter::SeqFilter(int size)
+	: m_size(0), m_next(0)
+{
+	DEB_CONSTRUCTOR();
+	setSize(size);
+}
+
+void SeqFilter::setSize(int size)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(size);
+
+	if (size < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(size);
+	// whole words: a run never wraps in the middle of a word
+	int nb_words = (size + WordBits - 1) / WordBits;
+	m_size = nb_words * WordBits;
+	m_word_list.assign(nb_words, 0);
+	reset();
+}
+
+void SeqFilter::reset(FrameType first)
+{
+	DEB_MEMBER_FUNCT();
+	m_next = first;
+	fill(m_word_list.begin(), m_word_list.end(), 0);
+}
+
+bool SeqFilter::checkVal(FrameType val, int nb)
+{
+	DEB_MEMBER_FUNCT();
+	if (m_size == 0)
+		THROW_HW_ERROR(Error) << "SeqFilter size not defined";
+	bool ok = ((val >= m_next) && (val + nb <= m_next + m_size));
+	if (!ok)
+		DEB_WARNING() << "SeqFilter: " << DEB_VAR2(val, nb) 
+			      << " out of window: " 
+			      << DEB_VAR2(m_next, m_size);
+	return ok;
+}
+
+bool SeqFilter::addVal(FrameType new_val)
+{
+	DEB_MEMBER_FUNCT();
+	if (!checkVal(new_val))
+		return false;
+	m_word_list[wordIdx(new_val)] |= bitMask(new_val);
+	return true;
+}
+
+bool SeqFilter::addRange(const FrameRange& range)
+{
+	DEB_MEMBER_FUNCT();
+	if (range.nb == 0)
+		return true;
+	if (!checkVal(range.first, range.nb))
+		return false;
+
+	FrameType f = range.first;
+	int left = range.nb;
+	while (left > 0) {
+		int bit = f % WordBits;
+		int n = min(left, WordBits - bit);
+		Word mask = (n == WordBits) ? ~Word(0) : 
+					      ((Word(1) << n) - 1) << bit;
+		m_word_list[wordIdx(f)] |= mask;
+		f += n;
+		left -= n;
+	}
+	return true;
+}
+
+FrameRange SeqFilter::getSeqRange()
+{
+	FrameRange range(m_next, 0);
+	while (m_size) {
+		Word& w = m_word_list[wordIdx(m_next)];
+		int bit = m_next % WordBits;
+		Word pending = ~(w >> bit);
+		int max_run = WordBits - bit;
+		int run = pending ? min(__builtin_ctzll(pending), max_run) : 
+				    max_run;
+		if (run == 0)
+			break;
+		Word mask = (run == WordBits) ? ~Word(0) : 
+						((Word(1) << run) - 1) << bit;
+		w &= ~mask;
+		range.nb += run;
+		m_next += run;
+		if (run < max_run)
+			break;
+	}
+	return range;
+}
+
+const double FrameMetaData::TimestampUnit = 100e-9;
+
+FrameMetaData::FrameMetaData()
+	: det_frame(-1), bunch_id(0), timestamp(0), mod_id(0), x(0), y(0), 
+	  z(0), debug(0), recv_packets(0)
+{}
+
+ostream& lima::SlsDetector::operator <<(ostream& os, const FrameMetaData& md)
+{
+	os << "<";
+	os << "det_frame=" << md.det_frame << ", "
+	   << "bunch_id=" << md.bunch_id << ", "
+	   << "timestamp=" << md.timestamp << ", "
+	   << "mod_id=" << md.mod_id << ", "
+	   << "x=" << md.x << ", y=" << md.y << ", z=" << md.z << ", "
+	   << "debug=" << DebHex(md.debug) << ", "
+	   << "recv_packets=" << md.recv_packets;
+	return os << ">";
+}
+
+static_assert(sizeof(FrameMetaData) % sizeof(uint64_t) == 0,
+	      "FrameMetaData must be made of 64-bit words");
+
+FrameMetaDataRing::Slot::Slot()
+	: seq(0), frame(-1)
+{
+	for (int i = 0; i < NbWords; ++i)
+		word[i].store(0, memory_order_relaxed);
+}
+
+FrameMetaDataRing::Slot::Slot(const Slot& o)
+	: seq(0), frame(o.frame.load(memory_order_relaxed))
+{
+	for (int i = 0; i < NbWords; ++i)
+		word[i].store(o.word[i].load(memory_order_relaxed), 
+			      memory_order_relaxed);
+}
+
+FrameMetaDataRing::FrameMetaDataRing()
+{
+	DEB_CONSTRUCTOR();
+}
+
+void FrameMetaDataRing::setSize(int size)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(size);
+	if (size < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(size);
+	m_slot_list.clear();
+	m_slot_list.resize(size);
+}
+
+void FrameMetaDataRing::clear()
+{
+	DEB_MEMBER_FUNCT();
+	SlotList::iterator it, end = m_slot_list.end();
+	for (it = m_slot_list.begin(); it != end; ++it)
+		it->frame.store(-1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+void FrameMetaDataRing::put(FrameType frame, const FrameMetaData& md)
+{
+	if (m_slot_list.empty())
+		return;
+	Slot& slot = m_slot_list[frame % m_slot_list.size()];
+	uint64_t word[NbWords];
+	memcpy(word, &md, sizeof(word));
+
+	unsigned int seq = slot.seq.load(memory_order_relaxed);
+	slot.seq.store(seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot.frame.store(frame, memory_order_relaxed);
+	for (int i = 0; i < NbWords; ++i)
+		slot.word[i].store(word[i], memory_order_relaxed);
+	slot.seq.store(seq + 2, memory_order_release);
+}
+
+bool FrameMetaDataRing::get(FrameType frame, FrameMetaData& md) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(frame);
+
+	if (m_slot_list.empty() || !isValidFrame(frame))
+		return false;
+	const Slot& slot = m_slot_list[frame % m_slot_list.size()];
+	uint64_t word[NbWords];
+	unsigned int seq0, seq1;
+	FrameType slot_frame;
+	do {
+		seq0 = slot.seq.load(memory_order_acquire);
+		slot_frame = slot.frame.load(memory_order_relaxed);
+		for (int i = 0; i < NbWords; ++i)
+			word[i] = slot.word[i].load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		seq1 = slot.seq.load(memory_order_relaxed);
+	} while ((seq0 & 1) || (seq0 != seq1));
+
+	bool ok = (slot_frame == frame);
+	if (ok)
+		memcpy(&md, word, sizeof(word));
+	DEB_RETURN() << DEB_VAR1(ok);
+	return ok;
+}
+
 Stats::Stats()
-	: cb_period(1e6), new_finish(1e6), cb_exec(1e6), recv_exec(1e6)
+	: cb_period(1e6), new_finish(1e6), cb_exec(1e6), recv_exec(1e6),
+	  det_period(1e6)
 {}
 
 void Stats::reset()
@@ -791,6 +1815,7 @@ void Stats::reset()
 	new_finish.reset();
 	cb_exec.reset();
 	recv_exec.reset();
+	det_period.reset();
 }
 
 Stats& Stats::operator +=(const Stats& o)
@@ -799,16 +1824,41 @@ Stats& Stats::operator +=(const Stats& o)
 	new_finish += o.new_finish;
 	cb_exec += o.cb_exec;
 	recv_exec += o.recv_exec;
+	det_period += o.det_period;
 	return *this;
 }
 
+StatsRecorder::StatsRecorder()
+	: cb_period(1e6), new_finish(1e6), cb_exec(1e6), recv_exec(1e6),
+	  det_period(1e6)
+{}
+
+void StatsRecorder::reset()
+{
+	cb_period.reset();
+	new_finish.reset();
+	cb_exec.reset();
+	recv_exec.reset();
+	det_period.reset();
+}
+
+void StatsRecorder::getSnapshot(Stats& s) const
+{
+	cb_period.getSnapshot(s.cb_period);
+	new_finish.getSnapshot(s.new_finish);
+	cb_exec.getSnapshot(s.cb_exec);
+	recv_exec.getSnapshot(s.recv_exec);
+	det_period.getSnapshot(s.det_period);
+}
+
 ostream& lima::SlsDetector::operator <<(ostream& os, const Stats& s)
 {
 	os << "<";
 	os << "cb_period=" << s.cb_period << ", "
 	   << "new_finish=" << s.new_finish << ", "
 	   << "cb_exec=" << s.cb_exec << ", "
-	   << "recv_exec=" << s.recv_exec;
+	   << "recv_exec=" << s.recv_exec << ", "
+	   << "det_period=" << s.det_period;
 	return os << ">";
 }
 
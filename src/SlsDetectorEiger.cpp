@@ -23,6 +23,9 @@
 #include "SlsDetectorEiger.h"
 #include "lima/MiscUtils.h"
 
+#include <numa.h>
+#include <sched.h>
+
 using namespace std;
 using namespace lima;
 using namespace lima::SlsDetector;
@@ -72,70 +75,62 @@ void Eiger::CorrBase::prepareAcq()
 	m_inter_lines[m_nb_eiger_modules - 1] = 0;
 }
 
-void Eiger::BadRecvFrameCorr::BadFrameData::reset()
+bool Eiger::CorrBase::copyCorrectFrame(FrameType frame, void *dest,
+				       const void *src, int size)
 {
-	last_idx = 0;
-	bad_frame_list.clear();
+	DEB_MEMBER_FUNCT();
+	memcpy(dest, src, size);
+	correctFrame(frame, dest);
+	return true;
 }
 
 Eiger::BadRecvFrameCorr::BadRecvFrameCorr(Eiger *eiger)
 	: CorrBase(eiger)
 {
 	DEB_CONSTRUCTOR();
-
-	m_cam = m_eiger->getCamera();
-	m_nb_ports = m_cam->getTotNbPorts();
-	m_bfd_list.resize(m_nb_ports);
 }
 
 void Eiger::BadRecvFrameCorr::prepareAcq()
 {
 	DEB_MEMBER_FUNCT();
-
 	CorrBase::prepareAcq();
+}
 
-	for (int i = 0; i < m_nb_ports; ++i)
-		m_bfd_list[i].reset();
+void Eiger::BadRecvFrameCorr::updateBadPortList(FrameType frame)
+{
+	DEB_MEMBER_FUNCT();
+	// the ports mark the frame bad before finishing it
+	m_eiger->getBadPortList(frame, m_bad_port_list);
 }
 
-void Eiger::BadRecvFrameCorr::correctFrame(FrameType frame, void *ptr)
+void Eiger::BadRecvFrameCorr::fillBadPorts(FrameType frame, void *ptr)
 {
 	DEB_MEMBER_FUNCT();
 
 	char *bptr = (char *) ptr;
-	for (int i = 0; i < m_nb_ports; ++i) {
-		BadFrameData& bfd = m_bfd_list[i];
-		IntList& bfl = bfd.bad_frame_list;
-		int& last_idx = bfd.last_idx;
-		if (bfl.empty()) {
-			int bad_frames = m_cam->getNbBadFrames(i);
-			if (bad_frames == last_idx)
-				continue;
-			m_cam->getBadFrameList(i, last_idx, bad_frames, bfl);
-		}
-		IntList::iterator end = bfl.end();
-		if (find(bfl.begin(), end, frame) != end)
-			m_eiger->processRecvPort(i, frame, NULL, 0, bptr);
-		if (*(end - 1) > int(frame))
-			continue;
-		last_idx += bfl.size();
-		bfl.clear();
-	}
+	IntList::const_iterator it, end = m_bad_port_list.end();
+	for (it = m_bad_port_list.begin(); it != end; ++it)
+		m_eiger->processRecvPort(*it, frame, NULL, 0, bptr);
 }
 
-Eiger::PixelDepth4Corr::PixelDepth4Corr(Eiger *eiger)
-	: CorrBase(eiger), m_port_geom_list(eiger->m_port_geom_list)
+void Eiger::BadRecvFrameCorr::correctFrame(FrameType frame, void *ptr)
 {
-	DEB_CONSTRUCTOR();
+	DEB_MEMBER_FUNCT();
+	updateBadPortList(frame);
+	fillBadPorts(frame, ptr);
 }
 
-void Eiger::PixelDepth4Corr::correctFrame(FrameType frame, void *ptr)
+bool Eiger::BadRecvFrameCorr::copyCorrectFrame(FrameType frame, void *dest,
+					       const void *src, int size)
 {
 	DEB_MEMBER_FUNCT();
-
-	PortGeometryList::iterator it, end = m_port_geom_list.end();
-	for (it = m_port_geom_list.begin(); it != end; ++it)
-		(*it)->expandPixelDepth4(frame, (char *) ptr);
+	updateBadPortList(frame);
+	// usual case: no bad port, let the next correction do the copy
+	if (m_bad_port_list.empty())
+		return false;
+	memcpy(dest, src, size);
+	fillBadPorts(frame, dest);
+	return true;
 }
 
 Eiger::InterModGapCorr::InterModGapCorr(Eiger *eiger)
@@ -161,21 +156,36 @@ void Eiger::InterModGapCorr::prepareAcq()
 		m_gap_list.push_back(Block(start, size));
 		start += size;
 	}
+
+	// neither the port threads nor the other corrections write 
+	// (non-zero values) in the gaps: clear them in the whole ring.
+	// Data is not read back, use streaming stores
+	StreamCopy::FillFunc fill = StreamCopy::getFillFunc();
+	int nb_buffers = m_eiger->getNbBuffers();
+	for (int i = 0; i < nb_buffers; ++i)
+		clearGaps(m_eiger->getFrameBufferPtr(i), fill);
+	StreamCopy::fence();
+	DEB_TRACE() << "Cleared " << DEB_VAR2(nb_buffers, m_gap_list.size());
 }
 
-void Eiger::InterModGapCorr::correctFrame(FrameType frame, void *ptr)
+void Eiger::InterModGapCorr::clearGaps(char *ptr, StreamCopy::FillFunc fill)
 {
 	DEB_MEMBER_FUNCT();
 	
-	char *dest = static_cast<char *>(ptr);
 	BlockList::const_iterator it, end = m_gap_list.end();
 	for (it = m_gap_list.begin(); it != end; ++it) {
 		int start = it->first;
 		int size = it->second;
-		memset(dest + start, 0, size);
+		fill(ptr + start, 0, size);
 	}
 }
 
+void Eiger::InterModGapCorr::correctFrame(FrameType /*frame*/, 
+					  void * /*ptr*/)
+{
+	// not in the per-frame list: gaps already cleared in prepareAcq
+}
+
 Eiger::Correction::Correction(Eiger *eiger)
 	: m_eiger(eiger)
 {
@@ -191,38 +201,196 @@ Data Eiger::Correction::process(Data& data)
 	
 	Data ret = data;
 
+	FrameType frame = ret.frameNumber;
+	CorrList& corr_list = m_eiger->m_corr_list;
+	CorrList::iterator it = corr_list.begin(), end = corr_list.end();
+
 	if (!_processingInPlaceFlag) {
 		int size = data.size();
-		Buffer *buffer = new Buffer(size);
-		memcpy(buffer->data, data.data(), size);
+		Buffer *buffer = m_eiger->m_buffer_pool->getBuffer(size);
 		ret.setBuffer(buffer);
 		buffer->unref();
+		// the first correction writing dest does the copy
+		void *src = data.data();
+		bool copied = false;
+		for (; !copied && (it != end); ++it)
+			copied = (*it)->copyCorrectFrame(frame, ret.data(),
+							 src, size);
+		if (!copied)
+			memcpy(ret.data(), src, size);
 	}
 
-	FrameType frame = ret.frameNumber;
 	void *ptr = ret.data();
-	CorrList& corr_list = m_eiger->m_corr_list;
-	CorrList::iterator it, end = corr_list.end();
-	for (it = corr_list.begin(); it != end; ++it)
+	for (; it != end; ++it)
 		(*it)->correctFrame(frame, ptr);
 
 	return ret;
 }
 
-Eiger::RecvPortGeometry::RecvPortGeometry(Eiger *eiger, int recv_idx, int port)
-	: m_eiger(eiger), m_port(port), m_recv_idx(recv_idx)
+const int Eiger::BufferPool::MaxNodeFreeBuffers = 16;
+
+Eiger::BufferPool::BufferPool()
+	: m_size(0), m_released(false)
+{
+	DEB_CONSTRUCTOR();
+	int nb_nodes = (numa_available() < 0) ? 1 : numa_max_node() + 1;
+	m_free_list.resize(nb_nodes);
+}
+
+Eiger::BufferPool::~BufferPool()
+{
+	DEB_DESTRUCTOR();
+	clearFreeList();
+}
+
+int Eiger::BufferPool::getCurrentNode()
+{
+	if (numa_available() < 0)
+		return 0;
+	int cpu = sched_getcpu();
+	int node = (cpu < 0) ? 0 : numa_node_of_cpu(cpu);
+	return (node < 0) ? 0 : node;
+}
+
+void *Eiger::BufferPool::allocBlock(int size, int node)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(size, node);
+
+	void *ptr;
+	if (numa_available() < 0) {
+		if (posix_memalign(&ptr, CacheLineSize, size) != 0)
+			ptr = NULL;
+		node = -1;
+	} else {
+		ptr = numa_alloc_onnode(size, node);
+	}
+	if (!ptr)
+		THROW_HW_ERROR(Error) << "Error allocating " << size << " "
+				      << "bytes on node " << node;
+	Block& b = m_block_map[ptr];
+	b.size = size;
+	b.node = node;
+	DEB_RETURN() << DEB_VAR1(ptr);
+	return ptr;
+}
+
+void Eiger::BufferPool::freeBlock(void *ptr)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(ptr);
+
+	BlockMap::iterator it = m_block_map.find(ptr);
+	if (it == m_block_map.end())
+		THROW_HW_ERROR(Error) << "Invalid buffer " << ptr;
+	Block& b = it->second;
+	if (b.node < 0)
+		free(ptr);
+	else
+		numa_free(ptr, b.size);
+	m_block_map.erase(it);
+}
+
+void Eiger::BufferPool::clearFreeList()
+{
+	DEB_MEMBER_FUNCT();
+
+	vector<PtrList>::iterator it, end = m_free_list.end();
+	for (it = m_free_list.begin(); it != end; ++it) {
+		PtrList::iterator pit, pend = it->end();
+		for (pit = it->begin(); pit != pend; ++pit)
+			freeBlock(*pit);
+		it->clear();
+	}
+}
+
+Buffer *Eiger::BufferPool::getBuffer(int size)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(size);
+
+	int node = getCurrentNode();
+	void *ptr;
+	{
+		AutoMutex l = lock();
+		if (size != m_size) {
+			clearFreeList();
+			m_size = size;
+		}
+		PtrList& free_list = m_free_list[node];
+		if (!free_list.empty()) {
+			ptr = free_list.back();
+			free_list.pop_back();
+		} else {
+			// pages will be placed on node by the first touch
+			ptr = allocBlock(size, node);
+		}
+	}
+
+	Buffer *buffer = new Buffer();
+	buffer->owner = Buffer::SHARED;
+	buffer->data = ptr;
+	buffer->callback = this;
+	DEB_RETURN() << DEB_VAR2(buffer, ptr);
+	return buffer;
+}
+
+void Eiger::BufferPool::destroy(void *ptr)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(ptr);
+
+	bool delete_pool;
+	{
+		AutoMutex l = lock();
+		BlockMap::iterator it = m_block_map.find(ptr);
+		if (it == m_block_map.end()) {
+			DEB_ERROR() << "Invalid buffer " << ptr;
+			return;
+		}
+		const Block& b = it->second;
+		int node = (b.node < 0) ? 0 : b.node;
+		PtrList& free_list = m_free_list[node];
+		if (m_released || (b.size != m_size) || 
+		    (int(free_list.size()) >= MaxNodeFreeBuffers))
+			freeBlock(ptr);
+		else
+			free_list.push_back(ptr);
+		delete_pool = m_released && m_block_map.empty();
+	}
+	if (delete_pool)
+		delete this;
+}
+
+void Eiger::BufferPool::release()
+{
+	DEB_MEMBER_FUNCT();
+
+	bool delete_pool;
+	{
+		AutoMutex l = lock();
+		m_released = true;
+		clearFreeList();
+		delete_pool = m_block_map.empty();
+	}
+	if (delete_pool)
+		delete this;
+}
+
+Eiger::RecvPortGeometry::RecvPortGeometry(int recv_idx, int port)
+	: m_port(port), m_recv_idx(recv_idx)
 {
 	DEB_CONSTRUCTOR();
 	DEB_PARAM() << DEB_VAR1(m_recv_idx);
 	m_top_half_recv = (m_recv_idx % 2 == 0);
 }
 
-void Eiger::RecvPortGeometry::prepareAcq()
+void Eiger::RecvPortGeometry::prepareAcq(const Config& cfg)
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(m_recv_idx);
 
-	const FrameDim& frame_dim = m_eiger->m_recv_frame_dim;
+	const FrameDim& frame_dim = cfg.recv_frame_dim;
 	const Size& size = frame_dim.getSize();
 	int depth = frame_dim.getDepth();
 	m_ilw = size.getWidth() * depth;
@@ -232,24 +400,30 @@ void Eiger::RecvPortGeometry::prepareAcq()
 	m_pchips = HalfModuleChips / RecvPorts;
 	m_scw = ChipSize * depth;
 	m_dcw = m_scw;
-	if (m_eiger->isPixelDepth4())
+	// 4-bit pixels are expanded to bytes while copied
+	m_expand4 = cfg.expand4;
+	if (m_expand4)
 		m_scw /= 2;
 
-	m_eiger->getCamera()->getRawMode(m_raw);
+	m_raw = cfg.raw;
+	if (!m_raw)
+		// inter-chip horz. gap
+		m_dcw += ChipGap * depth;
+
+	setPortFuncs(cfg.read_back);
+
 	if (m_raw) {
 		// vert. port concat.
 		m_port_offset += ChipSize * m_ilw * m_port;
 		return;
-	} else {
-		// inter-chip horz. gap
-		m_dcw += ChipGap * depth;
-		// horz. port concat.
-		m_port_offset += m_pchips * m_dcw * m_port;
 	}
 
+	// horz. port concat.
+	m_port_offset += m_pchips * m_dcw * m_port;
+
 	int mod_idx = m_recv_idx / 2;
 	for (int i = 0; i < mod_idx; ++i)
-		m_port_offset += m_eiger->getInterModuleGap(i) * m_ilw;
+		m_port_offset += cfg.inter_mod_gap[i] * m_ilw;
 
 	if (m_top_half_recv) {
 		// top-half module: vert-flipped data
@@ -273,41 +447,125 @@ void Eiger::RecvPortGeometry::processRecvPort(FrameType frame, char *dptr,
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR3(frame, m_recv_idx, m_port);
 
-	bool valid_data = (dptr != NULL);
-	char *src = dptr;
 	char *dest = bptr + m_port_offset;	
+	// with direct placement the data was received in place
+	if (dptr == NULL)
+		(this->*m_fill_port)(dest, 0xff);
+	else if (dptr != dest)
+		(this->*m_copy_port)(dest, dptr);
+	// the image is published to the processing threads afterwards
+	StreamCopy::fence();
+}
+
+int Eiger::RecvPortGeometry::getDirectOffset()
+{
+	DEB_MEMBER_FUNCT();
+	// raw mode, no 4-bit expansion: lines are contiguous in the image
+	const int pchips = HalfModuleChips / RecvPorts;
+	bool direct = (m_raw && !m_expand4 && (m_ilw == pchips * m_scw));
+	int offset = direct ? m_port_offset : -1;
+	DEB_RETURN() << DEB_VAR1(offset);
+	return offset;
+}
+
+// Port copy specialized for the chip widths of each pixel depth:
+// raw or with the inter-chip gap. 4-bit chips are packed in the source
+const Eiger::RecvPortGeometry::PortFuncs 
+Eiger::RecvPortGeometry::PortFuncList[] = {
+#define PORT_FUNCS(scw, dcw, e4) \
+	{scw, dcw, &RecvPortGeometry::copyPort<scw, dcw, e4>, \
+		   &RecvPortGeometry::fillPort<scw, dcw, e4>}
+	PORT_FUNCS(128, 256, true),	PORT_FUNCS(128, 258, true),
+	PORT_FUNCS(256, 256, false),	PORT_FUNCS(256, 258, false),
+	PORT_FUNCS(512, 512, false),	PORT_FUNCS(512, 516, false),
+	PORT_FUNCS(1024, 1024, false),	PORT_FUNCS(1024, 1032, false),
+	PORT_FUNCS(0, 0, false),
+#undef PORT_FUNCS
+};
+
+void Eiger::RecvPortGeometry::setPortFuncs(bool read_back)
+{
+	DEB_MEMBER_FUNCT();
+
+	// the RecvPortCorr corrections read the port data back: 
+	// keep it in the cache
+	read_back &= !m_raw;
+	StreamCopy::Level level = read_back ? StreamCopy::Std : 
+					      StreamCopy::Auto;
+	m_copy_func = StreamCopy::getCopyFunc(level);
+	m_fill_func = StreamCopy::getFillFunc(level);
+	m_expand4_func = StreamCopy::getExpand4Func(level);
+
+	const PortFuncs *f = PortFuncList;
+	for (; f->scw != 0; ++f)
+		if ((f->scw == m_scw) && (f->dcw == m_dcw))
+			break;
+	if (f->scw == 0)
+		DEB_WARNING() << "No specialized port copy for "
+			      << DEB_VAR2(m_scw, m_dcw);
+	m_copy_port = f->copy;
+	m_fill_port = f->fill;
+}
+
+template <int SCW, int DCW, bool E4>
+void Eiger::RecvPortGeometry::copyPort(char *dest, char *src)
+{
+	const int scw = SCW ? SCW : m_scw;
+	const int dcw = DCW ? DCW : m_dcw;
+	const bool expand4 = SCW ? E4 : m_expand4;
+	const int pchips = HalfModuleChips / RecvPorts;
+	// chip width in dest, without the inter-chip gap
+	const int cw = expand4 ? 2 * scw : scw;
+	StreamCopy::CopyFunc copy = m_copy_func;
+	StreamCopy::Expand4Func expand = m_expand4_func;
+	if (cw == dcw) {
+		// chips are contiguous in dest: one copy per line
+		const int len = pchips * scw;
+		for (int i = 0; i < ChipSize; ++i, src += len, dest += m_ilw)
+			if (expand4)
+				expand(dest, src, len);
+			else
+				copy(dest, src, len);
+		return;
+	}
 	for (int i = 0; i < ChipSize; ++i, dest += m_ilw) {
 		char *d = dest;
-		for (int j = 0; j < m_pchips; ++j, src += m_scw, d += m_dcw)
-			if (valid_data)
-				memcpy(d, src, m_scw);
+		for (int j = 0; j < pchips; ++j, src += scw, d += dcw)
+			if (expand4)
+				expand(d, src, scw);
 			else
-				memset(d, 0xff, m_scw);
+				copy(d, src, scw);
 	}
 }
 
-void Eiger::RecvPortGeometry::expandPixelDepth4(FrameType frame, char *ptr)
+template <int SCW, int DCW, bool E4>
+void Eiger::RecvPortGeometry::fillPort(char *dest, int val)
 {
-	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR3(frame, m_recv_idx, m_port);
-
-	ptr += m_port_offset;
-	for (int i = 0; i < ChipSize; ++i, ptr += m_ilw) {
-		char *chip = ptr;
-		for (int j = 0; j < m_pchips; ++j, chip += m_dcw) {
-			char *src = chip + m_scw;
-			char *dest = chip + 2 * m_scw;
-			for (int k = 0; k < ChipSize / 2; ++k) {
-				unsigned char b = *--src;
-				*--dest = b >> 4;
-				*--dest = b & 0xf;
-			}
-		}
+	const int scw = SCW ? SCW : m_scw;
+	const int dcw = DCW ? DCW : m_dcw;
+	const bool expand4 = SCW ? E4 : m_expand4;
+	const int pchips = HalfModuleChips / RecvPorts;
+	const int cw = expand4 ? 2 * scw : scw;
+	// val is a source byte: 4-bit pixels take its (low) nibble
+	if (expand4)
+		val &= 0xf;
+	StreamCopy::FillFunc fill = m_fill_func;
+	if (cw == dcw) {
+		const int len = pchips * cw;
+		for (int i = 0; i < ChipSize; ++i, dest += m_ilw)
+			fill(dest, val, len);
+		return;
+	}
+	for (int i = 0; i < ChipSize; ++i, dest += m_ilw) {
+		char *d = dest;
+		for (int j = 0; j < pchips; ++j, d += dcw)
+			fill(d, val, cw);
 	}
 }
 
 Eiger::Eiger(Camera *cam)
-	: Model(cam, EigerDet), m_fixed_clock_div(false)
+	: Model(cam, EigerDet), m_corr_mode(LinkTaskCorr), m_recv_packet_len(0),
+	  m_buffer_pool(new BufferPool()), m_fixed_clock_div(false)
 {
 	DEB_CONSTRUCTOR();
 
@@ -316,7 +574,7 @@ Eiger::Eiger(Camera *cam)
 
 	for (int i = 0; i < nb_det_modules; ++i) {
 		for (int j = 0; j < RecvPorts; ++j) {
-			RecvPortGeometry *g = new RecvPortGeometry(this, i, j);
+			RecvPortGeometry *g = new RecvPortGeometry(i, j);
 			m_port_geom_list.push_back(g);
 		}
 	}
@@ -330,6 +588,7 @@ Eiger::~Eiger()
 {
 	DEB_DESTRUCTOR();
 	removeAllCorr();
+	m_buffer_pool->release();
 }
 
 void Eiger::getFrameDim(FrameDim& frame_dim, bool raw)
@@ -561,10 +820,9 @@ void Eiger::updateImageSize()
 
 	removeAllCorr();
 
-	createBadRecvFrameCorr();
-
-	if (isPixelDepth4())
-		createPixelDepth4Corr();
+	// RecvPortCorr: bad frames are filled by the port threads
+	if (m_corr_mode == LinkTaskCorr)
+		createBadRecvFrameCorr();
 
 	Camera *cam = getCamera();
 
@@ -634,6 +892,23 @@ void Eiger::getParallelMode(ParallelMode& mode)
 	DEB_RETURN() << DEB_VAR1(mode);
 }
 
+void Eiger::setCorrMode(CorrMode corr_mode)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(corr_mode);
+	if (corr_mode == m_corr_mode)
+		return;
+	m_corr_mode = corr_mode;
+	updateImageSize();
+}
+
+void Eiger::getCorrMode(CorrMode& corr_mode)
+{
+	DEB_MEMBER_FUNCT();
+	corr_mode = m_corr_mode;
+	DEB_RETURN() << DEB_VAR1(corr_mode);
+}
+
 void Eiger::setFixedClockDiv(bool fixed_clock_div)
 {
 	DEB_MEMBER_FUNCT();
@@ -775,13 +1050,32 @@ void Eiger::prepareAcq()
 	
 	DEB_TRACE() << DEB_VAR2(raw, m_recv_frame_dim);
 
+	// 1 GbE packets carry a quarter of the 10 GbE data
+	m_recv_packet_len = EIGER_PACKET_DATA_LEN;
+	if (!isTenGigabitEthernetEnabled())
+		m_recv_packet_len /= 4;
+	DEB_TRACE() << DEB_VAR1(m_recv_packet_len);
+
+	RecvPortGeometry::Config geom_cfg;
+	geom_cfg.recv_frame_dim = m_recv_frame_dim;
+	geom_cfg.raw = raw;
+	geom_cfg.expand4 = isPixelDepth4();
+	geom_cfg.read_back = (m_corr_mode == RecvPortCorr);
+	for (int i = 0; i < getNbEigerModules() - 1; ++i)
+		geom_cfg.inter_mod_gap.push_back(getInterModuleGap(i));
 	PortGeometryList::iterator git, gend = m_port_geom_list.end();
 	for (git = m_port_geom_list.begin(); git != gend; ++git)
-		(*git)->prepareAcq();
+		(*git)->prepareAcq(geom_cfg);
 
 	CorrList::iterator cit, cend = m_corr_list.end();
 	for (cit = m_corr_list.begin(); cit != cend; ++cit)
 		(*cit)->prepareAcq();
+	cend = m_port_corr_list.end();
+	for (cit = m_port_corr_list.begin(); cit != cend; ++cit)
+		(*cit)->prepareAcq();
+	cend = m_prepare_corr_list.end();
+	for (cit = m_prepare_corr_list.begin(); cit != cend; ++cit)
+		(*cit)->prepareAcq();
 }
 
 void Eiger::processRecvFileStart(int port_idx, uint32_t dsize)
@@ -797,6 +1091,44 @@ void Eiger::processRecvPort(int port_idx, FrameType frame, char *dptr,
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR3(port_idx, frame, dsize);
 	m_port_geom_list[port_idx]->processRecvPort(frame, dptr, bptr);
+
+	CorrList::iterator it, end = m_port_corr_list.end();
+	for (it = m_port_corr_list.begin(); it != end; ++it)
+		(*it)->correctRecvPort(port_idx, frame, bptr);
+}
+
+int Eiger::getRecvPacketLen()
+{
+	DEB_MEMBER_FUNCT();
+	DEB_RETURN() << DEB_VAR1(m_recv_packet_len);
+	return m_recv_packet_len;
+}
+
+uint32_t Eiger::getRecvPortDataSize()
+{
+	DEB_MEMBER_FUNCT();
+	PixelDepth pixel_depth;
+	getCamera()->getPixelDepth(pixel_depth);
+	// 4-bit pixels are packed
+	const int pchips = HalfModuleChips / RecvPorts;
+	uint32_t size = ChipSize * pchips * ChipSize * int(pixel_depth) / 8;
+	DEB_RETURN() << DEB_VAR1(size);
+	return size;
+}
+
+int Eiger::getRecvPortDirectOffset(int port_idx)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(port_idx);
+	return m_port_geom_list[port_idx]->getDirectOffset();
+}
+
+bool Eiger::isRecvPortCorrActive()
+{
+	DEB_MEMBER_FUNCT();
+	bool active = (m_corr_mode == RecvPortCorr);
+	DEB_RETURN() << DEB_VAR1(active);
+	return active;
 }
 
 Eiger::Correction *Eiger::createCorrectionTask()
@@ -814,15 +1146,6 @@ Eiger::CorrBase *Eiger::createBadRecvFrameCorr()
 	return brf_corr;
 }
 
-Eiger::CorrBase *Eiger::createPixelDepth4Corr()
-{
-	DEB_MEMBER_FUNCT();
-	CorrBase *pd4_corr = new PixelDepth4Corr(this);
-	addCorr(pd4_corr);
-	DEB_RETURN() << DEB_VAR1(pd4_corr);
-	return pd4_corr;
-}
-
 Eiger::CorrBase *Eiger::createChipBorderCorr(ImageType image_type)
 {
 	DEB_MEMBER_FUNCT();
@@ -844,7 +1167,10 @@ Eiger::CorrBase *Eiger::createChipBorderCorr(ImageType image_type)
 			<< "Eiger correction not supported for " << image_type;
 	}
 
-	addCorr(border_corr);
+	if (m_corr_mode == RecvPortCorr)
+		addRecvPortCorr(border_corr);
+	else
+		addCorr(border_corr);
 
 	DEB_RETURN() << DEB_VAR1(border_corr);
 	return border_corr;
@@ -854,7 +1180,7 @@ Eiger::CorrBase *Eiger::createInterModGapCorr()
 {
 	DEB_MEMBER_FUNCT();
 	CorrBase *gap_corr = new InterModGapCorr(this);
-	addCorr(gap_corr);
+	addPrepareCorr(gap_corr);
 	DEB_RETURN() << DEB_VAR1(gap_corr);
 	return gap_corr;
 }
@@ -866,6 +1192,20 @@ void Eiger::addCorr(CorrBase *corr)
 	m_corr_list.push_back(corr);
 }
 
+void Eiger::addRecvPortCorr(CorrBase *corr)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(corr);
+	m_port_corr_list.push_back(corr);
+}
+
+void Eiger::addPrepareCorr(CorrBase *corr)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(corr);
+	m_prepare_corr_list.push_back(corr);
+}
+
 void Eiger::removeCorr(CorrBase *corr)
 {
 	DEB_MEMBER_FUNCT();
@@ -875,17 +1215,27 @@ void Eiger::removeCorr(CorrBase *corr)
 	it = find(m_corr_list.begin(), end, corr);
 	if (it != end)
 		m_corr_list.erase(it);
+	end = m_port_corr_list.end();
+	it = find(m_port_corr_list.begin(), end, corr);
+	if (it != end)
+		m_port_corr_list.erase(it);
+	end = m_prepare_corr_list.end();
+	it = find(m_prepare_corr_list.begin(), end, corr);
+	if (it != end)
+		m_prepare_corr_list.erase(it);
 	corr->m_eiger = NULL;
 }
 
 void Eiger::removeAllCorr()
 {
 	DEB_MEMBER_FUNCT();
-	CorrList::reverse_iterator it, end = m_corr_list.rend();
-	for (it = m_corr_list.rbegin(); it != end; ++it)
-		delete *it;
-	if (m_corr_list.size() > 0)
-		THROW_HW_ERROR(Error) << "Correction list not empty!";
+	// each delete removes the correction from its list
+	while (!m_port_corr_list.empty())
+		delete m_port_corr_list.back();
+	while (!m_corr_list.empty())
+		delete m_corr_list.back();
+	while (!m_prepare_corr_list.empty())
+		delete m_prepare_corr_list.back();
 }
 
 double Eiger::getBorderCorrFactor(int det, int line)
@@ -917,3 +1267,13 @@ ostream& lima::SlsDetector::operator <<(ostream& os, Eiger::ParallelMode mode)
 	return os << name;
 }
 
+ostream& lima::SlsDetector::operator <<(ostream& os, Eiger::CorrMode mode)
+{
+	const char *name = "Invalid";
+	switch (mode) {
+	case Eiger::LinkTaskCorr:	name = "LinkTaskCorr";	break;
+	case Eiger::RecvPortCorr:	name = "RecvPortCorr";	break;
+	}
+	return os << name;
+}
+
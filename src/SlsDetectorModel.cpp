@@ -69,3 +69,30 @@ string Model::getCmd(const string& s, int idx)
 	return m_cam->getCmd(s, idx);
 }
 
+int Model::getNbBuffers()
+{
+	DEB_MEMBER_FUNCT();
+	int nb_buffers;
+	m_cam->getBufferCbMgr()->getNbBuffers(nb_buffers);
+	DEB_RETURN() << DEB_VAR1(nb_buffers);
+	return nb_buffers;
+}
+
+char *Model::getFrameBufferPtr(FrameType frame_nb)
+{
+	DEB_MEMBER_FUNCT();
+	return m_cam->getFrameBufferPtr(frame_nb);
+}
+
+void Model::getBadPortList(FrameType frame, IntList& bad_port_list)
+{
+	DEB_MEMBER_FUNCT();
+	m_cam->m_frame_map.getBadItemList(frame, bad_port_list);
+}
+
+bool Model::isTenGigabitEthernetEnabled()
+{
+	DEB_MEMBER_FUNCT();
+	return m_cam->isTenGigabitEthernetEnabled();
+}
+
@@ -0,0 +1,496 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+#include "SlsDetectorPcapReceiver.h"
+
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <byteswap.h>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+// pcap magic numbers, as read in little endian
+#define PCAP_MAGIC_US		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+#define PCAP_MAGIC_US_SWAP	0xd4c3b2a1
+#define PCAP_MAGIC_NS_SWAP	0x4d3cb2a1
+
+#define PCAP_HEADER_LEN		24
+#define PCAP_RECORD_LEN		16
+
+// pcapng block types and options
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_PB		0x00000002
+#define PCAPNG_SPB		0x00000003
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_TSRESOL	9
+
+// link types
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_LINUX_SLL2	276
+
+#define ETH_HEADER_LEN		14
+#define SLL_HEADER_LEN		16
+#define SLL2_HEADER_LEN		20
+#define ETH_P_IPV4		0x0800
+#define ETH_P_8021Q		0x8100
+#define ETH_P_8021AD		0x88a8
+#define IP_PROTO_UDP		17
+#define UDP_HEADER_LEN		8
+
+static inline uint16_t net16(const char *p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+
+static inline uint32_t net32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+PcapFile::PcapFile(string fname)
+	: m_fname(fname), m_map(NULL), m_size(0), m_format(Pcap),
+	  m_swap(false), m_first_offset(0), m_offset(0), m_link_type(-1),
+	  m_time_unit(1e-6), m_last_time(0), m_nb_skipped(0)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR1(fname);
+
+	int fd = open(fname.c_str(), O_RDONLY);
+	if (fd < 0)
+		THROW_HW_ERROR(Error) << "Error opening " << fname << ": "
+				      << strerror(errno);
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		THROW_HW_ERROR(Error) << "Error getting size of " << fname
+				      << ": " << strerror(errno);
+	}
+	m_size = st.st_size;
+	if (m_size < PCAP_HEADER_LEN) {
+		close(fd);
+		THROW_HW_ERROR(Error) << "Invalid capture file: " << fname;
+	}
+	void *p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		THROW_HW_ERROR(Error) << "Error mapping " << fname << ": "
+				      << strerror(errno);
+	m_map = (const char *) p;
+	madvise(p, m_size, MADV_SEQUENTIAL);
+
+	try {
+		readFileHeader();
+	} catch (...) {
+		munmap((void *) m_map, m_size);
+		throw;
+	}
+}
+
+PcapFile::~PcapFile()
+{
+	DEB_DESTRUCTOR();
+	munmap((void *) m_map, m_size);
+}
+
+uint16_t PcapFile::get16(const char *p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return m_swap ? bswap_16(v) : v;
+}
+
+uint32_t PcapFile::get32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return m_swap ? bswap_32(v) : v;
+}
+
+void PcapFile::readFileHeader()
+{
+	DEB_MEMBER_FUNCT();
+
+	m_swap = false;
+	uint32_t magic = get32(m_map);
+	if (magic == PCAPNG_SHB) {
+		m_format = PcapNg;
+		m_first_offset = 0;
+	} else {
+		m_format = Pcap;
+		switch (magic) {
+		case PCAP_MAGIC_US_SWAP:
+			m_swap = true;
+			// fall through
+		case PCAP_MAGIC_US:
+			m_time_unit = 1e-6;
+			break;
+		case PCAP_MAGIC_NS_SWAP:
+			m_swap = true;
+			// fall through
+		case PCAP_MAGIC_NS:
+			m_time_unit = 1e-9;
+			break;
+		default:
+			THROW_HW_ERROR(Error) << "Unknown capture format: "
+					      << m_fname;
+		}
+		m_link_type = get32(m_map + 20) & 0xffff;
+		m_first_offset = PCAP_HEADER_LEN;
+	}
+	DEB_TRACE() << DEB_VAR3(m_format, m_swap, m_link_type);
+	rewind();
+}
+
+void PcapFile::rewind()
+{
+	m_offset = m_first_offset;
+	m_last_time = 0;
+	if (m_format == PcapNg)
+		m_if_list.clear();
+}
+
+bool PcapFile::next(Packet& packet)
+{
+	DEB_MEMBER_FUNCT();
+
+	while (true) {
+		const char *p;
+		int len, link_type;
+		double time;
+		if (m_format == Pcap) {
+			if (m_offset + PCAP_RECORD_LEN > m_size)
+				return false;
+			const char *r = m_map + m_offset;
+			uint32_t cap_len = get32(r + 8);
+			uint32_t orig_len = get32(r + 12);
+			if (m_offset + PCAP_RECORD_LEN + cap_len > m_size) {
+				DEB_WARNING() << "Truncated capture file";
+				return false;
+			}
+			m_offset += PCAP_RECORD_LEN + cap_len;
+			if (cap_len < orig_len) {
+				++m_nb_skipped;
+				continue;
+			}
+			time = get32(r) + get32(r + 4) * m_time_unit;
+			p = r + PCAP_RECORD_LEN;
+			len = cap_len;
+			link_type = m_link_type;
+		} else if (!nextPcapNgRecord(p, len, link_type, time)) {
+			return false;
+		} else if (!p) {
+			continue;
+		}
+		m_last_time = time;
+		if (decodePacket(p, len, link_type, packet)) {
+			packet.time = time;
+			return true;
+		}
+	}
+}
+
+bool PcapFile::nextPcapNgRecord(const char *& p, int& len, int& link_type,
+				double& time)
+{
+	DEB_MEMBER_FUNCT();
+
+	p = NULL;
+	if (m_offset + 12 > m_size)
+		return false;
+	const char *b = m_map + m_offset;
+	uint32_t block_type = get32(b);
+	if (block_type == PCAPNG_SHB) {
+		// the byte order can change at each section
+		uint32_t bom;
+		memcpy(&bom, b + 8, sizeof(bom));
+		m_swap = (bom != PCAPNG_BYTE_ORDER);
+	}
+	uint32_t block_len = get32(b + 4);
+	if ((block_len < 12) || (block_len % 4) ||
+	    (m_offset + block_len > m_size)) {
+		DEB_WARNING() << "Truncated capture file";
+		return false;
+	}
+	m_offset += block_len;
+
+	uint32_t cap_len, orig_len;
+	int if_idx = 0;
+	switch (block_type) {
+	case PCAPNG_SHB:
+		// interface IDs are local to the section
+		m_if_list.clear();
+		return true;
+	case PCAPNG_IDB:
+		readInterface(b, block_len);
+		return true;
+	case PCAPNG_EPB:
+	case PCAPNG_PB:
+		if (block_len < 32)
+			return true;
+		if (block_type == PCAPNG_EPB)
+			if_idx = get32(b + 8);
+		else
+			if_idx = get16(b + 8);
+		cap_len = get32(b + 20);
+		orig_len = get32(b + 24);
+		if (cap_len > block_len - 32)
+			return true;
+		p = b + 28;
+		break;
+	case PCAPNG_SPB:
+		if (block_len < 16)
+			return true;
+		orig_len = get32(b + 8);
+		cap_len = min(orig_len, block_len - 16);
+		p = b + 12;
+		break;
+	default:
+		return true;
+	}
+
+	if (if_idx >= int(m_if_list.size())) {
+		DEB_WARNING() << "Packet of unknown interface: "
+			      << DEB_VAR1(if_idx);
+		p = NULL;
+		return true;
+	}
+	const Interface& iface = m_if_list[if_idx];
+	if (block_type == PCAPNG_SPB) {
+		time = m_last_time;
+	} else {
+		uint64_t ts = (uint64_t(get32(b + 12)) << 32) | get32(b + 16);
+		time = ts * iface.time_unit;
+	}
+	if (cap_len < orig_len) {
+		++m_nb_skipped;
+		p = NULL;
+		return true;
+	}
+	len = cap_len;
+	link_type = iface.link_type;
+	return true;
+}
+
+void PcapFile::readInterface(const char *b, uint32_t block_len)
+{
+	DEB_MEMBER_FUNCT();
+
+	Interface iface;
+	iface.link_type = get16(b + 8);
+	iface.time_unit = 1e-6;
+	// options, after the 8-byte block header and 8-byte IDB body
+	const char *o = b + 16, *end = b + block_len - 4;
+	while (o + 4 <= end) {
+		int code = get16(o);
+		int len = get16(o + 2);
+		if ((code == PCAPNG_OPT_END) || (o + 4 + len > end))
+			break;
+		if ((code == PCAPNG_OPT_TSRESOL) && (len >= 1)) {
+			uint8_t r = o[4];
+			if (r & 0x80)
+				iface.time_unit = pow(2.0, -(r & 0x7f));
+			else
+				iface.time_unit = pow(10.0, -r);
+		}
+		o += 4 + (len + 3) / 4 * 4;
+	}
+	DEB_TRACE() << DEB_VAR2(iface.link_type, iface.time_unit);
+	m_if_list.push_back(iface);
+}
+
+bool PcapFile::decodePacket(const char *p, int len, int link_type,
+			    Packet& packet)
+{
+	DEB_MEMBER_FUNCT();
+
+	int ip_offset;
+	int eth_type = ETH_P_IPV4;
+	switch (link_type) {
+	case LINKTYPE_ETHERNET:
+		if (len < ETH_HEADER_LEN)
+			return false;
+		ip_offset = ETH_HEADER_LEN;
+		eth_type = net16(p + 12);
+		while (((eth_type == ETH_P_8021Q) ||
+			(eth_type == ETH_P_8021AD)) &&
+		       (len >= ip_offset + 4)) {
+			eth_type = net16(p + ip_offset + 2);
+			ip_offset += 4;
+		}
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (len < SLL_HEADER_LEN)
+			return false;
+		ip_offset = SLL_HEADER_LEN;
+		eth_type = net16(p + 14);
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		if (len < SLL2_HEADER_LEN)
+			return false;
+		ip_offset = SLL2_HEADER_LEN;
+		eth_type = net16(p);
+		break;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+		ip_offset = 0;
+		break;
+	default:
+		return false;
+	}
+	if (eth_type != ETH_P_IPV4)
+		return false;
+
+	const char *ip = p + ip_offset;
+	len -= ip_offset;
+	if ((len < 20) || ((ip[0] >> 4) != 4))
+		return false;
+	int ip_hlen = (ip[0] & 0xf) * 4;
+	if ((ip_hlen < 20) || (uint8_t(ip[9]) != IP_PROTO_UDP))
+		return false;
+	// fragments cannot be replayed as single datagrams
+	if (net16(ip + 6) & 0x3fff) {
+		++m_nb_skipped;
+		return false;
+	}
+	if (len < ip_hlen + UDP_HEADER_LEN)
+		return false;
+	const char *udp = ip + ip_hlen;
+	int udp_len = net16(udp + 4);
+	if ((udp_len < UDP_HEADER_LEN) || (ip_hlen + udp_len > len)) {
+		++m_nb_skipped;
+		return false;
+	}
+
+	packet.dst_ip = net32(ip + 16);
+	packet.udp_port = net16(udp + 2);
+	packet.data = udp + UDP_HEADER_LEN;
+	packet.len = udp_len - UDP_HEADER_LEN;
+	return true;
+}
+
+PcapPortReceiver::PcapPortReceiver(FrameHandler *handler, string fname,
+				   int udp_port, double time_scale,
+				   int nb_packets)
+	: PortPacketReceiver(handler), m_file(fname), m_udp_port(udp_port),
+	  m_time_scale(time_scale), m_nb_packets(nb_packets),
+	  m_finished(false), m_pending(false), m_t0(-1), m_capture_t0(0)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR4(fname, udp_port, time_scale, nb_packets);
+
+	if (time_scale < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid "
+					     << DEB_VAR1(time_scale);
+	rewind();
+}
+
+PcapPortReceiver::~PcapPortReceiver()
+{
+	DEB_DESTRUCTOR();
+}
+
+void PcapPortReceiver::rewind()
+{
+	DEB_MEMBER_FUNCT();
+
+	m_file.rewind();
+	m_t0 = -1;
+	// time origin: first packet of the capture, whatever its port, so
+	// the replays of the different ports keep their relative timing
+	m_pending = m_file.next(m_packet);
+	if (m_pending) {
+		m_capture_t0 = m_packet.time;
+		m_pending = (m_packet.udp_port == m_udp_port);
+	}
+	m_finished = !m_pending && !readNext();
+	if (m_finished)
+		DEB_WARNING() << "No packet for " << DEB_VAR1(m_udp_port);
+}
+
+bool PcapPortReceiver::readNext()
+{
+	while (m_file.next(m_packet))
+		if (m_packet.udp_port == m_udp_port)
+			return m_pending = true;
+	return false;
+}
+
+int PcapPortReceiver::poll(double timeout)
+{
+	DEB_MEMBER_FUNCT();
+
+	if (m_finished)
+		return 0;
+
+	double now = Timestamp::now();
+	if (m_t0 < 0)
+		m_t0 = now;
+	double deadline = now + timeout;
+
+	int nb_packets = 0;
+	while (nb_packets < m_nb_packets) {
+		if (!m_pending && !readNext()) {
+			m_finished = true;
+			break;
+		}
+		if (m_time_scale > 0) {
+			double dt = m_packet.time - m_capture_t0;
+			double t = m_t0 + dt * m_time_scale;
+			double wait = t - now;
+			if ((wait > 0) && nb_packets)
+				break;
+			if (wait > 0) {
+				if (t > deadline) {
+					if (timeout > 0)
+						Sleep(deadline - now);
+					break;
+				}
+				Sleep(wait);
+				now = Timestamp::now();
+			}
+		}
+		processPacket(m_packet.data, m_packet.len);
+		m_pending = false;
+		++nb_packets;
+	}
+	return nb_packets;
+}
@@ -22,6 +22,10 @@
 
 #include "SlsDetectorCamera.h"
 
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
 using namespace std;
 using namespace lima;
 using namespace lima::SlsDetector;
@@ -42,6 +46,8 @@ Receiver::Port::Thread::~Thread()
 
 	m_end = true;
 	m_port.stopPollFrameFinished();
+	ThreadRegistry& registry = m_port.m_cam->m_thread_registry;
+	registry.unregisterThread(m_port.getThreadName(), getThreadID());
 }
 
 void Receiver::Port::Thread::start()
@@ -51,11 +57,9 @@ void Receiver::Port::Thread::start()
 	m_end = true;
 	lima::Thread::start();
 
-	struct sched_param param;
-	param.sched_priority = 50;
-	int ret = pthread_setschedparam(m_thread, SCHED_RR, &param);
-	if (ret != 0)
-		DEB_ERROR() << "Could not set real-time priority!!";
+	ThreadRegistry& registry = m_port.m_cam->m_thread_registry;
+	registry.registerThread(m_port.getThreadName(), getThreadID(),
+				ThreadSchedParams(SchedRR, 50));
 
 	while (m_end)
 		Sleep(10e-3);
@@ -71,7 +75,8 @@ void Receiver::Port::Thread::threadFunction()
 }
 
 Receiver::Port::Port(Receiver& recv, int port)
-	: m_thread(*this)
+	: m_nb_late_frames(0), m_nb_partial_frames(0), m_nb_lost_packets(0),
+	  m_direct_frame(-1), m_write_frame(-1), m_thread(*this)
 {
 	DEB_CONSTRUCTOR();
 
@@ -83,12 +88,29 @@ Receiver::Port::Port(Receiver& recv, int port)
 	m_thread.start();
 }
 
+string Receiver::Port::getThreadName()
+{
+	ostringstream os;
+	os << "slsPort" << m_port_idx;
+	return os.str();
+}
+
 void Receiver::Port::prepareAcq()
 {
 	DEB_MEMBER_FUNCT();
 	m_stats.reset();
-	m_bad_frame_list.clear();
-	m_bad_frame_list.reserve(16 * 1024);
+	m_bad_frame_set.clear();
+	m_meta_data_ring.setSize(m_cam->m_frame_map.getBufferSize());
+	{
+		AutoMutex l = lock();
+		m_finished_queues = m_cam->m_finished_queues;
+	}
+	m_nb_late_frames.store(0, memory_order_relaxed);
+	m_nb_partial_frames.store(0, memory_order_relaxed);
+	m_nb_lost_packets.store(0, memory_order_relaxed);
+	AutoMutex l(m_frame_mutex);
+	m_direct_frame = -1;
+	m_write_frame = -1;
 }
 
 void Receiver::Port::processFileStart(uint32_t dsize)
@@ -97,32 +119,148 @@ void Receiver::Port::processFileStart(uint32_t dsize)
 	m_model->processRecvFileStart(m_port_idx, dsize);
 }
 
-void Receiver::Port::processFrame(FrameType frame, char *dptr, uint32_t dsize)
+void Receiver::Port::processFrame(FrameType frame, char *dptr, uint32_t dsize,
+				  const FrameMetaData& md)
 {
 	DEB_MEMBER_FUNCT();
 
-	m_frame_map_item->checkFinishedFrame(frame);
+	FrameMap::Item& item = *m_frame_map_item;
+	bool late;
+	{
+		AutoMutex l(m_frame_mutex);
+		// the direct frame (or an older one) is no longer written
+		if (isValidFrame(m_direct_frame) && (frame >= m_direct_frame))
+			m_direct_frame = -1;
+
+		// frames already declared lost by the Camera can still 
+		// arrive: they are recovered if not yet finished by all 
+		// the ports
+		FrameType last = item.getLastPushedFrame();
+		late = (isValidFrame(last) && (frame <= last) && 
+			isBadFrame(frame));
+		if (late && (!dptr || !item.holdLateFrame(frame))) {
+			DEB_TRACE() << "late " << DEB_VAR2(m_port_idx, frame);
+			m_nb_late_frames.fetch_add(1, memory_order_relaxed);
+			return;
+		} else if (!late) {
+			item.checkFinishedFrame(frame);
+			m_write_frame = frame;
+		}
+
+		// partial frame: the received packets are kept, the 
+		// missing ones were filled by the receiver (slsReceiver 
+		// or native engine)
+		int packet_len = m_model->getRecvPacketLen();
+		int exp_packets = packet_len ? (dsize / packet_len) : 0;
+		int recv_packets = md.recv_packets;
+		if ((dptr != NULL) && (recv_packets < exp_packets)) {
+			DEB_TRACE() << "partial " 
+				    << DEB_VAR4(m_port_idx, frame, 
+						recv_packets, exp_packets);
+			m_nb_partial_frames.fetch_add(1, memory_order_relaxed);
+			m_nb_lost_packets.fetch_add(exp_packets - recv_packets,
+						    memory_order_relaxed);
+		}
+	}
+
+	m_meta_data_ring.put(frame, md);
+
+	// the copy and corrections are done without the lock, the frame 
+	// queue is pushed with it
 	bool valid = (dptr != NULL);
-	if (valid) {
-		char *bptr = m_cam->getFrameBufferPtr(frame);
-		m_model->processRecvPort(m_port_idx, frame, dptr, dsize, bptr);
+	try {
+		if (valid)
+			writeFrame(frame, dptr, dsize);
+		if (!late)
+			fillLostFrames(frame, valid);
+	} catch (...) {
+		AutoMutex l(m_frame_mutex);
+		if (late)
+			item.releaseLateFrame(frame, false);
+		else
+			m_write_frame = -1;
+		throw;
 	}
-	Timestamp t0 = Timestamp::now();
+
+	AutoMutex l(m_frame_mutex);
+	if (late) {
+		DEB_TRACE() << "recovered " << DEB_VAR2(m_port_idx, frame);
+		item.releaseLateFrame(frame, true);
+		return;
+	}
+	m_write_frame = -1;
+	pushFinishedFrame(frame, valid);
+}
+
+void Receiver::Port::declareLostFrames(FrameType last_lost)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(m_port_idx, last_lost);
+
+	AutoMutex l(m_frame_mutex);
+	// processFrame finishes the previous frames with the one it writes
+	if (isValidFrame(m_write_frame))
+		return;
+	// the receiver is writing in the direct frame buffer: it is 
+	// finished by processFrame, the next frames in a later check
+	if (isValidFrame(m_direct_frame) && (last_lost >= m_direct_frame))
+		last_lost = m_direct_frame - 1;
+	FrameType last = m_frame_map_item->getLastPushedFrame();
+	if (!isValidFrame(last_lost) ||
+	    (isValidFrame(last) && (last_lost <= last)))
+		return;
+	fillLostFrames(last_lost, false);
+	pushFinishedFrame(last_lost, false);
+}
+
+void Receiver::Port::fillLostFrames(FrameType frame, bool valid)
+{
+	DEB_MEMBER_FUNCT();
+
+	// the lost frames must be filled before being finished, 
+	// other ports could complete them afterwards. Only the ones 
+	// sharing no buffer with frame still have it
+	if (!m_model->isRecvPortCorrActive())
+		return;
+	FrameType f = m_frame_map_item->getLastPushedFrame() + 1;
+	FrameType end = valid ? frame : (frame + 1);
+	FrameType buffer_size = m_cam->m_frame_map.getBufferSize();
+	if (frame + 1 - f > buffer_size)
+		f = frame + 1 - buffer_size;
+	for (; f != end; ++f) {
+		char *bptr = m_cam->getFrameBufferPtr(f);
+		m_model->processRecvPort(m_port_idx, f, NULL, 0, bptr);
+	}
+}
+
+void Receiver::Port::pushFinishedFrame(FrameType frame, bool valid)
+{
+	DEB_MEMBER_FUNCT();
+
+	int64_t t0 = getMonotonicNs();
 	m_frame_map_item->frameFinished(frame, true, valid);
-	Timestamp t1 = Timestamp::now();
-	m_stats.stats.new_finish.add(t1 - t0);
+	int64_t t1 = getMonotonicNs();
+	m_stats.stats.new_finish.add((t1 - t0) * 1e-9);
+}
+
+void Receiver::Port::writeFrame(FrameType frame, char *dptr, uint32_t dsize)
+{
+	DEB_MEMBER_FUNCT();
+	char *bptr = m_cam->getFrameBufferPtr(frame);
+	m_model->processRecvPort(m_port_idx, frame, dptr, dsize, bptr);
 }
 
 void Receiver::Port::pollFrameFinished()
 {
 	DEB_MEMBER_FUNCT();
 
-	FinishInfoList finfo_list;
-	finfo_list = m_frame_map_item->pollFrameFinished();
+	FrameMap::Item& item = *m_frame_map_item;
+	const FinishInfoList& finfo_list = item.pollFrameFinished();
 	FinishInfoList::const_iterator it, end = finfo_list.end();
 	for (it = finfo_list.begin(); it != end; ++it) {
 		const FinishInfo& finfo = *it;
-		if ((finfo.nb_lost != 0) || !finfo.finished.empty())
+		if ((finfo.nb_lost != 0) || !finfo.finished.empty() ||
+		    isValidFrame(finfo.recovered))
 			processFinishInfo(finfo);
 	}
 }
@@ -143,15 +281,17 @@ void Receiver::Port::processFinishInfo(const FinishInfo& finfo)
 					      << "port_idx=" << m_port_idx
 					      << ", first=" << finfo.first_lost
 					      << ", nb=" << finfo.nb_lost;
-		{
-			AutoMutex l = lock();
-			FrameType f = finfo.first_lost;
-			for (int i = 0; i < finfo.nb_lost; ++i, ++f)
-				m_bad_frame_list.push_back(f);
-		}
-		SortedIntList::const_iterator it, end = finfo.finished.end();
-		for (it = finfo.finished.begin(); it != end; ++it)
-			m_cam->m_acq_thread->queueFinishedFrame(*it);
+		AutoMutex l = lock();
+		if (isValidFrame(finfo.recovered))
+			m_bad_frame_set.remove(finfo.recovered);
+		else
+			m_bad_frame_set.add(finfo.first_lost, finfo.nb_lost);
+		// the queues outlive the AcqThread: frames finished after
+		// the acquisition are dropped
+		if (!finfo.finished.empty() && m_finished_queues && 
+		    m_cam->isAcqRunning())
+			m_finished_queues->queueFrames(m_port_idx, 
+						       finfo.finished);
 	} catch (Exception& e) {
 		ostringstream err_msg;
 		err_msg << "Port::processFinishInfo: " << e;
@@ -163,15 +303,156 @@ void Receiver::Port::processFinishInfo(const FinishInfo& finfo)
 	}
 }
 
+char *Receiver::Port::getDirectFrameBuffer(FrameType frame)
+{
+	DEB_MEMBER_FUNCT();
+
+	if (!m_cam->m_recv_direct_placement)
+		return NULL;
+	int offset = m_model->getRecvPortDirectOffset(m_port_idx);
+	if (offset < 0)
+		return NULL;
+	// a late frame must not overwrite its (reused) buffer; the frame
+	// cannot be declared lost until processFrame
+	AutoMutex l(m_frame_mutex);
+	FrameType last = m_frame_map_item->getLastPushedFrame();
+	if (isValidFrame(last) && (frame <= last))
+		return NULL;
+	m_direct_frame = frame;
+	return m_cam->getFrameBufferPtr(frame) + offset;
+}
+
 bool Receiver::Port::isBadFrame(FrameType frame)
 { 
+	// frames still in the buffer ring: bad-frame mask look-up
+	FrameMap::Item& item = *m_frame_map_item;
+	FrameType last = item.getLastPushedFrame();
+	int buffer_size = m_cam->m_frame_map.getBufferSize();
+	if (isValidFrame(last) && (frame <= last) && 
+	    (frame + buffer_size > last))
+		return item.isBadFrame(frame);
+
 	AutoMutex l = lock();
-	IntList::iterator end = m_bad_frame_list.end();
-	return (find(m_bad_frame_list.begin(), end, frame) != end); 
+	return m_bad_frame_set.contains(frame);
+}
+
+Receiver::NativePort::Thread::Thread(NativePort& port)
+	: m_port(port)
+{
+	DEB_CONSTRUCTOR();
+}
+
+Receiver::NativePort::Thread::~Thread()
+{
+	DEB_DESTRUCTOR();
+
+	if (!hasStarted())
+		return;
+
+	m_end = true;
+	ThreadRegistry& registry = m_port.m_recv.m_cam->m_thread_registry;
+	registry.unregisterThread(m_port.getThreadName(), getThreadID());
+}
+
+void Receiver::NativePort::Thread::start()
+{
+	DEB_MEMBER_FUNCT();
+
+	m_end = true;
+	lima::Thread::start();
+
+	ThreadRegistry& registry = m_port.m_recv.m_cam->m_thread_registry;
+	registry.registerThread(m_port.getThreadName(), getThreadID(),
+				ThreadSchedParams(SchedRR, 50));
+
+	while (m_end)
+		Sleep(10e-3);
+}
+
+void Receiver::NativePort::Thread::threadFunction()
+{
+	DEB_MEMBER_FUNCT();
+
+	m_end = false;
+	while (!m_end)
+		m_port.pollPackets();
+}
+
+Receiver::NativePort::NativePort(Receiver& recv, int port, int udp_port)
+	: m_recv(recv), m_port(port), m_thread(*this)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR3(m_recv.m_idx, port, udp_port);
+	m_packet_recv = m_recv.createPacketReceiver(this, port, udp_port);
+	m_thread.start();
+}
+
+Receiver::NativePort::~NativePort()
+{
+	DEB_DESTRUCTOR();
+}
+
+string Receiver::NativePort::getThreadName()
+{
+	ostringstream os;
+	os << "slsNative" << m_recv.m_cam->getPortIndex(m_recv.m_idx, m_port);
+	return os.str();
+}
+
+void Receiver::NativePort::prepareAcq(uint32_t frame_size, int packet_len)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	// packets queued while Idle, dropped by portCallback; bounded 
+	// in case of a continuous flow
+	Timestamp t0 = Timestamp::now();
+	while ((m_packet_recv->poll(0) > 0) && (Timestamp::now() - t0 < 0.1))
+		;
+	m_packet_recv->prepareAcq(frame_size, packet_len);
+}
+
+void Receiver::NativePort::getCounters(
+				PortPacketReceiver::Counters& counters)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	m_packet_recv->getCounters(counters);
+}
+
+void Receiver::NativePort::pollPackets()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l(m_mutex);
+	try {
+		// no packet in the period: the incomplete frame is delivered
+		if (m_packet_recv->poll(10e-3) == 0)
+			m_packet_recv->flush();
+	} catch (Exception& e) {
+		ostringstream err_msg;
+		err_msg << "Receiver::NativePort: " << e;
+		Event::Code err_code = Event::CamOverrun;
+		Event *event = new Event(Hardware, Event::Error, Event::Camera, 
+					 err_code, err_msg.str());
+		DEB_EVENT(*event) << DEB_VAR1(*event);
+		m_recv.m_cam->reportEvent(event);
+	}
+}
+
+char *Receiver::NativePort::getFrameBuffer(FrameType det_frame)
+{
+	return m_recv.getPortFrameBuffer(m_port, det_frame);
+}
+
+void Receiver::NativePort::frameReceived(const FrameMetaData& md, char *dptr,
+					 uint32_t dsize)
+{
+	m_recv.portCallback(m_port, md, dptr, dsize);
 }
 
 Receiver::Receiver(Camera *cam, int idx, int rx_port)
-	: m_cam(cam), m_idx(idx), m_rx_port(rx_port)
+	: m_cam(cam), m_idx(idx), m_rx_port(rx_port), 
+	  m_native_engine(SlsRecvEngine)
 {
 	DEB_CONSTRUCTOR();
 
@@ -320,6 +601,10 @@ void Receiver::setCPUAffinity(const RecvCPUAffinity& recv_affinity)
 
 #undef CreateHelper
 
+	// the native engine threads take the listener affinity
+	m_native_aff_list = lh.getThreadAffinityList();
+	applyNativeCPUAffinity();
+
 	slsReceiverUsers::CPUMaskList list_cpu_mask = lh.getCPUMaskList();
 	slsReceiverUsers::CPUMaskList writ_cpu_mask = wh.getCPUMaskList();
 	m_recv->setThreadCPUAffinity(list_cpu_mask, writ_cpu_mask);
@@ -330,13 +615,12 @@ void Receiver::setCPUAffinity(const RecvCPUAffinity& recv_affinity)
 			fifo_node_mask, max_node);
 	m_recv->setFifoNodeAffinity(fifo_node_mask, max_node);
 
+	ThreadRegistry& registry = m_cam->m_thread_registry;
 	CPUAffinityList port_thread_aff_list = pth.getThreadAffinityList();
 	CPUAffinityList::const_iterator tit = port_thread_aff_list.begin();
 	PortList::iterator pit, pend = m_port_list.end();
-	for (pit = m_port_list.begin(); pit != pend; ++pit, ++tit) {
-		pid_t tid = (*pit)->getThreadID();
-		(*tit).applyToTask(tid, false);
-	}
+	for (pit = m_port_list.begin(); pit != pend; ++pit, ++tit)
+		registry.setThreadCPUAffinity((*pit)->getThreadName(), *tit);
 }
 
 void Receiver::getNodeMaskList(const CPUAffinityList& listener,
@@ -383,6 +667,216 @@ void Receiver::prepareAcq()
 		(*it)->prepareAcq();
 }
 
+void Receiver::prepareNativePorts()
+{
+	DEB_MEMBER_FUNCT();
+
+	updateNativePorts();
+	if (m_native_port_list.empty())
+		return;
+
+	Model *model = m_cam->m_model;
+	uint32_t frame_size = model->getRecvPortDataSize();
+	int packet_len = model->getRecvPacketLen();
+	NativePortList::iterator nit, nend = m_native_port_list.end();
+	for (nit = m_native_port_list.begin(); nit != nend; ++nit)
+		(*nit)->prepareAcq(frame_size, packet_len);
+}
+
+void Receiver::setUdpPortList(const IntList& udp_port_list)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(PrettyIntList(udp_port_list));
+	m_udp_port_list = udp_port_list;
+}
+
+void Receiver::setUdpIp(string udp_ip)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(udp_ip);
+	m_udp_ip = udp_ip;
+}
+
+void Receiver::updateNativePorts()
+{
+	DEB_MEMBER_FUNCT();
+
+	RecvEngine engine = m_cam->m_recv_engine;
+	DEB_TRACE() << DEB_VAR2(m_idx, engine);
+	if (engine != m_native_engine) {
+		// releases the data ports / NIC queues
+		m_native_port_list.clear();
+		m_native_engine = engine;
+	}
+	if ((engine == SlsRecvEngine) || !m_native_port_list.empty())
+		return;
+
+	int nb_ports = m_port_list.size();
+	int nb_udp_ports = m_udp_port_list.size();
+	if (nb_udp_ports < nb_ports)
+		THROW_HW_ERROR(Error) << "Missing rx_udpport in config: "
+				      << DEB_VAR3(m_idx, nb_udp_ports, 
+						  nb_ports);
+	for (int i = 0; i < nb_ports; ++i) {
+		int udp_port = m_udp_port_list[i];
+		AutoPtr<NativePort> port = new NativePort(*this, i, udp_port);
+		m_native_port_list.push_back(port);
+	}
+	applyNativeCPUAffinity();
+}
+
+PortPacketReceiver *Receiver::createPacketReceiver(NativePort *port, 
+						   int port_idx, int udp_port)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(m_native_engine, port_idx, udp_port);
+
+	if (m_native_engine != XdpRecvEngine)
+		return new UdpPortReceiver(port, udp_port);
+
+	string net_dev = getUdpNetDev();
+	IntList queue_list = getXdpQueueList(net_dev, port_idx);
+	return new XdpPortReceiver(port, udp_port, net_dev, queue_list);
+}
+
+string Receiver::getUdpNetDev()
+{
+	DEB_MEMBER_FUNCT();
+
+	if (m_udp_ip.empty())
+		THROW_HW_ERROR(Error) << "Missing rx_udpip in config: " 
+				      << DEB_VAR1(m_idx);
+	in_addr addr;
+	if (inet_pton(AF_INET, m_udp_ip.c_str(), &addr) != 1)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(m_udp_ip);
+
+	ifaddrs *ifa_list;
+	if (getifaddrs(&ifa_list) < 0)
+		THROW_HW_ERROR(Error) << "Error in getifaddrs: " 
+				      << strerror(errno);
+	string net_dev;
+	for (ifaddrs *ifa = ifa_list; ifa && net_dev.empty(); 
+	     ifa = ifa->ifa_next) {
+		sockaddr *sa = ifa->ifa_addr;
+		if (!sa || (sa->sa_family != AF_INET))
+			continue;
+		in_addr& a = ((sockaddr_in *) sa)->sin_addr;
+		if (a.s_addr == addr.s_addr)
+			net_dev = ifa->ifa_name;
+	}
+	freeifaddrs(ifa_list);
+	if (net_dev.empty())
+		THROW_HW_ERROR(Error) << "No network device with " 
+				      << DEB_VAR1(m_udp_ip);
+	DEB_RETURN() << DEB_VAR1(net_dev);
+	return net_dev;
+}
+
+IntList Receiver::getXdpQueueList(const string& net_dev, int port_idx)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(net_dev, port_idx);
+
+	// the queues of net_dev handled by the port listener CPUs
+	CPUAffinity listener;
+	if (port_idx < int(m_native_aff_list.size()))
+		listener = m_native_aff_list[port_idx];
+	GlobalCPUAffinity& global = m_cam->m_cpu_affinity_map[
+						m_cam->m_pixel_depth];
+	IntList queue_list;
+	NetDevGroupCPUAffinityList::const_iterator it, end = global.netdev.end();
+	for (it = global.netdev.begin(); it != end; ++it) {
+		const StringList& nl = it->name_list;
+		if (find(nl.begin(), nl.end(), net_dev) == nl.end())
+			continue;
+		const NetDevRxQueueAffinityMap& m = it->queue_affinity;
+		NetDevRxQueueAffinityMap::const_iterator qit, qend = m.end();
+		for (qit = m.begin(); qit != qend; ++qit) {
+			CPUAffinity queue = qit->second.all();
+			if ((qit->first >= 0) && 
+			    (queue.getMask() & listener.getMask()))
+				queue_list.push_back(qit->first);
+		}
+	}
+	// no specific queue affinity: all the queues
+	if (queue_list.empty())
+		queue_list = NetDevRxQueueMgr(net_dev).getRxQueueList();
+	DEB_RETURN() << DEB_VAR1(PrettyIntList(queue_list));
+	return queue_list;
+}
+
+void Receiver::applyNativeCPUAffinity()
+{
+	DEB_MEMBER_FUNCT();
+
+	ThreadRegistry& registry = m_cam->m_thread_registry;
+	CPUAffinityList::const_iterator ait = m_native_aff_list.begin();
+	CPUAffinityList::const_iterator aend = m_native_aff_list.end();
+	NativePortList::iterator it, end = m_native_port_list.end();
+	for (it = m_native_port_list.begin(); (it != end) && (ait != aend); 
+	     ++it, ++ait)
+		registry.setThreadCPUAffinity((*it)->getThreadName(), *ait);
+}
+
+bool Receiver::getLimaFrame(FrameType det_frame, FrameType& lima_frame)
+{
+	DEB_MEMBER_FUNCT();
+	FrameType skip_freq = m_cam->m_skip_frame_freq;
+	bool skip_frame = false;
+	lima_frame = det_frame;
+	if (skip_freq) {
+		skip_frame = ((det_frame + 1) % (skip_freq + 1) == 0);
+		lima_frame -= det_frame / (skip_freq + 1);
+		DEB_TRACE() << DEB_VAR3(det_frame, skip_frame, lima_frame);
+	}
+	return !skip_frame;
+}
+
+char *Receiver::getPortFrameBuffer(int port, FrameType det_frame)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(port, det_frame);
+
+	int nb_ports = m_port_list.size();
+	FrameType lima_frame;
+	if ((port >= nb_ports) || !m_cam->isAcqRunning() ||
+	    (det_frame >= m_cam->m_det_nb_frames) ||
+	    !getLimaFrame(det_frame, lima_frame))
+		return NULL;
+	return m_port_list[port]->getDirectFrameBuffer(lima_frame);
+}
+
+Receiver::LocalFifo::LocalFifo(Receiver *recv, int port, uint32_t slot_size,
+			       int nb_slots)
+	: m_recv(recv), m_port(port), m_slot_size(slot_size), 
+	  m_nb_slots(nb_slots), m_next_slot(0), m_nb_direct_frames(0),
+	  m_slot_mem(size_t(slot_size) * nb_slots)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR3(port, slot_size, nb_slots);
+}
+
+void Receiver::LocalFifo::receive(const FrameMetaData& md, const char *data,
+				  uint32_t dsize)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(m_port, md.det_frame, dsize);
+
+	if (dsize > m_slot_size)
+		THROW_HW_ERROR(InvalidValue) << "Frame too big: " 
+					     << DEB_VAR2(dsize, m_slot_size);
+	char *dptr = m_recv->getPortFrameBuffer(m_port, md.det_frame);
+	if (dptr) {
+		++m_nb_direct_frames;
+	} else {
+		dptr = &m_slot_mem[size_t(m_next_slot) * m_slot_size];
+		m_next_slot = (m_next_slot + 1) % m_nb_slots;
+	}
+	// the network reception
+	memcpy(dptr, data, dsize);
+	m_recv->portCallback(m_port, md, dptr, dsize);
+}
+
 int Receiver::fileStartCallback(char *fpath, char *fname, uint64_t fidx,
 				uint32_t dsize, void *priv)
 {
@@ -409,9 +903,18 @@ void Receiver::portCallback(FrameType frame,
 	DEB_STATIC_FUNCT();
 	Receiver *recv = static_cast<Receiver *>(priv);
 	int port = (x % 2);
-	FrameType det_frame = frame - 1;
-	DEB_PARAM() << DEB_VAR2(frame, det_frame);
-	recv->portCallback(det_frame, port, dptr, dsize);
+	FrameMetaData md;
+	md.det_frame = frame - 1;
+	md.bunch_id = bunch_id;
+	md.timestamp = timestamp;
+	md.mod_id = mod_id;
+	md.x = x;
+	md.y = y;
+	md.z = z;
+	md.debug = debug;
+	md.recv_packets = recv_packets;
+	DEB_PARAM() << DEB_VAR2(frame, md.det_frame);
+	recv->portCallback(port, md, dptr, dsize);
 }
 
 int Receiver::fileStartCallback(char *fpath, char *fname, uint64_t fidx,
@@ -424,45 +927,48 @@ int Receiver::fileStartCallback(char *fpath, char *fname, uint64_t fidx,
 	return 0;
 }
 
-void Receiver::portCallback(FrameType det_frame, int port, char *dptr,
+void Receiver::portCallback(int port, const FrameMetaData& md, char *dptr,
 			    uint32_t dsize)
 {
 	DEB_MEMBER_FUNCT();
 
 	int nb_ports = m_port_list.size();
-	if ((port >= nb_ports) || (m_cam->getState() == Stopping))
+	// outside the acquisition the packets are drained and dropped
+	if ((port >= nb_ports) || !m_cam->isAcqRunning())
 		return;
 
-	Timestamp t0 = Timestamp::now();
+	int64_t t0 = getMonotonicNs();
 
 	Port& recv_port = *m_port_list[port];
 	Port::Stats& port_stats = recv_port.m_stats;
-	if (port_stats.last_t0.isSet())
-		port_stats.stats.cb_period.add(t0 - port_stats.last_t0);
-	if (port_stats.last_t1.isSet())
-		port_stats.stats.recv_exec.add(t0 - port_stats.last_t1);
+	StatsRecorder& stats = port_stats.stats;
+	if (port_stats.last_t0)
+		stats.cb_period.add((t0 - port_stats.last_t0) * 1e-9);
+	if (port_stats.last_t1)
+		stats.recv_exec.add((t0 - port_stats.last_t1) * 1e-9);
 	port_stats.last_t0 = t0;
+	FrameType& last_det_frame = port_stats.last_det_frame;
+	if (isValidFrame(last_det_frame) && 
+	    (md.det_frame == last_det_frame + 1)) {
+		uint64_t ticks = md.timestamp - port_stats.last_det_timestamp;
+		stats.det_period.add(ticks * FrameMetaData::TimestampUnit);
+	}
+	last_det_frame = md.det_frame;
+	port_stats.last_det_timestamp = md.timestamp;
 
+	FrameType det_frame = md.det_frame;
 	try {
 		if (det_frame >= m_cam->m_det_nb_frames)
 			THROW_HW_ERROR(Error) << "Invalid " 
 					      << DEB_VAR2(det_frame,
 							  DebHex(det_frame));
-		FrameType skip_freq = m_cam->m_skip_frame_freq;
-		bool skip_frame = false;
-		FrameType lima_frame = det_frame;
+		FrameType lima_frame;
 		int port_idx = recv_port.m_port_idx;
-		if (skip_freq) {
-			skip_frame = ((det_frame + 1) % (skip_freq + 1) == 0);
-			lima_frame -= det_frame / (skip_freq + 1);
-			DEB_TRACE() << DEB_VAR4(port_idx, det_frame,
-						skip_frame, lima_frame);
-		}
-		if (skip_frame) {
+		if (!getLimaFrame(det_frame, lima_frame)) {
 			if (det_frame == m_cam->m_det_nb_frames - 1)
 				m_cam->processLastSkippedFrame(port_idx);
 		} else {
-			recv_port.processFrame(lima_frame, dptr, dsize);
+			recv_port.processFrame(lima_frame, dptr, dsize, md);
 		}
 	} catch (Exception& e) {
 		ostringstream err_msg;
@@ -475,7 +981,7 @@ void Receiver::portCallback(FrameType det_frame, int port, char *dptr,
 		m_cam->reportEvent(event);
 	}
 
-	Timestamp t1 = Timestamp::now();
-	port_stats.stats.cb_exec.add(t1 - t0);
+	int64_t t1 = getMonotonicNs();
+	stats.cb_exec.add((t1 - t0) * 1e-9);
 	port_stats.last_t1 = t1;
 }
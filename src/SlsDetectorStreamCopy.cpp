@@ -0,0 +1,374 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+#include "SlsDetectorStreamCopy.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SLS_STREAM_COPY_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+atomic<StreamCopy::Level> StreamCopy::s_level(StreamCopy::Auto);
+
+static void StdCopy(char *dest, const char *src, int len)
+{
+	memcpy(dest, src, len);
+}
+
+static void StdFill(char *dest, int val, int len)
+{
+	memset(dest, val, len);
+}
+
+// Each packed byte holds two 4-bit pixels, the first one in the low nibble
+static void StdExpand4(char *dest, const char *src, int len)
+{
+	const unsigned char *s = (const unsigned char *) src;
+	for (int i = 0; i < len; ++i, ++s) {
+		*dest++ = *s & 0xf;
+		*dest++ = *s >> 4;
+	}
+}
+
+#ifdef SLS_STREAM_COPY_X86
+
+// Streaming stores are only efficient on full cache lines: the partial
+// lines at the head and the tail are done with regular stores, as well as
+// the short blocks. The source is read with unaligned loads, one cache line
+// per iteration
+
+static const int MinStreamLen = 8 * CacheLineSize;
+
+__attribute__((target("sse2")))
+static void SSE2Copy(char *dest, const char *src, int len)
+{
+	const int line = CacheLineSize;
+	int head = -uintptr_t(dest) & (line - 1);
+	if (len < MinStreamLen) {
+		memcpy(dest, src, len);
+		return;
+	}
+	memcpy(dest, src, head);
+	dest += head, src += head, len -= head;
+	__m128i *d = (__m128i *) dest;
+	const __m128i *s = (const __m128i *) src;
+	for (; len >= line; len -= line, d += 4, s += 4) {
+		__m128i v0 = _mm_loadu_si128(s + 0);
+		__m128i v1 = _mm_loadu_si128(s + 1);
+		__m128i v2 = _mm_loadu_si128(s + 2);
+		__m128i v3 = _mm_loadu_si128(s + 3);
+		_mm_stream_si128(d + 0, v0);
+		_mm_stream_si128(d + 1, v1);
+		_mm_stream_si128(d + 2, v2);
+		_mm_stream_si128(d + 3, v3);
+	}
+	memcpy(d, s, len);
+}
+
+__attribute__((target("sse2")))
+static void SSE2Fill(char *dest, int val, int len)
+{
+	const int line = CacheLineSize;
+	int head = -uintptr_t(dest) & (line - 1);
+	if (len < MinStreamLen) {
+		memset(dest, val, len);
+		return;
+	}
+	memset(dest, val, head);
+	dest += head, len -= head;
+	__m128i v = _mm_set1_epi8(val);
+	__m128i *d = (__m128i *) dest;
+	for (; len >= line; len -= line, d += 4) {
+		_mm_stream_si128(d + 0, v);
+		_mm_stream_si128(d + 1, v);
+		_mm_stream_si128(d + 2, v);
+		_mm_stream_si128(d + 3, v);
+	}
+	memset(d, val, len);
+}
+
+__attribute__((target("avx2")))
+static void AVX2Copy(char *dest, const char *src, int len)
+{
+	const int line = CacheLineSize;
+	int head = -uintptr_t(dest) & (line - 1);
+	if (len < MinStreamLen) {
+		memcpy(dest, src, len);
+		return;
+	}
+	memcpy(dest, src, head);
+	dest += head, src += head, len -= head;
+	__m256i *d = (__m256i *) dest;
+	const __m256i *s = (const __m256i *) src;
+	for (; len >= line; len -= line, d += 2, s += 2) {
+		__m256i v0 = _mm256_loadu_si256(s + 0);
+		__m256i v1 = _mm256_loadu_si256(s + 1);
+		_mm256_stream_si256(d + 0, v0);
+		_mm256_stream_si256(d + 1, v1);
+	}
+	memcpy(d, s, len);
+}
+
+__attribute__((target("avx2")))
+static void AVX2Fill(char *dest, int val, int len)
+{
+	const int line = CacheLineSize;
+	int head = -uintptr_t(dest) & (line - 1);
+	if (len < MinStreamLen) {
+		memset(dest, val, len);
+		return;
+	}
+	memset(dest, val, head);
+	dest += head, len -= head;
+	__m256i v = _mm256_set1_epi8(val);
+	__m256i *d = (__m256i *) dest;
+	for (; len >= line; len -= line, d += 2) {
+		_mm256_stream_si256(d + 0, v);
+		_mm256_stream_si256(d + 1, v);
+	}
+	memset(d, val, len);
+}
+
+__attribute__((target("avx512f")))
+static void AVX512Copy(char *dest, const char *src, int len)
+{
+	const int line = CacheLineSize;
+	int head = -uintptr_t(dest) & (line - 1);
+	if (len < MinStreamLen) {
+		memcpy(dest, src, len);
+		return;
+	}
+	memcpy(dest, src, head);
+	dest += head, src += head, len -= head;
+	__m512i *d = (__m512i *) dest;
+	const __m512i *s = (const __m512i *) src;
+	for (; len >= line; len -= line, d += 1, s += 1) {
+		__m512i v0 = _mm512_loadu_si512(s + 0);
+		_mm512_stream_si512(d + 0, v0);
+	}
+	memcpy(d, s, len);
+}
+
+__attribute__((target("avx512f")))
+static void AVX512Fill(char *dest, int val, int len)
+{
+	const int line = CacheLineSize;
+	int head = -uintptr_t(dest) & (line - 1);
+	if (len < MinStreamLen) {
+		memset(dest, val, len);
+		return;
+	}
+	memset(dest, val, head);
+	dest += head, len -= head;
+	__m512i v = _mm512_set1_epi8(val);
+	__m512i *d = (__m512i *) dest;
+	for (; len >= line; len -= line, d += 1) {
+		_mm512_stream_si512(d + 0, v);
+	}
+	memset(d, val, len);
+}
+
+// The expanded 4-bit chips are too short for streaming stores
+
+__attribute__((target("sse2")))
+static void SSE2Expand4(char *dest, const char *src, int len)
+{
+	const int vlen = sizeof(__m128i);
+	const __m128i mask = _mm_set1_epi8(0xf);
+	__m128i *d = (__m128i *) dest;
+	const __m128i *s = (const __m128i *) src;
+	for (; len >= vlen; len -= vlen, d += 2, ++s) {
+		__m128i v = _mm_loadu_si128(s);
+		__m128i lo = _mm_and_si128(v, mask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		_mm_storeu_si128(d + 0, _mm_unpacklo_epi8(lo, hi));
+		_mm_storeu_si128(d + 1, _mm_unpackhi_epi8(lo, hi));
+	}
+	StdExpand4((char *) d, (const char *) s, len);
+}
+
+__attribute__((target("avx2")))
+static void AVX2Expand4(char *dest, const char *src, int len)
+{
+	const int vlen = sizeof(__m256i);
+	const __m256i mask = _mm256_set1_epi8(0xf);
+	__m256i *d = (__m256i *) dest;
+	const __m256i *s = (const __m256i *) src;
+	for (; len >= vlen; len -= vlen, d += 2, ++s) {
+		__m256i v = _mm256_loadu_si256(s);
+		__m256i lo = _mm256_and_si256(v, mask);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+		// unpack works on 128-bit lanes: reorder them
+		__m256i a = _mm256_unpacklo_epi8(lo, hi);
+		__m256i b = _mm256_unpackhi_epi8(lo, hi);
+		_mm256_storeu_si256(d + 0, _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256(d + 1, _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	SSE2Expand4((char *) d, (const char *) s, len);
+}
+
+#endif // SLS_STREAM_COPY_X86
+
+bool StreamCopy::isSupported(Level level)
+{
+	switch (level) {
+	case Auto:
+	case Std:
+		return true;
+#ifdef SLS_STREAM_COPY_X86
+	case SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	case AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	case AVX512:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx512f");
+#endif
+	default:
+		return false;
+	}
+}
+
+StreamCopy::Level StreamCopy::getBestLevel()
+{
+	DEB_STATIC_FUNCT();
+	Level level = Std;
+	if (isSupported(AVX512))
+		level = AVX512;
+	else if (isSupported(AVX2))
+		level = AVX2;
+	else if (isSupported(SSE2))
+		level = SSE2;
+	DEB_RETURN() << DEB_VAR1(level);
+	return level;
+}
+
+void StreamCopy::getSupportedLevelList(LevelList& level_list)
+{
+	DEB_STATIC_FUNCT();
+	level_list.clear();
+	for (int l = Std; l <= AVX512; ++l)
+		if (isSupported(Level(l)))
+			level_list.push_back(Level(l));
+}
+
+StreamCopy::Level StreamCopy::checkLevel(Level level)
+{
+	DEB_STATIC_FUNCT();
+	if (level == Auto)
+		level = s_level;
+	if (level == Auto)
+		level = getBestLevel();
+	else if (!isSupported(level))
+		THROW_HW_ERROR(NotSupported) << DEB_VAR1(level) << " "
+					     << "not supported by the CPU";
+	return level;
+}
+
+void StreamCopy::setLevel(Level level)
+{
+	DEB_STATIC_FUNCT();
+	DEB_PARAM() << DEB_VAR1(level);
+	if (!isSupported(level))
+		THROW_HW_ERROR(NotSupported) << DEB_VAR1(level) << " "
+					     << "not supported by the CPU";
+	s_level = level;
+}
+
+void StreamCopy::getLevel(Level& level)
+{
+	DEB_STATIC_FUNCT();
+	level = checkLevel(Auto);
+	DEB_RETURN() << DEB_VAR1(level);
+}
+
+StreamCopy::CopyFunc StreamCopy::getCopyFunc(Level level)
+{
+	DEB_STATIC_FUNCT();
+	DEB_PARAM() << DEB_VAR1(level);
+	switch (checkLevel(level)) {
+#ifdef SLS_STREAM_COPY_X86
+	case SSE2:	return SSE2Copy;
+	case AVX2:	return AVX2Copy;
+	case AVX512:	return AVX512Copy;
+#endif
+	default:	return StdCopy;
+	}
+}
+
+StreamCopy::FillFunc StreamCopy::getFillFunc(Level level)
+{
+	DEB_STATIC_FUNCT();
+	DEB_PARAM() << DEB_VAR1(level);
+	switch (checkLevel(level)) {
+#ifdef SLS_STREAM_COPY_X86
+	case SSE2:	return SSE2Fill;
+	case AVX2:	return AVX2Fill;
+	case AVX512:	return AVX512Fill;
+#endif
+	default:	return StdFill;
+	}
+}
+
+StreamCopy::Expand4Func StreamCopy::getExpand4Func(Level level)
+{
+	DEB_STATIC_FUNCT();
+	DEB_PARAM() << DEB_VAR1(level);
+	switch (checkLevel(level)) {
+#ifdef SLS_STREAM_COPY_X86
+	case SSE2:	return SSE2Expand4;
+	// AVX-512 capable CPUs also implement AVX2
+	case AVX2:
+	case AVX512:	return AVX2Expand4;
+#endif
+	default:	return StdExpand4;
+	}
+}
+
+void StreamCopy::fence()
+{
+#ifdef SLS_STREAM_COPY_X86
+	_mm_sfence();
+#endif
+}
+
+ostream& lima::SlsDetector::operator <<(ostream& os, StreamCopy::Level level)
+{
+	const char *name = "Invalid";
+	switch (level) {
+	case StreamCopy::Auto:		name = "Auto";		break;
+	case StreamCopy::Std:		name = "Std";		break;
+	case StreamCopy::SSE2:		name = "SSE2";		break;
+	case StreamCopy::AVX2:		name = "AVX2";		break;
+	case StreamCopy::AVX512:	name = "AVX512";	break;
+	}
+	return os << name;
+}
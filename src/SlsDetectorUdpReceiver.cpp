@@ -0,0 +1,355 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+#include "SlsDetectorUdpReceiver.h"
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#ifndef UDP_GRO
+#define UDP_GRO		104
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+PortPacketReceiver::Counters::Counters()
+	: nb_packets(0), nb_frames(0), nb_partial_frames(0),
+	  nb_lost_packets(0), nb_late_packets(0), nb_invalid_packets(0)
+{}
+
+ostream& lima::SlsDetector::operator <<(ostream& os,
+					const PortPacketReceiver::Counters& c)
+{
+	os << "<";
+	os << "nb_packets=" << c.nb_packets << ", "
+	   << "nb_frames=" << c.nb_frames << ", "
+	   << "nb_partial_frames=" << c.nb_partial_frames << ", "
+	   << "nb_lost_packets=" << c.nb_lost_packets << ", "
+	   << "nb_late_packets=" << c.nb_late_packets << ", "
+	   << "nb_invalid_packets=" << c.nb_invalid_packets;
+	return os << ">";
+}
+
+// copies len bytes at offset of the fragmented packet
+static void copyFrags(const iovec *frag, int nb_frags, size_t offset,
+		      char *dest, size_t len)
+{
+	for (; (nb_frags > 0) && (offset >= frag->iov_len); ++frag, --nb_frags)
+		offset -= frag->iov_len;
+	for (; (nb_frags > 0) && (len > 0); ++frag, --nb_frags, offset = 0) {
+		size_t l = min(len, frag->iov_len - offset);
+		memcpy(dest, (const char *) frag->iov_base + offset, l);
+		dest += l;
+		len -= l;
+	}
+}
+
+PortPacketReceiver::PortPacketReceiver(FrameHandler *handler)
+	: m_handler(handler), m_frame_size(0), m_packet_len(0),
+	  m_frame_packets(0), m_frame(-1), m_frame_done(true),
+	  m_frame_ptr(NULL), m_recv_packets(0)
+{
+	DEB_CONSTRUCTOR();
+}
+
+PortPacketReceiver::~PortPacketReceiver()
+{
+	DEB_DESTRUCTOR();
+}
+
+void PortPacketReceiver::prepareAcq(uint32_t frame_size, int packet_len)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(frame_size, packet_len);
+
+	if ((packet_len <= 0) || (frame_size % packet_len != 0))
+		THROW_HW_ERROR(InvalidValue) << "Invalid "
+					     << DEB_VAR2(frame_size, packet_len);
+	m_frame_size = frame_size;
+	m_packet_len = packet_len;
+	m_frame_packets = frame_size / packet_len;
+	m_slot.resize(frame_size);
+	m_packet_mask.assign((m_frame_packets + 63) / 64, 0);
+
+	m_frame = -1;
+	m_frame_done = true;
+	m_frame_ptr = NULL;
+	m_recv_packets = 0;
+	m_counters = Counters();
+}
+
+void PortPacketReceiver::processPacket(const char *p, int len)
+{
+	iovec frag;
+	frag.iov_base = (void *) p;
+	frag.iov_len = len;
+	processPacket(&frag, 1);
+}
+
+void PortPacketReceiver::processPacket(const iovec *frag, int nb_frags)
+{
+	DEB_MEMBER_FUNCT();
+
+	size_t len = 0;
+	for (int i = 0; i < nb_frags; ++i)
+		len += frag[i].iov_len;
+	const size_t header_len = sizeof(PacketHeader);
+	if (len != header_len + m_packet_len) {
+		++m_counters.nb_invalid_packets;
+		return;
+	}
+	++m_counters.nb_packets;
+
+	PacketHeader h;
+	copyFrags(frag, nb_frags, 0, (char *) &h, header_len);
+	// frame numbers start at 1
+	FrameType det_frame = h.frame - 1;
+	int packet = h.packet;
+	if ((h.frame == 0) || (packet >= m_frame_packets)) {
+		++m_counters.nb_invalid_packets;
+		return;
+	}
+
+	if (!isValidFrame(m_frame) || (det_frame > m_frame)) {
+		finishFrame();
+		startFrame(det_frame, h);
+	} else if ((det_frame < m_frame) || m_frame_done) {
+		++m_counters.nb_late_packets;
+		return;
+	}
+
+	uint64_t& w = m_packet_mask[packet / 64];
+	uint64_t bit = uint64_t(1) << (packet % 64);
+	if (w & bit) {
+		// duplicated
+		++m_counters.nb_late_packets;
+		return;
+	}
+	w |= bit;
+	char *dest = m_frame_ptr + size_t(packet) * m_packet_len;
+	copyFrags(frag, nb_frags, header_len, dest, m_packet_len);
+	if (++m_recv_packets == m_frame_packets)
+		finishFrame();
+}
+
+void PortPacketReceiver::startFrame(FrameType det_frame, 
+				    const PacketHeader& h)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(det_frame);
+
+	m_frame = det_frame;
+	m_frame_done = false;
+	m_recv_packets = 0;
+	m_packet_mask.assign(m_packet_mask.size(), 0);
+	m_frame_ptr = m_handler->getFrameBuffer(det_frame);
+	if (!m_frame_ptr)
+		m_frame_ptr = &m_slot[0];
+
+	m_md.det_frame = det_frame;
+	m_md.bunch_id = h.bunch_id;
+	m_md.timestamp = h.timestamp;
+	m_md.mod_id = h.mod_id;
+	m_md.x = h.x;
+	m_md.y = h.y;
+	m_md.z = h.z;
+	m_md.debug = h.debug;
+}
+
+void PortPacketReceiver::finishFrame()
+{
+	DEB_MEMBER_FUNCT();
+
+	if (!isValidFrame(m_frame) || m_frame_done)
+		return;
+
+	int nb_lost = m_frame_packets - m_recv_packets;
+	if (nb_lost > 0) {
+		// as slsReceiver: the missing packets are filled with 0xff
+		for (int i = 0; i < m_frame_packets; ++i) {
+			uint64_t bit = uint64_t(1) << (i % 64);
+			if (m_packet_mask[i / 64] & bit)
+				continue;
+			char *dest = m_frame_ptr + size_t(i) * m_packet_len;
+			memset(dest, 0xff, m_packet_len);
+		}
+		++m_counters.nb_partial_frames;
+		m_counters.nb_lost_packets += nb_lost;
+		DEB_TRACE() << "partial " << DEB_VAR2(m_frame, nb_lost);
+	}
+	++m_counters.nb_frames;
+
+	m_frame_done = true;
+	m_md.recv_packets = m_recv_packets;
+	m_handler->frameReceived(m_md, m_frame_ptr, m_frame_size);
+}
+
+void PortPacketReceiver::flush()
+{
+	DEB_MEMBER_FUNCT();
+	finishFrame();
+}
+
+UdpPortReceiver::UdpPortReceiver(FrameHandler *handler, int udp_port,
+				 string addr, int nb_msgs)
+	: PortPacketReceiver(handler), m_udp_port(udp_port), m_fd(-1), 
+	  m_gro(false), m_nb_msgs(nb_msgs)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR3(udp_port, addr, nb_msgs);
+
+	openSocket(addr);
+
+	m_msg_buffer.resize(size_t(m_nb_msgs) * MsgBufferLen);
+	m_msg_list.resize(m_nb_msgs);
+	m_iov_list.resize(m_nb_msgs);
+	int ctrl_len = CMSG_SPACE(sizeof(int));
+	m_ctrl_buffer.resize(m_nb_msgs * ctrl_len);
+	for (int i = 0; i < m_nb_msgs; ++i) {
+		iovec& iov = m_iov_list[i];
+		iov.iov_base = &m_msg_buffer[size_t(i) * MsgBufferLen];
+		iov.iov_len = MsgBufferLen;
+		msghdr& h = m_msg_list[i].msg_hdr;
+		memset(&h, 0, sizeof(h));
+		h.msg_iov = &iov;
+		h.msg_iovlen = 1;
+		h.msg_control = &m_ctrl_buffer[i * ctrl_len];
+		h.msg_controllen = ctrl_len;
+	}
+}
+
+UdpPortReceiver::~UdpPortReceiver()
+{
+	DEB_DESTRUCTOR();
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+void UdpPortReceiver::openSocket(const string& addr)
+{
+	DEB_MEMBER_FUNCT();
+
+	m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (m_fd < 0)
+		THROW_HW_ERROR(Error) << "Error creating socket: "
+				      << strerror(errno);
+
+	// several receivers (threads) can share the port
+	int val = 1;
+	if (setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) < 0)
+		THROW_HW_ERROR(Error) << "Error setting SO_REUSEPORT: "
+				      << strerror(errno);
+	val = 64 * 1024 * 1024;
+	if (setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) < 0)
+		DEB_WARNING() << "Could not set SO_RCVBUF: " << strerror(errno);
+	val = 1;
+	m_gro = (setsockopt(m_fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0);
+	if (!m_gro)
+		DEB_TRACE() << "UDP GRO not available";
+
+	sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(m_udp_port);
+	if (inet_pton(AF_INET, addr.c_str(), &sa.sin_addr) != 1)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(addr);
+	if (bind(m_fd, (sockaddr *) &sa, sizeof(sa)) < 0)
+		THROW_HW_ERROR(Error) << "Error binding "
+				      << DEB_VAR2(addr, m_udp_port) << ": "
+				      << strerror(errno);
+	socklen_t sa_len = sizeof(sa);
+	if (getsockname(m_fd, (sockaddr *) &sa, &sa_len) < 0)
+		THROW_HW_ERROR(Error) << "Error getting socket name: "
+				      << strerror(errno);
+	m_udp_port = ntohs(sa.sin_port);
+	DEB_TRACE() << DEB_VAR2(m_udp_port, m_gro);
+}
+
+int UdpPortReceiver::poll(double timeout)
+{
+	DEB_MEMBER_FUNCT();
+
+	pollfd pfd;
+	pfd.fd = m_fd;
+	pfd.events = POLLIN;
+	int ret = ::poll(&pfd, 1, int(timeout * 1e3));
+	if (ret < 0) {
+		if (errno == EINTR)
+			return 0;
+		THROW_HW_ERROR(Error) << "Error polling socket: "
+				      << strerror(errno);
+	} else if (ret == 0) {
+		return 0;
+	}
+
+	int ctrl_len = CMSG_SPACE(sizeof(int));
+	for (int i = 0; i < m_nb_msgs; ++i)
+		m_msg_list[i].msg_hdr.msg_controllen = ctrl_len;
+	int nb_msgs = recvmmsg(m_fd, &m_msg_list[0], m_nb_msgs, MSG_DONTWAIT,
+			       NULL);
+	if (nb_msgs < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR))
+			return 0;
+		THROW_HW_ERROR(Error) << "Error in recvmmsg: "
+				      << strerror(errno);
+	}
+
+	int nb_packets = 0;
+	for (int i = 0; i < nb_msgs; ++i) {
+		mmsghdr& m = m_msg_list[i];
+		const char *p = (const char *) m_iov_list[i].iov_base;
+		int len = m.msg_len;
+		// GRO: coalesced datagrams of seg_len bytes (last can be less)
+		int seg_len = len;
+		msghdr& h = m.msg_hdr;
+		cmsghdr *c = CMSG_FIRSTHDR(&h);
+		for (; c != NULL; c = CMSG_NXTHDR(&h, c))
+			if ((c->cmsg_level == SOL_UDP) &&
+			    (c->cmsg_type == UDP_GRO))
+				memcpy(&seg_len, CMSG_DATA(c), sizeof(int));
+		// empty datagram: no header
+		if ((len <= 0) || (seg_len <= 0)) {
+			countInvalidPacket();
+			continue;
+		}
+		processMsg(p, len, seg_len);
+		nb_packets += (len + seg_len - 1) / seg_len;
+	}
+	return nb_packets;
+}
+
+void UdpPortReceiver::processMsg(const char *p, int len, int seg_len)
+{
+	for (; len > 0; p += seg_len, len -= seg_len)
+		processPacket(p, min(len, seg_len));
+}
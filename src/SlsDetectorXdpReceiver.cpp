@@ -0,0 +1,390 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+
+#include "SlsDetectorXdpReceiver.h"
+
+#ifdef SLSDETECTOR_AF_XDP
+
+#include <xdp/xsk.h>
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <linux/if_link.h>
+#include <linux/if_ether.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+// multi-buffer (jumbo frames) support: Linux >= 6.6
+#ifndef XDP_USE_SG
+#define XDP_USE_SG		(1 << 4)
+#endif
+#ifndef XDP_PKT_CONTD
+#define XDP_PKT_CONTD		(1 << 0)
+#endif
+
+#endif // SLSDETECTOR_AF_XDP
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+ostream& lima::SlsDetector::operator <<(ostream& os, 
+					XdpPortReceiver::Mode mode)
+{
+	const char *name = "Invalid";
+	switch (mode) {
+	case XdpPortReceiver::ZeroCopyMode:	name = "ZeroCopy";	break;
+	case XdpPortReceiver::DriverCopyMode:	name = "DriverCopy";	break;
+	case XdpPortReceiver::GenericMode:	name = "Generic";	break;
+	}
+	return os << name;
+}
+
+#ifdef SLSDETECTOR_AF_XDP
+
+// UMEM: Eiger jumbo frames span two chunks (multi-buffer)
+static const int NbChunks = 4096;
+static const int ChunkSize = XSK_UMEM__DEFAULT_FRAME_SIZE;
+static const int RxBatch = 64;
+
+struct XdpPortReceiver::Queue {
+	int queue_id;
+	void *umem_area;
+	size_t umem_size;
+	xsk_umem *umem;
+	xsk_socket *xsk;
+	xsk_ring_prod fill;
+	xsk_ring_cons comp;
+	xsk_ring_cons rx;
+
+	Queue(int id)
+		: queue_id(id), umem_area(MAP_FAILED), 
+		  umem_size(size_t(NbChunks) * ChunkSize), umem(NULL), 
+		  xsk(NULL)
+	{}
+
+	~Queue()
+	{
+		if (xsk)
+			xsk_socket__delete(xsk);
+		if (umem)
+			xsk_umem__delete(umem);
+		if (umem_area != MAP_FAILED)
+			munmap(umem_area, umem_size);
+	}
+
+	int create(const string& net_dev, Mode mode);
+	int getFd()
+	{ return xsk_socket__fd(xsk); }
+};
+
+int XdpPortReceiver::Queue::create(const string& net_dev, Mode mode)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	umem_area = mmap(NULL, umem_size, PROT_READ | PROT_WRITE, 
+			 flags | MAP_HUGETLB, -1, 0);
+	if (umem_area == MAP_FAILED)
+		umem_area = mmap(NULL, umem_size, PROT_READ | PROT_WRITE, 
+				 flags, -1, 0);
+	if (umem_area == MAP_FAILED)
+		return -errno;
+
+	xsk_umem_config umem_cfg;
+	memset(&umem_cfg, 0, sizeof(umem_cfg));
+	umem_cfg.fill_size = NbChunks;
+	umem_cfg.comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS;
+	umem_cfg.frame_size = ChunkSize;
+	umem_cfg.frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM;
+	int ret = xsk_umem__create(&umem, umem_area, umem_size, &fill, &comp,
+				   &umem_cfg);
+	if (ret < 0) {
+		umem = NULL;
+		return ret;
+	}
+
+	xsk_socket_config xsk_cfg;
+	memset(&xsk_cfg, 0, sizeof(xsk_cfg));
+	xsk_cfg.rx_size = NbChunks;
+	xsk_cfg.tx_size = 0;
+	uint16_t bind_flags = XDP_USE_SG | XDP_USE_NEED_WAKEUP;
+	switch (mode) {
+	case ZeroCopyMode:
+		xsk_cfg.xdp_flags = XDP_FLAGS_DRV_MODE;
+		bind_flags |= XDP_ZEROCOPY;
+		break;
+	case DriverCopyMode:
+		xsk_cfg.xdp_flags = XDP_FLAGS_DRV_MODE;
+		bind_flags |= XDP_COPY;
+		break;
+	case GenericMode:
+		xsk_cfg.xdp_flags = XDP_FLAGS_SKB_MODE;
+		bind_flags |= XDP_COPY;
+		break;
+	}
+	xsk_cfg.bind_flags = bind_flags;
+	ret = xsk_socket__create(&xsk, net_dev.c_str(), queue_id, umem, &rx, 
+				 NULL, &xsk_cfg);
+	if (ret < 0) {
+		xsk = NULL;
+		return ret;
+	}
+
+	// all the chunks are given to the kernel
+	uint32_t idx;
+	if (xsk_ring_prod__reserve(&fill, NbChunks, &idx) != NbChunks)
+		return -ENOMEM;
+	for (int i = 0; i < NbChunks; ++i)
+		*xsk_ring_prod__fill_addr(&fill, idx++) = 
+			uint64_t(i) * ChunkSize;
+	xsk_ring_prod__submit(&fill, NbChunks);
+	return 0;
+}
+
+#else // !SLSDETECTOR_AF_XDP
+
+struct XdpPortReceiver::Queue {
+};
+
+#endif // SLSDETECTOR_AF_XDP
+
+bool XdpPortReceiver::isAvailable()
+{
+#ifdef SLSDETECTOR_AF_XDP
+	return true;
+#else
+	return false;
+#endif
+}
+
+XdpPortReceiver::XdpPortReceiver(FrameHandler *handler, int udp_port, 
+				 string net_dev, const IntList& queue_list)
+	: PortPacketReceiver(handler), m_udp_port(udp_port), 
+	  m_net_dev(net_dev), m_mode(ZeroCopyMode)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR3(udp_port, net_dev, PrettyIntList(queue_list));
+
+#ifdef SLSDETECTOR_AF_XDP
+	if (queue_list.empty())
+		THROW_HW_ERROR(InvalidValue) << "Empty queue list";
+
+	// UMEM registration is accounted as locked memory in old kernels
+	struct rlimit rlim = {RLIM_INFINITY, RLIM_INFINITY};
+	if (setrlimit(RLIMIT_MEMLOCK, &rlim) < 0)
+		DEB_WARNING() << "Could not raise RLIMIT_MEMLOCK: " 
+			      << strerror(errno);
+
+	// the mode found for the first queue is used for the others
+	IntList::const_iterator it, end = queue_list.end();
+	for (it = queue_list.begin(); it != end; ++it) {
+		AutoPtr<Queue> q;
+		int ret;
+		for (;;) {
+			q = new Queue(*it);
+			ret = q->create(m_net_dev, m_mode);
+			if ((ret == 0) || (it != queue_list.begin()) || 
+			    (m_mode == GenericMode))
+				break;
+			DEB_TRACE() << m_net_dev << " queue " << *it << ": "
+				    << m_mode << " mode failed: " 
+				    << strerror(-ret);
+			m_mode = Mode(m_mode + 1);
+		}
+		if (ret < 0)
+			THROW_HW_ERROR(Error) << "Error creating XSK on " 
+					      << m_net_dev << " queue " << *it
+					      << " (" << m_mode << " mode): "
+					      << strerror(-ret);
+		m_queue_list.push_back(q);
+	}
+	DEB_ALWAYS() << m_net_dev << ": " << DEB_VAR2(m_udp_port, m_mode);
+#else
+	THROW_HW_ERROR(NotSupported) << "AF_XDP support not compiled";
+#endif
+}
+
+XdpPortReceiver::~XdpPortReceiver()
+{
+	DEB_DESTRUCTOR();
+}
+
+#ifdef SLSDETECTOR_AF_XDP
+
+int XdpPortReceiver::poll(double timeout)
+{
+	DEB_MEMBER_FUNCT();
+
+	int nb_packets = 0;
+	QueueList::iterator it, end = m_queue_list.end();
+	for (it = m_queue_list.begin(); it != end; ++it)
+		nb_packets += processQueue(**it);
+	if (nb_packets > 0)
+		return nb_packets;
+
+	vector<pollfd> pfd_list(m_queue_list.size());
+	vector<pollfd>::iterator pit = pfd_list.begin();
+	for (it = m_queue_list.begin(); it != end; ++it, ++pit) {
+		pit->fd = (*it)->getFd();
+		pit->events = POLLIN;
+	}
+	int ret = ::poll(&pfd_list[0], pfd_list.size(), int(timeout * 1e3));
+	if (ret < 0) {
+		if (errno == EINTR)
+			return 0;
+		THROW_HW_ERROR(Error) << "Error polling XSK: " 
+				      << strerror(errno);
+	} else if (ret == 0) {
+		return 0;
+	}
+	for (it = m_queue_list.begin(); it != end; ++it)
+		nb_packets += processQueue(**it);
+	return nb_packets;
+}
+
+int XdpPortReceiver::processQueue(Queue& q)
+{
+	DEB_MEMBER_FUNCT();
+
+	int nb_packets = 0;
+	uint32_t idx;
+	uint32_t n = xsk_ring_cons__peek(&q.rx, RxBatch, &idx);
+	if (n == 0) {
+		if (xsk_ring_prod__needs_wakeup(&q.fill))
+			recvfrom(q.getFd(), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+		return 0;
+	}
+
+	// a packet continuing in the next batch is left in the ring
+	uint32_t nb_descs = n;
+	while ((nb_descs > 0) && 
+	       (xsk_ring_cons__rx_desc(&q.rx, idx + nb_descs - 1)->options &
+		XDP_PKT_CONTD))
+		--nb_descs;
+	if (nb_descs < n)
+		xsk_ring_cons__cancel(&q.rx, n - nb_descs);
+	if (nb_descs == 0)
+		return 0;
+
+	// the consumed chunks go back to the fill ring
+	uint32_t fill_idx;
+	while (xsk_ring_prod__reserve(&q.fill, nb_descs, &fill_idx) != 
+	       nb_descs)
+		;
+	m_frag_list.clear();
+	for (uint32_t i = 0; i < nb_descs; ++i) {
+		const xdp_desc *desc = xsk_ring_cons__rx_desc(&q.rx, idx + i);
+		iovec frag;
+		frag.iov_base = xsk_umem__get_data(q.umem_area, desc->addr);
+		frag.iov_len = desc->len;
+		m_frag_list.push_back(frag);
+		if (!(desc->options & XDP_PKT_CONTD)) {
+			processFrame(&m_frag_list[0], m_frag_list.size());
+			m_frag_list.clear();
+			++nb_packets;
+		}
+		*xsk_ring_prod__fill_addr(&q.fill, fill_idx + i) = desc->addr;
+	}
+	xsk_ring_cons__release(&q.rx, nb_descs);
+	xsk_ring_prod__submit(&q.fill, nb_descs);
+	return nb_packets;
+}
+
+void XdpPortReceiver::processFrame(iovec *frag, int nb_frags)
+{
+	DEB_MEMBER_FUNCT();
+
+	// Ethernet [+ VLAN] / IPv4 / UDP headers are in the first fragment
+	const char *p = (const char *) frag[0].iov_base;
+	size_t len = frag[0].iov_len;
+	size_t off = sizeof(ethhdr);
+	if (len < off) {
+		countInvalidPacket();
+		return;
+	}
+	uint16_t proto = ntohs(((const ethhdr *) p)->h_proto);
+	if (proto == ETH_P_8021Q) {
+		off += 4;
+		if (len < off) {
+			countInvalidPacket();
+			return;
+		}
+		proto = ntohs(*(const uint16_t *) (p + off - 2));
+	}
+	if ((proto != ETH_P_IP) || (len < off + sizeof(iphdr))) {
+		countInvalidPacket();
+		return;
+	}
+	const iphdr *ip = (const iphdr *) (p + off);
+	off += ip->ihl * 4;
+	if ((ip->protocol != IPPROTO_UDP) || 
+	    (ip->frag_off & htons(IP_MF | IP_OFFMASK)) ||
+	    (len < off + sizeof(udphdr))) {
+		countInvalidPacket();
+		return;
+	}
+	const udphdr *udp = (const udphdr *) (p + off);
+	off += sizeof(udphdr);
+	if ((ntohs(udp->dest) != m_udp_port) || 
+	    (ntohs(udp->len) < sizeof(udphdr))) {
+		countInvalidPacket();
+		return;
+	}
+
+	// the fragments are trimmed to the UDP payload
+	size_t payload_len = ntohs(udp->len) - sizeof(udphdr);
+	frag[0].iov_base = (char *) frag[0].iov_base + off;
+	frag[0].iov_len -= off;
+	int i;
+	for (i = 0; (i < nb_frags) && (payload_len > 0); ++i) {
+		frag[i].iov_len = min(frag[i].iov_len, payload_len);
+		payload_len -= frag[i].iov_len;
+	}
+	processPacket(frag, i);
+}
+
+#else // !SLSDETECTOR_AF_XDP
+
+// not reached, the constructor throws: idle for the poll timeout
+int XdpPortReceiver::poll(double timeout)
+{
+	Sleep(timeout);
+	return 0;
+}
+
+int XdpPortReceiver::processQueue(Queue& /*q*/)
+{
+	return 0;
+}
+
+void XdpPortReceiver::processFrame(iovec * /*frag*/, int /*nb_frags*/)
+{
+}
+
+#endif // SLSDETECTOR_AF_XDP
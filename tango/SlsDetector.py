@@ -81,7 +81,10 @@ class SlsDetector(PyTango.Device_4Impl):
 
     MilliVoltSuffix = '_mv'
 
+    StatsPercentiles = [50, 90, 99, 99.9]
+
     ModelAttrs = ['parallel_mode',
+                  'corr_mode',
                   'high_voltage',
                   'clock_div',
                   'fixed_clock_div',
@@ -139,10 +142,19 @@ class SlsDetector(PyTango.Device_4Impl):
         nl = ['Parallel', 'NonParallel', 'Safe']
         self.__ParallelMode = ConstListAttr(nl, namespc=SlsDetectorHw.Eiger)
 
+        nl = ['LinkTaskCorr', 'RecvPortCorr']
+        self.__CorrMode = ConstListAttr(nl, namespc=SlsDetectorHw.Eiger)
+
         nl = ['PixelDepth4', 'PixelDepth8', 'PixelDepth16', 'PixelDepth32']
         bdl = map(lambda x: getattr(SlsDetectorHw, x), nl)
         self.__PixelDepth = OrderedDict([(str(bd), int(bd)) for bd in bdl])
 
+        nl = ['BlockWait', 'BusyWait']
+        self.__FrameQueueWaitPolicy = ConstListAttr(nl, namespc=SlsDetectorHw)
+
+        nl = ['SlsRecvEngine', 'NativeRecvEngine', 'XdpRecvEngine']
+        self.__RecvEngine = ConstListAttr(nl, namespc=SlsDetectorHw)
+
     @Core.DEB_MEMBER_FUNCT
     def init_dac_adc_attr(self):
         nb_modules = self.cam.getNbDetSubModules()
@@ -318,6 +330,18 @@ class SlsDetector(PyTango.Device_4Impl):
         deb.Return("bad_frame_list=%s" % bad_frame_list)
         return bad_frame_list
 
+    @Core.DEB_MEMBER_FUNCT
+    def getNbPartialFrames(self, port_idx):
+        nb_partial_frames = self.cam.getNbPartialFrames(port_idx);
+        deb.Return("nb_partial_frames=%s" % nb_partial_frames)
+        return nb_partial_frames
+
+    @Core.DEB_MEMBER_FUNCT
+    def getNbLostPackets(self, port_idx):
+        nb_lost_packets = self.cam.getNbLostPackets(port_idx);
+        deb.Return("nb_lost_packets=%s" % nb_lost_packets)
+        return nb_lost_packets
+
     @Core.DEB_MEMBER_FUNCT
     def getStats(self, port_idx_stats_name):
         port_idx_str, stats_name = port_idx_stats_name.split(':')
@@ -326,6 +350,7 @@ class SlsDetector(PyTango.Device_4Impl):
         stats = self.cam.getStats(port_idx)
         stat = getattr(stats, stats_name)
         stat_data = [stat.min(), stat.max(), stat.ave(), stat.std(), stat.n()]
+        stat_data += [stat.percentile(p) for p in self.StatsPercentiles]
         deb.Return("stat_data=%s" % stat_data)
         return stat_data
 
@@ -336,7 +361,7 @@ class SlsDetector(PyTango.Device_4Impl):
         deb.Param("port_idx=%s, stats_name=%s");
         stats = self.cam.getStats(port_idx)
         stat = getattr(stats, stats_name)
-        stat_data = np.array(stat.hist).flatten()
+        stat_data = np.array(stat.getHistogram()).flatten()
         deb.Return("stat_data=%s" % stat_data)
         return stat_data
 
@@ -461,6 +486,43 @@ class SlsDetector(PyTango.Device_4Impl):
         aff_map = self.getPixelDepthCPUAffinityMapFromArray(aff_array)
         self.cam.setPixelDepthCPUAffinityMap(aff_map)
 
+    @Core.DEB_MEMBER_FUNCT
+    def read_thread_sched_params(self, attr):
+        sched_array = []
+        for info in self.cam.getThreadInfoList():
+            p = info.sched_params
+            policy = self.getSchedPolicyName(p.policy)
+            sched_array.append('%s,%d,%s,%d,%s' % 
+                               (info.name, info.tid, policy, p.priority,
+                                hex(p.cpu_affinity.getMask())))
+        deb.Return("sched_array=%s" % sched_array)
+        attr.set_value(sched_array)
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_thread_sched_params(self, attr):
+        sched_array = attr.get_write_value()
+        deb.Param("sched_array=%s" % sched_array)
+        err = ValueError("Invalid thread_sched_params: must be a list of "
+                         "name,policy,priority[,cpu_mask] strings")
+        for s in sched_array:
+            fields = s.split(',')
+            if len(fields) not in [3, 4]:
+                raise err
+            name, policy, priority = fields[:3]
+            policy = getattr(SlsDetectorHw, 'Sched' + policy, None)
+            if policy is None:
+                raise err
+            mask = int(fields[3], 0) if len(fields) == 4 else 0
+            params = SlsDetectorHw.ThreadSchedParams(
+                policy, int(priority), SlsDetectorHw.CPUAffinity(mask))
+            self.cam.setThreadSchedParams(name, params)
+
+    def getSchedPolicyName(self, policy):
+        for name in ['Default', 'Other', 'FIFO', 'RR', 'Batch', 'Idle']:
+            if policy == getattr(SlsDetectorHw, 'Sched' + name):
+                return name
+        return str(policy)
+
 
 class SlsDetectorClass(PyTango.DeviceClass):
 
@@ -514,9 +576,16 @@ class SlsDetectorClass(PyTango.DeviceClass):
         'getBadFrameList':
         [[PyTango.DevLong, "port_idx(-1=all)"],
          [PyTango.DevVarLongArray, "Bad frame list"]],
+        'getNbPartialFrames':
+        [[PyTango.DevLong, "port_idx(-1=all)"],
+         [PyTango.DevLong, "Number of frames with lost packets"]],
+        'getNbLostPackets':
+        [[PyTango.DevLong, "port_idx(-1=all)"],
+         [PyTango.DevLong, "Number of lost packets"]],
         'getStats':
         [[PyTango.DevString, "port_idx(-1=all):stats_name"],
-         [PyTango.DevVarDoubleArray, "Statistics: min, max, ave, std, n"]],
+         [PyTango.DevVarDoubleArray, "Statistics: min, max, ave, std, n, "
+                                     "p50, p90, p99, p99.9"]],
         'getStatsHistogram':
         [[PyTango.DevString, "port_idx(-1=all):stats_name"],
          [PyTango.DevVarDoubleArray, "[[bin, count], ...]"]],
@@ -551,6 +620,14 @@ class SlsDetectorClass(PyTango.DeviceClass):
         [[PyTango.DevBoolean,
           PyTango.SCALAR,
           PyTango.READ_WRITE]],
+        'recv_direct_placement':
+        [[PyTango.DevBoolean,
+          PyTango.SCALAR,
+          PyTango.READ_WRITE]],
+        'recv_engine':
+        [[PyTango.DevString,
+          PyTango.SCALAR,
+          PyTango.READ_WRITE]],
         'threshold_energy':
         [[PyTango.DevLong,
           PyTango.SCALAR,
@@ -572,6 +649,10 @@ class SlsDetectorClass(PyTango.DeviceClass):
           PyTango.SCALAR,
           PyTango.READ_WRITE]],
         'parallel_mode':
+        [[PyTango.DevString,
+          PyTango.SCALAR,
+          PyTango.READ_WRITE]],
+        'corr_mode':
         [[PyTango.DevString,
           PyTango.SCALAR,
           PyTango.READ_WRITE]],
@@ -599,6 +680,22 @@ class SlsDetectorClass(PyTango.DeviceClass):
         [[PyTango.DevLong,
           PyTango.SCALAR,
           PyTango.READ_WRITE]],
+        'frame_queue_size':
+        [[PyTango.DevLong,
+          PyTango.SCALAR,
+          PyTango.READ_WRITE]],
+        'frame_queue_wait_policy':
+        [[PyTango.DevString,
+          PyTango.SCALAR,
+          PyTango.READ_WRITE]],
+        'frame_queue_high_watermark_list':
+        [[PyTango.DevLong,
+          PyTango.SPECTRUM,
+          PyTango.READ, 64]],
+        'thread_sched_params':
+        [[PyTango.DevString,
+          PyTango.SPECTRUM,
+          PyTango.READ_WRITE, 64]],
         }
 
     def __init__(self,name) :
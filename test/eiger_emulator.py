@@ -0,0 +1,211 @@
+############################################################################
+# This file is part of LImA, a Library for Image Acquisition
+#
+# Copyright (C) : 2009-2017
+# European Synchrotron Radiation Facility
+# BP 220, Grenoble 38043
+# FRANCE
+#
+# This is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses/>.
+############################################################################
+
+# Eiger data stand-in for hardware-free tests: streams firmware v2 data
+# packets (48-byte header + 4096-byte payload, as decoded by
+# eiger_packet.py) to the receiver data ports, with injected packet loss.
+# The detector control is not emulated: tests going through the Camera
+# must use the slsDetectorPackage virtual servers as the config hostnames
+# (eigerDetectorServer_virtual), which also stream loss-free data.
+#
+# All pixels of a frame have the value (frame_nb % max_pixel_value), so the
+# receiver pipeline output can be checked. Example, 1 module, 16-bit,
+# 100 Hz, 1% packet loss, ports from the config file:
+#
+#   python eiger_emulator.py -c ${EIGER_CONFIG} -d 16 -r 100 -l 0.01
+
+from __future__ import print_function
+
+import sys
+import re
+import time
+import struct
+import socket
+import random
+import argparse
+import threading
+
+ChipSize = 256
+HalfModuleChips = 4
+RecvPorts = 2
+PacketDataLen = 4096
+TstampClockFreq = 10e6
+PacketXferTime = 7.646e-6
+EigerDetType = 1
+HeaderVersion = 2
+HeaderFmt = '<QLLQQHHHHLHBB'
+
+
+def port_packets(depth, tengiga=True):
+    port_bytes = ChipSize * ChipSize * HalfModuleChips / RecvPorts * depth / 8
+    packet_len = PacketDataLen if tengiga else PacketDataLen / 4
+    return int(port_bytes / packet_len), int(packet_len)
+
+
+def frame_payload(frame, depth, packet_len):
+    v = frame % ((1 << depth) - 1)
+    if depth == 4:
+        return struct.pack('B', v * 0x11) * packet_len
+    fmt = {8: '<B', 16: '<H', 32: '<L'}[depth]
+    return struct.pack(fmt, v) * int(packet_len * 8 / depth)
+
+
+def read_config(fname):
+    hostnames = []
+    udp_ports = {}
+    udp_ip = {}
+    for l in open(fname):
+        l = l.split('#')[0].strip()
+        if not l:
+            continue
+        toks = l.split()
+        if toks[0] == 'hostname':
+            hostnames = [h for h in toks[1].split('+') if h]
+            continue
+        m = re.match('([0-9]+):rx_udpport(2?)$', toks[0])
+        if m:
+            hm, p = int(m.group(1)), 1 if m.group(2) else 0
+            udp_ports.setdefault(hm, [None, None])[p] = int(toks[1])
+            continue
+        m = re.match('([0-9]+):rx_udpip$', toks[0])
+        if m:
+            udp_ip[int(m.group(1))] = toks[1]
+    nb_half_modules = len(hostnames)
+    dest = []
+    for hm in range(nb_half_modules):
+        ip = udp_ip.get(hm, '127.0.0.1')
+        for port in udp_ports[hm]:
+            dest.append((ip, port))
+    return nb_half_modules, dest
+
+
+class Emulator(object):
+
+    def __init__(self, dest, depth=16, period=0.01, exp_time=0.005,
+                 nb_frames=1, packet_loss=0.0, lost_frames=(), seed=None):
+        self.dest = dest
+        self.pars = {'dr': depth, 'period': period, 'exptime': exp_time,
+                     'frames': nb_frames, 'cycles': 1, 'tengiga': 1}
+        self.packet_loss = packet_loss
+        self.lost_frames = set(lost_frames)
+        self.random = random.Random(seed)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 1 << 24)
+        self.lock = threading.Lock()
+        self.thread = None
+        self.stop_req = False
+        self.frames_sent = 0
+        self.packets_sent = 0
+        self.packets_lost = 0
+
+    def start(self):
+        with self.lock:
+            if self.thread is not None and self.thread.is_alive():
+                raise RuntimeError('Acquisition running')
+            self.stop_req = False
+            self.thread = threading.Thread(target=self.stream)
+            self.thread.start()
+
+    def stop(self):
+        self.stop_req = True
+        if self.thread is not None:
+            self.thread.join()
+
+    def wait(self):
+        if self.thread is not None:
+            self.thread.join()
+
+    def stream(self):
+        depth = int(self.pars['dr'])
+        period = float(self.pars['period'])
+        nb_frames = int(self.pars['frames']) * int(self.pars['cycles'])
+        tengiga = int(self.pars['tengiga']) != 0
+        nb_packets, packet_len = port_packets(depth, tengiga)
+        self.frames_sent = self.packets_sent = self.packets_lost = 0
+        t0 = time.time()
+        for frame in range(nb_frames):
+            if self.stop_req:
+                break
+            delay = t0 + frame * period - time.time()
+            if delay > 0:
+                time.sleep(delay)
+            self.frames_sent += 1
+            if frame in self.lost_frames:
+                self.packets_lost += nb_packets * len(self.dest)
+                continue
+            payload = frame_payload(frame, depth, packet_len)
+            for port_idx, addr in enumerate(self.dest):
+                hm, col = divmod(port_idx, RecvPorts)
+                tstamp = frame * period
+                for packet in range(nb_packets):
+                    if self.random.random() < self.packet_loss:
+                        self.packets_lost += 1
+                        continue
+                    t = tstamp + packet * PacketXferTime
+                    h = struct.pack(HeaderFmt, frame + 1, 0, packet, 0,
+                                    int(t * TstampClockFreq), hm, col, hm,
+                                    0, 0, 0, EigerDetType, HeaderVersion)
+                    self.sock.sendto(h + payload, addr)
+                    self.packets_sent += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Eiger emulator')
+    parser.add_argument('-c', '--config', help='Eiger config file')
+    parser.add_argument('-m', '--nb-modules', type=int, default=1)
+    parser.add_argument('-a', '--addr', default='127.0.0.1',
+                        help='data destination without config')
+    parser.add_argument('-p', '--base-port', type=int, default=50010,
+                        help='first data port without config')
+    parser.add_argument('-d', '--depth', type=int, default=16,
+                        choices=[4, 8, 16, 32])
+    parser.add_argument('-r', '--frame-rate', type=float, default=100)
+    parser.add_argument('-n', '--nb-frames', type=int, default=100)
+    parser.add_argument('-l', '--packet-loss', type=float, default=0.0)
+    parser.add_argument('-f', '--lost-frames', default='',
+                        help='comma-separated list of frames not sent')
+    parser.add_argument('-s', '--seed', type=int)
+    args = parser.parse_args()
+
+    if args.config:
+        nb_half_modules, dest = read_config(args.config)
+    else:
+        nb_half_modules = args.nb_modules * 2
+        nb_ports = nb_half_modules * RecvPorts
+        dest = [(args.addr, args.base_port + i) for i in range(nb_ports)]
+    lost_frames = [int(x) for x in args.lost_frames.split(',') if x]
+
+    emu = Emulator(dest, args.depth, 1.0 / args.frame_rate,
+                   0.5 / args.frame_rate, args.nb_frames, args.packet_loss,
+                   lost_frames, args.seed)
+    print('%d half-modules, ports: %s' % (nb_half_modules, dest))
+
+    t0 = time.time()
+    emu.start()
+    emu.wait()
+    elapsed = time.time() - t0
+    print('frames=%d, packets=%d, lost=%d, elapsed=%.3f s' %
+          (emu.frames_sent, emu.packets_sent, emu.packets_lost, elapsed))
+
+
+if __name__ == '__main__':
+    main()
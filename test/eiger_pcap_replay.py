@@ -0,0 +1,232 @@
+############################################################################
+# This file is part of LImA, a Library for Image Acquisition
+#
+# Copyright (C) : 2009-2017
+# European Synchrotron Radiation Facility
+# BP 220, Grenoble 38043
+# FRANCE
+#
+# This is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses/>.
+############################################################################
+
+# Replays the UDP payloads of a pcap/pcapng capture (tcpdump, dumpcap)
+# to the receiver data ports, reproducing the bursts, drops and reordering
+# of the captured traffic. Timing is the original one scaled by -s
+# (1: original, 2: twice slower, 0: as fast as possible). Destination
+# ports can be remapped, e.g. capture taken on the beamline, replayed on
+# a development machine with the emulator config:
+#
+#   python eiger_pcap_replay.py -a 127.0.0.1 -m 50001:50010,50002:50011 \
+#       -s 1 beamline.pcapng
+#
+# A Python sender cannot keep the 10 GbE packet rate; for a replay at
+# full speed through the receive path see test_slsdetector_pcap_replay.
+
+from __future__ import print_function
+
+import sys
+import time
+import struct
+import socket
+import argparse
+
+LinkEthernet = 1
+LinkRaw = 101
+LinkLinuxSLL = 113
+LinkIPv4 = 228
+LinkLinuxSLL2 = 276
+
+EthPIPv4 = 0x0800
+EthPVlan = (0x8100, 0x88a8)
+IPProtoUDP = 17
+
+
+def pcap_records(data):
+    magic = struct.unpack('<L', data[:4])[0]
+    units = {0xa1b2c3d4: ('<', 1e-6), 0xd4c3b2a1: ('>', 1e-6),
+             0xa1b23c4d: ('<', 1e-9), 0x4d3cb2a1: ('>', 1e-9)}
+    if magic not in units:
+        raise ValueError('Unknown capture format')
+    e, unit = units[magic]
+    link_type = struct.unpack(e + 'L', data[20:24])[0] & 0xffff
+    offset = 24
+    while offset + 16 <= len(data):
+        sec, frac, cap_len, orig_len = struct.unpack(e + 'LLLL',
+                                                     data[offset:offset + 16])
+        offset += 16
+        p = data[offset:offset + cap_len]
+        offset += cap_len
+        if len(p) == cap_len == orig_len:
+            yield sec + frac * unit, link_type, p
+
+
+def pcapng_records(data):
+    e = '<'
+    ifaces = []
+    last_t = 0
+    offset = 0
+    while offset + 12 <= len(data):
+        if data[offset:offset + 4] == b'\x0a\x0d\x0d\x0a':
+            bom = data[offset + 8:offset + 12]
+            e = '<' if bom == b'\x4d\x3c\x2b\x1a' else '>'
+            ifaces = []
+        btype, blen = struct.unpack(e + 'LL', data[offset:offset + 8])
+        if blen < 12 or offset + blen > len(data):
+            break
+        b = data[offset:offset + blen]
+        offset += blen
+        if btype == 1:
+            link_type = struct.unpack(e + 'H', b[8:10])[0]
+            unit = 1e-6
+            o = 16
+            while o + 4 <= blen - 4:
+                code, olen = struct.unpack(e + 'HH', b[o:o + 4])
+                if code == 0:
+                    break
+                if code == 9 and olen >= 1:
+                    r = bytearray(b[o + 4:o + 5])[0]
+                    unit = 2.0 ** -(r & 0x7f) if r & 0x80 else 10.0 ** -r
+                o += 4 + (olen + 3) // 4 * 4
+            ifaces.append((link_type, unit))
+        elif btype in (2, 6) and blen >= 32:
+            if btype == 6:
+                iface = struct.unpack(e + 'L', b[8:12])[0]
+            else:
+                iface = struct.unpack(e + 'H', b[8:10])[0]
+            ts_h, ts_l, cap_len, orig_len = struct.unpack(e + 'LLLL',
+                                                          b[12:28])
+            if iface >= len(ifaces) or cap_len != orig_len:
+                continue
+            link_type, unit = ifaces[iface]
+            last_t = ((ts_h << 32) | ts_l) * unit
+            yield last_t, link_type, b[28:28 + cap_len]
+        elif btype == 3 and blen >= 16 and ifaces:
+            orig_len = struct.unpack(e + 'L', b[8:12])[0]
+            p = b[12:12 + orig_len]
+            if len(p) == orig_len:
+                yield last_t, ifaces[0][0], p
+
+
+def udp_packets(fname):
+    data = open(fname, 'rb').read()
+    if data[:4] == b'\x0a\x0d\x0d\x0a':
+        records = pcapng_records(data)
+    else:
+        records = pcap_records(data)
+    for t, link_type, p in records:
+        eth_type = EthPIPv4
+        if link_type == LinkEthernet:
+            off = 14
+            eth_type = struct.unpack('>H', p[12:14])[0]
+            while eth_type in EthPVlan and len(p) >= off + 4:
+                eth_type = struct.unpack('>H', p[off + 2:off + 4])[0]
+                off += 4
+        elif link_type == LinkLinuxSLL:
+            off = 16
+            eth_type = struct.unpack('>H', p[14:16])[0]
+        elif link_type == LinkLinuxSLL2:
+            off = 20
+            eth_type = struct.unpack('>H', p[0:2])[0]
+        elif link_type in (LinkRaw, LinkIPv4):
+            off = 0
+        else:
+            continue
+        ip = p[off:]
+        if eth_type != EthPIPv4 or len(ip) < 20:
+            continue
+        ver_ihl, proto = bytearray(ip[0:1])[0], bytearray(ip[9:10])[0]
+        ihl = (ver_ihl & 0xf) * 4
+        frag = struct.unpack('>H', ip[6:8])[0] & 0x3fff
+        if ver_ihl >> 4 != 4 or proto != IPProtoUDP or frag:
+            continue
+        dst = socket.inet_ntoa(ip[16:20])
+        sport, dport, ulen = struct.unpack('>HHH', ip[ihl:ihl + 6])
+        payload = ip[ihl + 8:ihl + ulen]
+        if len(payload) == ulen - 8:
+            yield t, dst, dport, payload
+
+
+def parse_port_map(s):
+    port_map = {}
+    for x in s.split(','):
+        if x:
+            src, dst = x.split(':')
+            port_map[int(src)] = int(dst)
+    return port_map
+
+
+def replay(fname, dest_addr, port_map, port_offset, ports, time_scale,
+           repeat=1):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 1 << 24)
+    packets = []
+    for t, dst, dport, payload in udp_packets(fname):
+        if ports and dport not in ports:
+            continue
+        port = port_map.get(dport, dport + port_offset)
+        packets.append((t, (dest_addr or dst, port), payload))
+    if not packets:
+        raise ValueError('No UDP packet to replay in %s' % fname)
+    nb_sent = 0
+    nb_bytes = 0
+    late = 0.0
+    t0 = time.time()
+    for r in range(repeat):
+        start = time.time()
+        capture_t0 = packets[0][0]
+        for t, addr, payload in packets:
+            if time_scale > 0:
+                delay = start + (t - capture_t0) * time_scale - time.time()
+                if delay > 0:
+                    time.sleep(delay)
+                else:
+                    late = max(late, -delay)
+            sock.sendto(payload, addr)
+            nb_sent += 1
+            nb_bytes += len(payload)
+    elapsed = time.time() - t0
+    return nb_sent, nb_bytes, elapsed, late
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Eiger capture replay')
+    parser.add_argument('capture', help='pcap or pcapng file')
+    parser.add_argument('-a', '--addr',
+                        help='destination address, default: captured one')
+    parser.add_argument('-m', '--port-map', default='',
+                        help='captured:replayed port list, e.g. 50001:50010')
+    parser.add_argument('-o', '--port-offset', type=int, default=0,
+                        help='added to the non-mapped ports')
+    parser.add_argument('-p', '--ports', default='',
+                        help='comma-separated captured ports to replay')
+    parser.add_argument('-s', '--time-scale', type=float, default=1.0,
+                        help='1: original timing, 0: as fast as possible')
+    parser.add_argument('-r', '--repeat', type=int, default=1)
+    args = parser.parse_args()
+
+    if args.time_scale < 0:
+        parser.error('invalid time scale: %s' % args.time_scale)
+    ports = set(int(x) for x in args.ports.split(',') if x)
+    port_map = parse_port_map(args.port_map)
+    nb_sent, nb_bytes, elapsed, late = replay(args.capture, args.addr,
+                                              port_map, args.port_offset,
+                                              ports, args.time_scale,
+                                              args.repeat)
+    print('packets=%d, bytes=%d, elapsed=%.3f s, %.3f Gbit/s, '
+          'max_late=%.6f s' % (nb_sent, nb_bytes, elapsed,
+                               nb_bytes * 8 / elapsed / 1e9, late))
+
+
+if __name__ == '__main__':
+    main()
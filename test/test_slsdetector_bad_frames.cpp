@@ -0,0 +1,172 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+// Bad frame store test: FrameRangeSet vs a brute-force frame list, with
+// frames lost in runs by several ports, plus the cost of a long lossy
+// acquisition (add, index queries and the merged, summarised report).
+// The default number of runs is small; 1000000 gives the benchmark figures
+
+#include "lima/Timestamp.h"
+#include "SlsDetectorDefs.h"
+
+#include <cstdlib>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+DEB_GLOBAL(DebModTest);
+
+typedef vector<FrameRangeSet> FrameRangeSetList;
+typedef vector<IntList> RefList;
+
+// runs of lost frames, increasing as the port threads report them
+static void fillPorts(int nb_ports, int nb_runs, FrameRangeSetList& set_list,
+		      RefList *ref_list)
+{
+	set_list.assign(nb_ports, FrameRangeSet());
+	if (ref_list)
+		ref_list->assign(nb_ports, IntList());
+	srand(nb_ports * nb_runs);
+	for (int p = 0; p < nb_ports; ++p) {
+		FrameType f = 0;
+		for (int i = 0; i < nb_runs; ++i) {
+			f += 1 + rand() % 200;
+			int nb = 1 + ((rand() % 4) ? 0 : rand() % 50);
+			set_list[p].add(f, nb);
+			if (ref_list)
+				for (int j = 0; j < nb; ++j)
+					(*ref_list)[p].push_back(f + j);
+			f += nb;
+		}
+	}
+}
+
+static void checkSets(int nb_ports, int nb_runs)
+{
+	DEB_GLOBAL_FUNCT();
+
+	FrameRangeSetList set_list;
+	RefList ref_list;
+	fillPorts(nb_ports, nb_runs, set_list, &ref_list);
+
+	FrameRangeSet::SetList merge_list;
+	IntList ref_merged;
+	for (int p = 0; p < nb_ports; ++p) {
+		FrameRangeSet& s = set_list[p];
+		IntList& ref = ref_list[p];
+		merge_list.push_back(&s);
+		ref_merged.insert(ref_merged.end(), ref.begin(), ref.end());
+
+		if (s.getNbFrames() != ref.size())
+			THROW_HW_ERROR(Error) << "Size mismatch: " 
+					      << DEB_VAR1(p);
+		int nb = ref.size();
+		for (int i = 0; i < 100; ++i) {
+			int first = rand() % nb;
+			int last = first + rand() % (nb - first + 1);
+			IntList l;
+			s.getFrameList(first, last, l);
+			if (l != IntList(ref.begin() + first, 
+					 ref.begin() + last))
+				THROW_HW_ERROR(Error) << "List mismatch: "
+						      << DEB_VAR3(p, first,
+								  last);
+		}
+		for (FrameType f = 0; f <= FrameType(ref.back()) + 1; ++f) {
+			bool in_ref = binary_search(ref.begin(), ref.end(), 
+						    int(f));
+			if (s.contains(f) != in_ref)
+				THROW_HW_ERROR(Error) << "Contains mismatch: "
+						      << DEB_VAR2(p, f);
+		}
+	}
+
+	sort(ref_merged.begin(), ref_merged.end());
+	IntList::iterator end = unique(ref_merged.begin(), ref_merged.end());
+	ref_merged.erase(end, ref_merged.end());
+	FrameRangeSet merged;
+	FrameRangeSet::merge(merge_list, merged);
+	IntList l;
+	merged.getFrameList(l);
+	if (l != ref_merged)
+		THROW_HW_ERROR(Error) << "Merge mismatch";
+
+	// out of order insertion, overlapping several ranges
+	FrameRangeSet s = set_list[0];
+	const FrameRangeList& r = s.getRangeList();
+	FrameType first = r[1].first - 1, last = r[3].end() + 1;
+	s.add(first, last - first);
+	IntList ref = ref_list[0];
+	for (FrameType f = first; f != last; ++f)
+		ref.push_back(f);
+	sort(ref.begin(), ref.end());
+	end = unique(ref.begin(), ref.end());
+	ref.erase(end, ref.end());
+	s.getFrameList(l);
+	if (l != ref)
+		THROW_HW_ERROR(Error) << "Insertion mismatch";
+
+	DEB_ALWAYS() << DEB_VAR3(nb_ports, nb_runs, merged);
+}
+
+static void benchSets(int nb_ports, int nb_runs)
+{
+	DEB_GLOBAL_FUNCT();
+
+	FrameRangeSetList set_list;
+	Timestamp t0 = Timestamp::now();
+	fillPorts(nb_ports, nb_runs, set_list, NULL);
+	double add_ms = (Timestamp::now() - t0) * 1e3;
+
+	FrameRangeSet::SetList merge_list;
+	for (int p = 0; p < nb_ports; ++p)
+		merge_list.push_back(&set_list[p]);
+	t0 = Timestamp::now();
+	FrameRangeSet merged;
+	FrameRangeSet::merge(merge_list, merged);
+	ostringstream os;
+	os << merged;
+	double report_ms = (Timestamp::now() - t0) * 1e3;
+
+	FrameType nb_frames = merged.getNbFrames();
+	int nb_ranges = merged.getNbRanges();
+	DEB_ALWAYS() << DEB_VAR4(nb_frames, nb_ranges, add_ms, report_ms);
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	int nb_runs = 10000;
+	if (argc > 1) {
+		istringstream is(argv[1]);
+		is >> nb_runs;
+	}
+
+	checkSets(1, 1000);
+	checkSets(8, 1000);
+	benchSets(36, nb_runs / 36);
+
+	return 0;
+}
@@ -0,0 +1,273 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+// Eiger chip border correction microbenchmark: the former column/row walks
+// of ChipBorderCorr vs the row-oriented Eiger::BorderPixelCorr, on 4M and
+// 9M frames, in place, out of place (copy) and by receiver port windows,
+// as in the RecvPortCorr mode. All must produce the same output (the 
+// inter-module gaps are not corrected by ports). The number of iterations
+// (2 by default, 100 for timing) is given as argument
+
+#include "lima/Timestamp.h"
+#include "lima/MiscUtils.h"
+#include "SlsDetectorEiger.h"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+DEB_GLOBAL(DebModTest);
+
+static const int ChipSize = 256;
+static const int ChipGap = 2;
+static const int HalfModuleChips = 4;
+static const int ModWidth = HalfModuleChips * ChipSize + 
+						(HalfModuleChips - 1) * ChipGap;
+static const int ModHeight = 2 * ChipSize + ChipGap;
+static const int InterModGap = 36;
+
+template <class T>
+class RefBorderCorr
+{
+public:
+	RefBorderCorr(int nb_modules, const Eiger::BorderFactorList& f)
+		: m_nb_modules(nb_modules), m_f(f)
+	{
+		m_inter_lines.assign(m_nb_modules, InterModGap);
+		m_inter_lines[m_nb_modules - 1] = 0;
+		m_width = ModWidth;
+		m_height = m_nb_modules * ModHeight + 
+					(m_nb_modules - 1) * InterModGap;
+	}
+
+	void correctFrame(void *ptr)
+	{
+		correctBorderCols(ptr);
+		correctBorderRows(ptr);
+		correctInterChipCols(ptr);
+		correctInterChipRows(ptr);
+	}
+
+private:
+	static void correctInterChipLine(T *d, int offset, int nb_iter, 
+					 int step) 
+	{
+		for (int i = 0; i < nb_iter; ++i, d += step)
+			d[0] = d[offset] /= 2;
+	}
+
+	static void correctBorderLine(T *d, int nb_iter, int step, double f) 
+	{
+		for (int i = 0; i < nb_iter; ++i, d += step)
+			d[0] /= f;
+	}
+
+	void correctInterChipCols(void *ptr)
+	{
+		T *d = static_cast<T *>(ptr);
+		for (int i = 0; i < HalfModuleChips - 1; ++i) {
+			d += ChipSize;
+			correctInterChipLine(d++, -1, m_height, m_width);
+			correctInterChipLine(d++, 1, m_height, m_width);
+		}
+	}
+
+	void correctInterChipRows(void *ptr)
+	{
+		T *p = static_cast<T *>(ptr);
+		for (int i = 0; i < m_nb_modules; ++i) {
+			T *d = p + ChipSize * m_width;
+			correctInterChipLine(d, -m_width, m_width, 1);
+			d += m_width;
+			correctInterChipLine(d, m_width, m_width, 1);
+			if (i == m_nb_modules - 1)
+				continue;
+			p += (ModHeight + m_inter_lines[i]) * m_width;
+		}
+	}
+
+	void correctBorderCols(void *ptr)
+	{
+		T *d = static_cast<T *>(ptr);
+		correctBorderLine(d, m_height, m_width, 2);
+		d += m_width - 1;
+		correctBorderLine(d, m_height, m_width, 2);
+	}
+
+	void correctBorderRows(void *ptr)
+	{
+		T *p = static_cast<T *>(ptr);
+		for (int i = 0; i < m_nb_modules; ++i) {
+			double f0 = m_f[i][0], f1 = m_f[i][1];
+			T *d = p;
+			correctBorderLine(d, m_width, 1, f0);
+			d += m_width;
+			correctBorderLine(d, m_width, 1, f1);
+			d += (ModHeight - 1 - 2) * m_width;
+			correctBorderLine(d, m_width, 1, f1);
+			d += m_width;
+			correctBorderLine(d, m_width, 1, f0);
+			p += (ModHeight + m_inter_lines[i]) * m_width;
+		}
+	}
+
+	int m_nb_modules;
+	Eiger::BorderFactorList m_f;
+	vector<int> m_inter_lines;
+	int m_width;
+	int m_height;
+};
+
+static const int RecvPorts = 2;
+
+template <class T>
+static void correctPorts(Eiger::BorderPixelCorr<T>& corr, int nb_modules,
+			 T *ptr)
+{
+	int port_width = ModWidth / RecvPorts;
+	for (int i = 0; i < nb_modules * 2 * RecvPorts; ++i) {
+		int recv_idx = i / RecvPorts, port = i % RecvPorts;
+		int c0 = port * port_width;
+		int c1 = (port == RecvPorts - 1) ? ModWidth : c0 + port_width;
+		corr.correctHalfModule(ptr, recv_idx / 2, (recv_idx % 2 == 0),
+				       c0, c1);
+	}
+}
+
+template <class T>
+static void clearInterModGaps(vector<T>& frame, int nb_modules)
+{
+	T *d = &frame[0];
+	for (int i = 0; i < nb_modules - 1; ++i) {
+		d += ModHeight * ModWidth;
+		memset(d, 0, InterModGap * ModWidth * sizeof(T));
+		d += InterModGap * ModWidth;
+	}
+}
+
+template <class T>
+static void testCorr(int nb_modules, int nb_iter)
+{
+	DEB_GLOBAL_FUNCT();
+
+	int depth = sizeof(T);
+	DEB_ALWAYS() << DEB_VAR2(nb_modules, depth);
+
+	// default factors, and others without exact reciprocal
+	Eiger::BorderFactorList f(nb_modules);
+	for (int i = 0; i < nb_modules; ++i) {
+		f[i].resize(2);
+		f[i][0] = (i % 2) ? 2.0 : 1.7;
+		f[i][1] = (i % 2) ? 1.3 : 1.1;
+	}
+
+	RefBorderCorr<T> ref_corr(nb_modules, f);
+	Eiger::BorderPixelCorr<T> corr;
+	vector<int> inter_lines(nb_modules, InterModGap);
+	inter_lines[nb_modules - 1] = 0;
+	corr.prepare(ModWidth, ModHeight, inter_lines, f);
+
+	int height = nb_modules * ModHeight + (nb_modules - 1) * InterModGap;
+	int nb_pixels = ModWidth * height;
+	vector<T> src(nb_pixels);
+	srand(nb_modules * depth);
+	for (int i = 0; i < nb_pixels; ++i)
+		src[i] = T(rand());
+
+	vector<T> ref_frame = src, frame = src, copy_frame(nb_pixels);
+	ref_corr.correctFrame(&ref_frame[0]);
+	corr.correctFrame(&frame[0]);
+	corr.correctFrame(&copy_frame[0], &src[0]);
+	if ((frame != ref_frame) || (copy_frame != ref_frame))
+		THROW_HW_ERROR(Error) << "Correction mismatch: "
+				      << DEB_VAR2(nb_modules, depth);
+
+	vector<T> port_frame = src;
+	correctPorts(corr, nb_modules, &port_frame[0]);
+	vector<T> gap_ref_frame = ref_frame;
+	clearInterModGaps(port_frame, nb_modules);
+	clearInterModGaps(gap_ref_frame, nb_modules);
+	if (port_frame != gap_ref_frame)
+		THROW_HW_ERROR(Error) << "Port correction mismatch: "
+				      << DEB_VAR2(nb_modules, depth);
+
+	Timestamp t0 = Timestamp::now();
+	for (int i = 0; i < nb_iter; ++i)
+		ref_corr.correctFrame(&ref_frame[0]);
+	double ref_us = (Timestamp::now() - t0) * 1e6 / nb_iter;
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_iter; ++i)
+		corr.correctFrame(&frame[0]);
+	double row_us = (Timestamp::now() - t0) * 1e6 / nb_iter;
+
+	// out-of-place: memcpy + in-place correction vs fused copy
+	int frame_size = nb_pixels * depth;
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_iter; ++i) {
+		memcpy(&ref_frame[0], &src[0], frame_size);
+		ref_corr.correctFrame(&ref_frame[0]);
+	}
+	double ref_copy_us = (Timestamp::now() - t0) * 1e6 / nb_iter;
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_iter; ++i)
+		corr.correctFrame(&copy_frame[0], &src[0]);
+	double row_copy_us = (Timestamp::now() - t0) * 1e6 / nb_iter;
+
+	// single thread: the port threads run them in parallel
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_iter; ++i)
+		correctPorts(corr, nb_modules, &port_frame[0]);
+	double port_us = (Timestamp::now() - t0) * 1e6 / nb_iter;
+	double one_port_us = port_us / (nb_modules * 2 * RecvPorts);
+
+	DEB_ALWAYS() << "  " << DEB_VAR4(ref_us, row_us, 
+					 ref_copy_us, row_copy_us);
+	DEB_ALWAYS() << "  " << DEB_VAR2(port_us, one_port_us);
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	int nb_iter = 2;
+	if (argc > 1) {
+		istringstream is(argv[1]);
+		is >> nb_iter;
+	}
+
+	// 4M and 9M frames
+	int nb_modules_list[] = {8, 18};
+	for (unsigned int i = 0; i < C_LIST_SIZE(nb_modules_list); ++i) {
+		int nb_modules = nb_modules_list[i];
+		testCorr<Eiger::Byte>(nb_modules, nb_iter);
+		testCorr<Eiger::Word>(nb_modules, nb_iter);
+		testCorr<Eiger::Long>(nb_modules, nb_iter);
+	}
+
+	return 0;
+}
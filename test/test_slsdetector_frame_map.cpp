@@ -0,0 +1,278 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+// FrameMap completion accounting microbenchmark: each thread plays a
+// receiver port, finishing all the frames through its FrameMap::Item,
+// as Receiver::Port::processFrame/pollFrameFinished do. Some frames are
+// declared bad by one port, checked in the bad-item mask when finished.
+// The recovery of frames declared lost and later received is also checked.
+// Run with "36 200000" (max. ports, frames) for benchmark figures
+
+#include "lima/Timestamp.h"
+#include "lima/MiscUtils.h"
+#include "lima/ThreadUtils.h"
+#include "SlsDetectorDefs.h"
+
+#include <sched.h>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+DEB_GLOBAL(DebModTest);
+
+static const int BufferSize = 1024;
+static const int BadFrameFreq = 97;
+
+static int getBadItem(FrameType frame)
+{ return frame % BadFrameFreq; }
+
+class PortThread : public Thread {
+	DEB_CLASS(DebModTest, "PortThread");
+public:
+	PortThread(FrameMap& frame_map, int idx, FrameType nb_frames,
+		   atomic<FrameType>& nb_finished, atomic<bool>& active);
+
+	FrameType getNbFinished() const
+	{ return m_nb_finished; }
+
+protected:
+	virtual void threadFunction();
+
+private:
+	void checkBadItems(FrameType frame);
+
+	FrameMap& m_frame_map;
+	FrameMap::Item& m_item;
+	int m_idx;
+	FrameType m_nb_frames;
+	atomic<FrameType>& m_tot_finished;
+	atomic<bool>& m_active;
+	FrameType m_nb_finished;
+};
+
+PortThread::PortThread(FrameMap& frame_map, int idx, FrameType nb_frames,
+		       atomic<FrameType>& nb_finished, atomic<bool>& active)
+	: m_frame_map(frame_map), m_item(frame_map.getItem(idx)),
+	  m_idx(idx), m_nb_frames(nb_frames),
+	  m_tot_finished(nb_finished), m_active(active), m_nb_finished(0)
+{
+	DEB_CONSTRUCTOR();
+	start();
+}
+
+void PortThread::threadFunction()
+{
+	DEB_MEMBER_FUNCT();
+
+	typedef FrameMap::Item::FinishInfoList FinishInfoList;
+
+	while (!m_active)
+		sched_yield();
+
+	for (FrameType frame = 0; frame < m_nb_frames; ++frame) {
+		// a port cannot get a full buffer ahead of the slowest one
+		FrameType min_finished = frame + 1 - BufferSize;
+		while ((frame >= BufferSize) &&
+		       (m_tot_finished.load() < min_finished))
+			sched_yield();
+
+		bool valid = (getBadItem(frame) != m_idx);
+		m_item.frameFinished(frame, true, valid);
+		const FinishInfoList& finfo_list = m_item.pollFrameFinished();
+		FinishInfoList::const_iterator it, end = finfo_list.end();
+		for (it = finfo_list.begin(); it != end; ++it) {
+			FrameRangeSpan::const_iterator rit, rend;
+			rend = it->finished.end();
+			for (rit = it->finished.begin(); rit != rend; ++rit) {
+				for (int i = 0; i < rit->nb; ++i)
+					checkBadItems(rit->first + i);
+				m_nb_finished += rit->nb;
+				m_tot_finished += rit->nb;
+			}
+		}
+	}
+}
+
+void PortThread::checkBadItems(FrameType frame)
+{
+	DEB_MEMBER_FUNCT();
+
+	IntList bad_item_list;
+	m_frame_map.getBadItemList(frame, bad_item_list);
+	int bad_item = getBadItem(frame);
+	bool bad = (bad_item < m_frame_map.getNbItems());
+	if ((bad_item_list.size() != (bad ? 1 : 0)) || 
+	    (bad && (bad_item_list[0] != bad_item)))
+		THROW_HW_ERROR(Error) << "Bad item mismatch: " 
+				      << DEB_VAR3(frame, bad_item, 
+						  bad_item_list.size());
+}
+
+static double runTest(int nb_ports, int group_size, FrameType nb_frames)
+{
+	DEB_GLOBAL_FUNCT();
+
+	FrameMap frame_map;
+	frame_map.setNbItems(nb_ports);
+	frame_map.setItemGroupSize(group_size);
+	frame_map.setBufferSize(BufferSize);
+	frame_map.clear();
+
+	atomic<FrameType> nb_finished(0);
+	atomic<bool> active(false);
+
+	typedef vector<AutoPtr<PortThread> > ThreadList;
+	ThreadList thread_list;
+	for (int i = 0; i < nb_ports; ++i)
+		thread_list.push_back(new PortThread(frame_map, i, nb_frames,
+						     nb_finished, active));
+
+	Timestamp t0 = Timestamp::now();
+	active = true;
+	ThreadList::iterator it, end = thread_list.end();
+	for (it = thread_list.begin(); it != end; ++it)
+		(*it)->join();
+	Timestamp elapsed = Timestamp::now() - t0;
+
+	if (nb_finished != nb_frames)
+		THROW_HW_ERROR(Error) << "Frame accounting error: "
+				      << DEB_VAR2(nb_finished, nb_frames);
+	return elapsed;
+}
+
+static int pollNbFinished(FrameMap::Item& item)
+{
+	typedef FrameMap::Item::FinishInfoList FinishInfoList;
+	const FinishInfoList& finfo_list = item.pollFrameFinished();
+	int nb_finished = 0;
+	FinishInfoList::const_iterator it, end = finfo_list.end();
+	for (it = finfo_list.begin(); it != end; ++it) {
+		const FrameRangeSpan& finished = it->finished;
+		FrameRangeSpan::const_iterator rit, rend = finished.end();
+		for (rit = finished.begin(); rit != rend; ++rit)
+			nb_finished += rit->nb;
+	}
+	return nb_finished;
+}
+
+static int finishOthers(FrameMap& frame_map, FrameType frame)
+{
+	int nb_finished = 0;
+	for (int i = 1; i < frame_map.getNbItems(); ++i) {
+		FrameMap::Item& item = frame_map.getItem(i);
+		item.frameFinished(frame, true, true);
+		nb_finished += pollNbFinished(item);
+	}
+	return nb_finished;
+}
+
+#define CHECK_LATE(cond)						\
+	if (!(cond))							\
+		THROW_HW_ERROR(Error) << "Late frame check failed: "	\
+				      << #cond << ", "			\
+				      << DEB_VAR2(nb_ports, group_size)
+
+// port 0 declares frames lost, which are received afterwards: they are
+// recovered only if not finished by the other ports
+static void checkLateFrames(int nb_ports, int group_size)
+{
+	DEB_GLOBAL_FUNCT();
+
+	FrameMap frame_map;
+	frame_map.setNbItems(nb_ports);
+	frame_map.setItemGroupSize(group_size);
+	frame_map.setBufferSize(BufferSize);
+	frame_map.clear();
+	FrameMap::Item& item = frame_map.getItem(0);
+
+	// lost frame already polled
+	item.frameFinished(0, true, false);
+	CHECK_LATE(pollNbFinished(item) == 0);
+	CHECK_LATE(item.isBadFrame(0) && item.holdLateFrame(0));
+	item.releaseLateFrame(0, true);
+	CHECK_LATE((pollNbFinished(item) == 0) && !item.isBadFrame(0));
+	CHECK_LATE(finishOthers(frame_map, 0) == 1);
+
+	// lost frame finished by all the ports
+	item.frameFinished(1, true, false);
+	int nb_finished = pollNbFinished(item);
+	CHECK_LATE(nb_finished + finishOthers(frame_map, 1) == 1);
+	CHECK_LATE(!item.holdLateFrame(1));
+
+	// lost frame not yet polled
+	item.frameFinished(2, true, false);
+	CHECK_LATE(item.holdLateFrame(2));
+	nb_finished = pollNbFinished(item);
+	CHECK_LATE(nb_finished + finishOthers(frame_map, 2) == 0);
+	item.releaseLateFrame(2, true);
+	CHECK_LATE(pollNbFinished(item) == 1);
+
+	// buffer reused
+	for (FrameType f = 3; f < BufferSize + 3; ++f) {
+		item.frameFinished(f, true, true);
+		pollNbFinished(item);
+		finishOthers(frame_map, f);
+	}
+	CHECK_LATE(!item.holdLateFrame(3));
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	int max_ports = 8;
+	FrameType nb_frames = 2000;
+	if (argc > 1) {
+		istringstream is(argv[1]);
+		is >> max_ports;
+	}
+	if (argc > 2) {
+		istringstream is(argv[2]);
+		is >> nb_frames;
+	}
+	DEB_ALWAYS() << DEB_VAR2(max_ports, nb_frames);
+
+	IntList port_list;
+	for (int nb_ports = 1; nb_ports < max_ports; nb_ports *= 2)
+		port_list.push_back(nb_ports);
+	port_list.push_back(max_ports);
+
+	IntList::const_iterator it, end = port_list.end();
+	for (it = port_list.begin(); it != end; ++it) {
+		int nb_ports = *it;
+		for (int group_size = 1; group_size <= 2; ++group_size) {
+			if (group_size > nb_ports)
+				continue;
+			if (nb_ports > 1)
+				checkLateFrames(nb_ports, group_size);
+			double elapsed = runTest(nb_ports, group_size,
+						 nb_frames);
+			double frame_rate = nb_frames / elapsed;
+			double ns_per_frame = elapsed * 1e9 / nb_frames;
+			DEB_ALWAYS() << DEB_VAR4(nb_ports, group_size,
+						 frame_rate, ns_per_frame);
+		}
+	}
+
+	return 0;
+}
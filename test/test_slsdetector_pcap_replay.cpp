@@ -0,0 +1,492 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+
+// Capture replay through the native frame assembly.
+//
+// Without arguments: synthetic pcap and pcapng captures of two ports are
+// written, with packets out of order, a duplicated and a missing packet,
+// a lost frame and foreign traffic, and replayed with the original,
+// scaled and as-fast-as-possible timings.
+//
+// With arguments: test_slsdetector_pcap_replay <capture> [pixel_depth
+// [time_scale [udp_port ...]]] replays the Eiger ports of a capture (all
+// the UDP ports found by default) and reports the receiver counters and
+// the replay throughput.
+
+#include "SlsDetectorPcapReceiver.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <set>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+DEB_GLOBAL(DebModTest);
+
+const int PacketLen = 4096;
+const int FramePackets = 16;
+const int FrameSize = PacketLen * FramePackets;
+const int NbFrames = 6;
+const int NbPorts = 2;
+const int BaseUdpPort = 50010;
+const double FramePeriod = 10e-3;
+const double PacketPeriod = 10e-6;
+
+// pixels of an Eiger port: half of a half-module of 4 chips of 256x256
+const int EigerPortPixels = 256 * 256 * 4 / 2;
+
+static char dataByte(int port, FrameType frame, int packet, int i)
+{
+	return char(port * 71 + frame * 31 + packet * 7 + i);
+}
+
+static bool isPacketSent(int port, FrameType frame, int packet)
+{
+	if ((port == 0) && (frame == 4))
+		return false;
+	return !((port == 1) && (frame == 2) && (packet == 5));
+}
+
+class TestHandler : public PortPacketReceiver::FrameHandler
+{
+	DEB_CLASS_NAMESPC(DebModTest, "TestHandler", "Test");
+
+public:
+	TestHandler(int port) : m_port(port)
+	{}
+
+	virtual char *getFrameBuffer(FrameType /*det_frame*/)
+	{ return NULL; }
+
+	virtual void frameReceived(const FrameMetaData& md, char *dptr,
+				   uint32_t dsize)
+	{
+		DEB_MEMBER_FUNCT();
+		DEB_PARAM() << DEB_VAR2(m_port, md);
+		if (dsize != FrameSize)
+			THROW_HW_ERROR(Error) << "Invalid " << DEB_VAR1(dsize);
+		for (int p = 0; p < FramePackets; ++p) {
+			const char *d = dptr + p * PacketLen;
+			bool lost = !isPacketSent(m_port, md.det_frame, p);
+			for (int i = 0; i < PacketLen; ++i) {
+				char ref = lost ? char(0xff) :
+					dataByte(m_port, md.det_frame, p, i);
+				if (d[i] != ref)
+					THROW_HW_ERROR(Error)
+						<< "Data mismatch: "
+						<< DEB_VAR4(m_port,
+							    md.det_frame,
+							    p, i);
+			}
+		}
+		m_frame_list.push_back(md.det_frame);
+		m_recv_packets_list.push_back(md.recv_packets);
+	}
+
+	IntList m_frame_list;
+	IntList m_recv_packets_list;
+
+private:
+	int m_port;
+};
+
+
+// Writer of the synthetic captures: Ethernet/IPv4/UDP frames, in pcap
+// (microseconds) or pcapng (nanoseconds, if_tsresol option) format
+class CaptureWriter
+{
+	DEB_CLASS_NAMESPC(DebModTest, "CaptureWriter", "Test");
+
+public:
+	CaptureWriter(bool pcapng) : m_pcapng(pcapng)
+	{
+		DEB_CONSTRUCTOR();
+
+		char fname[] = "/tmp/test_slsdetector_pcap_XXXXXX";
+		int fd = mkstemp(fname);
+		if (fd < 0)
+			THROW_HW_ERROR(Error) << "Error creating temp file";
+		close(fd);
+		m_fname = fname;
+		m_file = fopen(fname, "wb");
+		if (!m_pcapng) {
+			uint32_t h[6] = {0xa1b2c3d4, 0x00040002, 0, 0,
+					 65535, 1};
+			write(h, sizeof(h));
+		} else {
+			// section header, no option
+			uint32_t shb[7] = {0x0a0d0d0a, 28, 0x1a2b3c4d,
+					   0x00000001, 0xffffffff,
+					   0xffffffff, 28};
+			write(shb, sizeof(shb));
+			// interface, Ethernet, if_tsresol = 9 (ns)
+			uint32_t idb[7] = {1, 28, 1, 65535,
+					   (1 << 16) | 9, 9, 28};
+			write(idb, sizeof(idb));
+		}
+	}
+
+	~CaptureWriter()
+	{
+		if (m_file)
+			fclose(m_file);
+		unlink(m_fname.c_str());
+	}
+
+	const string& getFileName()
+	{ return m_fname; }
+
+	void finish()
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+
+	void writePacket(double t, int udp_port, const vector<char>& data,
+			 bool frag = false)
+	{
+		vector<char> f(14 + 20 + 8);
+		f[12] = 0x08;				// IPv4
+		char *ip = &f[14];
+		ip[0] = 0x45;
+		put16(ip + 2, 20 + 8 + data.size());
+		if (frag)
+			put16(ip + 6, 0x2000);		// more fragments
+		ip[8] = 64;
+		ip[9] = 17;				// UDP
+		put32(ip + 12, 0x0a000001);
+		put32(ip + 16, 0x0a000002);
+		char *udp = ip + 20;
+		put16(udp, 32000);
+		put16(udp + 2, udp_port);
+		put16(udp + 4, 8 + data.size());
+		f.insert(f.end(), data.begin(), data.end());
+		writeFrame(t, f);
+	}
+
+	void writeArp(double t)
+	{
+		vector<char> f(14 + 28);
+		f[12] = 0x08;
+		f[13] = 0x06;
+		writeFrame(t, f);
+	}
+
+private:
+	static void put16(char *p, uint16_t v)
+	{
+		v = htons(v);
+		memcpy(p, &v, sizeof(v));
+	}
+
+	static void put32(char *p, uint32_t v)
+	{
+		v = htonl(v);
+		memcpy(p, &v, sizeof(v));
+	}
+
+	void write(const void *p, size_t len)
+	{
+		DEB_MEMBER_FUNCT();
+		if (fwrite(p, 1, len, m_file) != len)
+			THROW_HW_ERROR(Error) << "Error writing capture";
+	}
+
+	void writeFrame(double t, vector<char> f)
+	{
+		uint32_t len = f.size();
+		if (!m_pcapng) {
+			uint32_t usec = uint32_t(t * 1e6 + 0.5);
+			uint32_t r[4] = {usec / 1000000, usec % 1000000,
+					 len, len};
+			write(r, sizeof(r));
+			write(&f[0], len);
+			return;
+		}
+		f.resize((len + 3) / 4 * 4);
+		uint32_t block_len = 32 + f.size();
+		uint64_t ns = uint64_t(t * 1e9 + 0.5);
+		uint32_t epb[7] = {6, block_len, 0, uint32_t(ns >> 32),
+				   uint32_t(ns), len, len};
+		write(epb, sizeof(epb));
+		write(&f[0], f.size());
+		write(&block_len, sizeof(block_len));
+	}
+
+	bool m_pcapng;
+	string m_fname;
+	FILE *m_file;
+};
+
+static vector<char> buildPacket(int port, FrameType frame, int packet)
+{
+	vector<char> buffer(sizeof(PacketHeader) + PacketLen);
+	PacketHeader h;
+	memset(&h, 0, sizeof(h));
+	h.frame = frame + 1;
+	h.packet = packet;
+	h.bunch_id = frame * 10;
+	h.timestamp = frame * 1000;
+	h.y = port;
+	memcpy(&buffer[0], &h, sizeof(h));
+	char *d = &buffer[sizeof(h)];
+	for (int i = 0; i < PacketLen; ++i)
+		d[i] = dataByte(port, frame, packet, i);
+	return buffer;
+}
+
+static void writeCapture(CaptureWriter& w)
+{
+	DEB_GLOBAL_FUNCT();
+
+	// port 1 starts 1 ms late: relative timing must be kept
+	for (FrameType f = 0; f < NbFrames; ++f) {
+		w.writeArp(f * FramePeriod);
+		for (int port = 0; port < NbPorts; ++port) {
+			double t0 = f * FramePeriod + port * 1e-3;
+			for (int i = 0; i < FramePackets; ++i) {
+				// swapped packet pairs
+				int p = i ^ 1;
+				double t = t0 + i * PacketPeriod;
+				int udp_port = BaseUdpPort + port;
+				if (!isPacketSent(port, f, p))
+					continue;
+				vector<char> d = buildPacket(port, f, p);
+				w.writePacket(t, udp_port, d);
+				if ((port == 0) && (f == 1) && (i == 3))
+					w.writePacket(t, udp_port, d);
+				// a fragment of a foreign datagram
+				if ((f == 3) && (i == 7))
+					w.writePacket(t, udp_port, d, true);
+			}
+		}
+	}
+	w.finish();
+}
+
+static void testReplay(bool pcapng, double time_scale)
+{
+	DEB_GLOBAL_FUNCT();
+	DEB_PARAM() << DEB_VAR2(pcapng, time_scale);
+
+	CaptureWriter w(pcapng);
+	writeCapture(w);
+
+	vector<AutoPtr<TestHandler> > handler_list;
+	vector<AutoPtr<PcapPortReceiver> > recv_list;
+	for (int port = 0; port < NbPorts; ++port) {
+		TestHandler *h = new TestHandler(port);
+		handler_list.push_back(h);
+		PcapPortReceiver *r = new PcapPortReceiver(h, w.getFileName(),
+							   BaseUdpPort + port,
+							   time_scale);
+		r->prepareAcq(FrameSize, PacketLen);
+		recv_list.push_back(r);
+	}
+
+	// both ports polled from the same thread, as fast as possible
+	Timestamp t0 = Timestamp::now();
+	Timestamp t1[NbPorts];
+	bool finished = false;
+	while (!finished) {
+		finished = true;
+		for (int port = 0; port < NbPorts; ++port) {
+			PcapPortReceiver& r = *recv_list[port];
+			if (r.isFinished())
+				continue;
+			r.poll(0);
+			if (r.isFinished()) {
+				r.flush();
+				t1[port] = Timestamp::now();
+			}
+			finished = false;
+		}
+	}
+
+	// last packet of port 1 at frame 5, packet 14 (swapped pairs)
+	double span = ((NbFrames - 1) * FramePeriod + 1e-3 +
+		       (FramePackets - 1) * PacketPeriod);
+	double elapsed = t1[1] - t0;
+	DEB_ALWAYS() << DEB_VAR4(pcapng, time_scale, span, elapsed);
+	if (elapsed < span * time_scale * 0.9)
+		THROW_HW_ERROR(Error) << "Replay too fast: "
+				      << DEB_VAR3(time_scale, span, elapsed);
+	double port_delay = t1[1] - t1[0];
+	if ((time_scale > 0) && (port_delay < 1e-3 * time_scale * 0.5))
+		THROW_HW_ERROR(Error) << "Port timing not kept: "
+				      << DEB_VAR1(port_delay);
+
+	IntList ref_frames[NbPorts] = {{0, 1, 2, 3, 5}, {0, 1, 2, 3, 4, 5}};
+	IntList ref_packets[NbPorts] = {{16, 16, 16, 16, 16},
+					{16, 16, 15, 16, 16, 16}};
+	for (int port = 0; port < NbPorts; ++port) {
+		TestHandler& h = *handler_list[port];
+		PortPacketReceiver::Counters c;
+		recv_list[port]->getCounters(c);
+		DEB_ALWAYS() << DEB_VAR2(port, c);
+		if (h.m_frame_list != ref_frames[port])
+			THROW_HW_ERROR(Error) << "Invalid frames: "
+					      << PrettyIntList(h.m_frame_list);
+		if (h.m_recv_packets_list != ref_packets[port])
+			THROW_HW_ERROR(Error) << "Invalid packets: "
+					      << PrettyIntList(
+						    h.m_recv_packets_list);
+		bool ok = (c.nb_frames == ref_frames[port].size());
+		if (port == 0)
+			ok &= ((c.nb_partial_frames == 0) &&
+			       (c.nb_lost_packets == 0) &&
+			       (c.nb_late_packets == 1));
+		else
+			ok &= ((c.nb_partial_frames == 1) &&
+			       (c.nb_lost_packets == 1) &&
+			       (c.nb_late_packets == 0));
+		if (!ok)
+			THROW_HW_ERROR(Error) << "Invalid counters: " << c;
+	}
+}
+
+
+class ReplayHandler : public PortPacketReceiver::FrameHandler
+{
+public:
+	ReplayHandler() : m_nb_frames(0), m_nb_skipped(0), m_first(true),
+			  m_last(0)
+	{}
+
+	virtual char *getFrameBuffer(FrameType /*det_frame*/)
+	{ return NULL; }
+
+	virtual void frameReceived(const FrameMetaData& md, char * /*dptr*/,
+				   uint32_t /*dsize*/)
+	{
+		if (!m_first && (md.det_frame > m_last + 1))
+			m_nb_skipped += md.det_frame - m_last - 1;
+		m_first = false;
+		m_last = md.det_frame;
+		++m_nb_frames;
+	}
+
+	int m_nb_frames;
+	int m_nb_skipped;
+	bool m_first;
+	FrameType m_last;
+};
+
+static void replayCapture(string fname, int pixel_depth, double time_scale,
+			  IntList port_list)
+{
+	DEB_GLOBAL_FUNCT();
+	DEB_PARAM() << DEB_VAR3(fname, pixel_depth, time_scale);
+
+	PcapFile f(fname);
+	PcapFile::Packet p;
+	set<int> port_set(port_list.begin(), port_list.end());
+	int packet_len = 0;
+	while (f.next(p)) {
+		if (port_list.empty() && (p.len > int(sizeof(PacketHeader))))
+			port_set.insert(p.udp_port);
+		if (!packet_len && port_set.count(p.udp_port))
+			packet_len = p.len - sizeof(PacketHeader);
+	}
+	if (port_set.empty() || !packet_len)
+		THROW_HW_ERROR(Error) << "No Eiger packet in " << fname;
+	uint32_t frame_size = EigerPortPixels * pixel_depth / 8;
+	DEB_ALWAYS() << DEB_VAR3(port_set.size(), packet_len, frame_size);
+
+	vector<AutoPtr<ReplayHandler> > handler_list;
+	vector<AutoPtr<PcapPortReceiver> > recv_list;
+	set<int>::const_iterator it, end = port_set.end();
+	for (it = port_set.begin(); it != end; ++it) {
+		ReplayHandler *h = new ReplayHandler();
+		handler_list.push_back(h);
+		PcapPortReceiver *r = new PcapPortReceiver(h, fname, *it,
+							   time_scale);
+		r->prepareAcq(frame_size, packet_len);
+		recv_list.push_back(r);
+	}
+
+	int nb_ports = recv_list.size();
+	Timestamp t0 = Timestamp::now();
+	bool finished = false;
+	while (!finished) {
+		finished = true;
+		for (int i = 0; i < nb_ports; ++i) {
+			PcapPortReceiver& r = *recv_list[i];
+			if (r.isFinished())
+				continue;
+			r.poll(0);
+			if (r.isFinished())
+				r.flush();
+			finished = false;
+		}
+	}
+	double elapsed = Timestamp::now() - t0;
+
+	uint64_t nb_bytes = 0;
+	for (it = port_set.begin(); it != end; ++it) {
+		int i = distance(port_set.begin(), it);
+		int udp_port = *it;
+		ReplayHandler& h = *handler_list[i];
+		PortPacketReceiver::Counters c;
+		recv_list[i]->getCounters(c);
+		nb_bytes += c.nb_packets * packet_len;
+		DEB_ALWAYS() << DEB_VAR4(udp_port, c, h.m_nb_frames,
+					 h.m_nb_skipped);
+	}
+	double gbytes_per_sec = nb_bytes / elapsed / 1e9;
+	DEB_ALWAYS() << DEB_VAR3(f.getNbSkippedPackets(), elapsed,
+				 gbytes_per_sec);
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	try {
+		if (argc > 1) {
+			int pixel_depth = (argc > 2) ? atoi(argv[2]) : 16;
+			double time_scale = (argc > 3) ? atof(argv[3]) : 0;
+			IntList port_list;
+			for (int i = 4; i < argc; ++i)
+				port_list.push_back(atoi(argv[i]));
+			replayCapture(argv[1], pixel_depth, time_scale,
+				      port_list);
+			return 0;
+		}
+		testReplay(false, 1);
+		testReplay(true, 0.5);
+		testReplay(true, 0);
+		testReplay(false, 0);
+	} catch (Exception& e) {
+		DEB_ERROR() << "Exception: " << e;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,396 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+
+// Offline replay benchmark of the receive pipeline, without detector nor
+// network: one thread per receiver port feeds synthetic port frames 
+// through Eiger::RecvPortGeometry (processRecvPort), its FrameMap::Item 
+// and finished queue, as Receiver::Port does. An AcqThread stand-in 
+// orders the finished frames (SeqFilter) and publishes them through a 
+// StdBufferCbMgr. Frame rate, throughput and latency percentiles (first 
+// port start to newFrameReady) are reported per pixel depth, raw/assembled
+// mode and number of ports. Arguments: max. ports, frames and frame rate
+// (0: as fast as possible); the defaults only check the pipeline, use 
+// "8 2000" or more for benchmark figures
+
+#include "lima/Timestamp.h"
+#include "lima/MiscUtils.h"
+#include "lima/ThreadUtils.h"
+#include "lima/HwBufferMgr.h"
+#include "SlsDetectorEiger.h"
+
+#include <sched.h>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+DEB_GLOBAL(DebModTest);
+
+static const int ChipSize = 256;
+static const int ChipGap = 2;
+static const int HalfModuleChips = 4;
+static const int RecvPorts = 2;
+static const int InterModGap = 36;
+static const int NbBuffers = 64;
+static const int NbSrcSlots = 4;
+
+struct TestConfig {
+	int depth;
+	bool raw;
+	int nb_ports;
+};
+
+struct TestResult {
+	double frame_rate;
+	double gbytes_per_sec;
+	double latency_p50;
+	double latency_p99;
+	double latency_max;
+};
+
+class FrameCallback : public HwFrameCallback
+{
+protected:
+	virtual bool newFrameReady(const HwFrameInfoType& /*frame_info*/)
+	{ return true; }
+};
+
+class Pipeline
+{
+	DEB_CLASS(DebModTest, "Pipeline");
+
+public:
+	Pipeline(const TestConfig& cfg, FrameType nb_frames, 
+		 double frame_rate);
+	~Pipeline();
+
+	void run(TestResult& res);
+
+private:
+	class PortThread : public Thread {
+		DEB_CLASS(DebModTest, "PortThread");
+	public:
+		PortThread(Pipeline& pipeline, int port_idx)
+			: m_pipeline(pipeline), m_port_idx(port_idx)
+		{ start(); }
+
+	protected:
+		virtual void threadFunction()
+		{ m_pipeline.processPortFrames(m_port_idx); }
+
+	private:
+		Pipeline& m_pipeline;
+		int m_port_idx;
+	};
+
+	typedef SPSCQueue<FrameRange> FinishedQueue;
+	typedef vector<AutoPtr<Eiger::RecvPortGeometry> > GeometryList;
+	typedef vector<AutoPtr<FinishedQueue> > FinishedQueueList;
+	typedef vector<AutoPtr<FrameMetaDataRing> > MetaDataRingList;
+	typedef vector<AutoPtr<PortThread> > ThreadList;
+
+	void initGeometry();
+	void processPortFrames(int port_idx);
+	void acqLoop();
+	int64_t getTimeNs()
+	{ return int64_t((Timestamp::now() - m_t0) * 1e9); }
+
+	TestConfig m_cfg;
+	FrameType m_nb_frames;
+	double m_frame_rate;
+	FrameDim m_frame_dim;
+	uint32_t m_port_size;
+	vector<vector<char> > m_src_list;
+	GeometryList m_geom_list;
+	FrameMap m_frame_map;
+	FinishedQueueList m_finished_queue_list;
+	MetaDataRingList m_meta_data_ring_list;
+	WaitEvent m_finished_event;
+	SeqFilter m_seq_filter;
+	SoftBufferAllocMgr m_alloc_mgr;
+	StdBufferCbMgr m_cb_mgr;
+	FrameCallback m_frame_cb;
+	atomic<bool> m_active;
+	atomic<FrameType> m_nb_ready;
+	Timestamp m_t0;
+	vector<atomic<int64_t> > m_start_ns;
+	vector<double> m_latency;
+};
+
+Pipeline::Pipeline(const TestConfig& cfg, FrameType nb_frames,
+		   double frame_rate)
+	: m_cfg(cfg), m_nb_frames(nb_frames), m_frame_rate(frame_rate),
+	  m_seq_filter(NbBuffers), m_cb_mgr(m_alloc_mgr), m_active(false),
+	  m_nb_ready(0), m_start_ns(nb_frames), m_latency(nb_frames)
+{
+	DEB_CONSTRUCTOR();
+
+	initGeometry();
+
+	// port frames as received: 4-bit pixels are packed
+	const int pchips = HalfModuleChips / RecvPorts;
+	m_port_size = ChipSize * pchips * ChipSize * m_cfg.depth / 8;
+	for (int i = 0; i < m_cfg.nb_ports; ++i) {
+		vector<char> src(size_t(m_port_size) * NbSrcSlots);
+		for (size_t j = 0; j < src.size(); ++j)
+			src[j] = char(i * 37 + j);
+		m_src_list.push_back(src);
+		m_finished_queue_list.push_back(new FinishedQueue(NbBuffers));
+		FrameMetaDataRing *ring = new FrameMetaDataRing();
+		ring->setSize(NbBuffers);
+		m_meta_data_ring_list.push_back(ring);
+	}
+
+	m_frame_map.setNbItems(m_cfg.nb_ports);
+	m_frame_map.setBufferSize(NbBuffers);
+	m_frame_map.clear();
+
+	m_cb_mgr.allocBuffers(NbBuffers, 1, m_frame_dim);
+	m_cb_mgr.registerFrameCallback(m_frame_cb);
+	for (int i = 0; i < NbBuffers; ++i)
+		memset(m_cb_mgr.getFrameBufferPtr(i), 0, 
+		       m_frame_dim.getMemSize());
+
+	for (FrameType f = 0; f < m_nb_frames; ++f)
+		m_start_ns[f] = -1;
+}
+
+Pipeline::~Pipeline()
+{
+	DEB_DESTRUCTOR();
+	m_cb_mgr.unregisterFrameCallback(m_frame_cb);
+}
+
+void Pipeline::initGeometry()
+{
+	DEB_MEMBER_FUNCT();
+
+	int nb_half_modules = (m_cfg.nb_ports + RecvPorts - 1) / RecvPorts;
+	int nb_modules = (nb_half_modules + 1) / 2;
+
+	Eiger::RecvPortGeometry::Config geom_cfg;
+	ImageType image_type = (m_cfg.depth == 32) ? Bpp32 : 
+			       (m_cfg.depth == 16) ? Bpp16 : Bpp8;
+	Size recv_size(ChipSize * HalfModuleChips, ChipSize);
+	if (m_cfg.raw) {
+		recv_size /= Point(RecvPorts, 1);
+		recv_size *= Point(1, RecvPorts);
+	} else {
+		recv_size += Point(ChipGap * 3, ChipGap / 2);
+	}
+	geom_cfg.recv_frame_dim = FrameDim(recv_size, image_type);
+	geom_cfg.raw = m_cfg.raw;
+	geom_cfg.expand4 = (m_cfg.depth == 4);
+	geom_cfg.inter_mod_gap.assign(max(nb_modules - 1, 0), InterModGap);
+
+	int height = recv_size.getHeight() * nb_half_modules;
+	if (!m_cfg.raw)
+		height += InterModGap * (nb_modules - 1);
+	m_frame_dim = FrameDim(recv_size.getWidth(), height, image_type);
+	DEB_TRACE() << DEB_VAR1(m_frame_dim);
+
+	for (int i = 0; i < m_cfg.nb_ports; ++i) {
+		int recv_idx = i / RecvPorts;
+		int port = i % RecvPorts;
+		Eiger::RecvPortGeometry *geom = 
+			new Eiger::RecvPortGeometry(recv_idx, port);
+		geom->prepareAcq(geom_cfg);
+		m_geom_list.push_back(geom);
+	}
+}
+
+void Pipeline::processPortFrames(int port_idx)
+{
+	DEB_MEMBER_FUNCT();
+
+	typedef FrameMap::Item::FinishInfoList FinishInfoList;
+
+	Eiger::RecvPortGeometry& geom = *m_geom_list[port_idx];
+	FrameMap::Item& item = m_frame_map.getItem(port_idx);
+	FinishedQueue& queue = *m_finished_queue_list[port_idx];
+	FrameMetaDataRing& meta_data_ring = *m_meta_data_ring_list[port_idx];
+	char *src_base = &m_src_list[port_idx][0];
+	FrameMetaData md;
+
+	while (!m_active)
+		sched_yield();
+
+	for (FrameType frame = 0; frame < m_nb_frames; ++frame) {
+		// a port cannot get a full buffer ahead of the AcqThread
+		while (frame >= m_nb_ready.load() + NbBuffers)
+			sched_yield();
+		if (m_frame_rate > 0) {
+			int64_t t = int64_t(frame * 1e9 / m_frame_rate);
+			while (getTimeNs() < t)
+				sched_yield();
+		}
+
+		// latency is measured from the first port starting the frame
+		int64_t none = -1;
+		m_start_ns[frame].compare_exchange_strong(none, getTimeNs());
+
+		char *src = src_base + (frame % NbSrcSlots) * m_port_size;
+		char *bptr = (char *) m_cb_mgr.getFrameBufferPtr(frame);
+		geom.processRecvPort(frame, src, bptr);
+
+		md.det_frame = frame;
+		md.recv_packets = m_port_size / EIGER_PACKET_DATA_LEN;
+		meta_data_ring.put(frame, md);
+
+		item.frameFinished(frame, true, true);
+		const FinishInfoList& finfo_list = item.pollFrameFinished();
+		bool finished = false;
+		FinishInfoList::const_iterator it, end = finfo_list.end();
+		for (it = finfo_list.begin(); it != end; ++it) {
+			FrameRangeSpan::const_iterator rit, rend;
+			rend = it->finished.end();
+			for (rit = it->finished.begin(); rit != rend; ++rit) {
+				while (!queue.push(*rit))
+					sched_yield();
+				finished = true;
+			}
+		}
+		if (finished)
+			m_finished_event.signal();
+	}
+}
+
+void Pipeline::acqLoop()
+{
+	DEB_MEMBER_FUNCT();
+
+	FrameRangeList finished_list;
+	while (m_nb_ready < m_nb_frames) {
+		int seq = m_finished_event.getSeq();
+		finished_list.clear();
+		FinishedQueueList::iterator it, end = m_finished_queue_list.end();
+		for (it = m_finished_queue_list.begin(); it != end; ++it)
+			(*it)->pop_all(finished_list);
+		FrameRangeList::const_iterator fit, fend = finished_list.end();
+		for (fit = finished_list.begin(); fit != fend; ++fit)
+			if (!m_seq_filter.addRange(*fit))
+				THROW_HW_ERROR(Error) << "Pipeline overrun: "
+						      << DEB_VAR1(*fit);
+
+		if (!m_seq_filter.hasSeqRange()) {
+			if (!m_finished_event.wait(seq, 5.0))
+				THROW_HW_ERROR(Error) << "Pipeline stalled: " 
+						      << DEB_VAR1(m_nb_ready);
+			continue;
+		}
+
+		FrameRange frames = m_seq_filter.getSeqRange();
+		for (FrameType f = frames.first; f != frames.end(); ++f) {
+			HwFrameInfoType frame_info;
+			frame_info.acq_frame_nb = f;
+			m_cb_mgr.newFrameReady(frame_info);
+			m_latency[f] = (getTimeNs() - m_start_ns[f]) * 1e-9;
+			++m_nb_ready;
+		}
+	}
+}
+
+void Pipeline::run(TestResult& res)
+{
+	DEB_MEMBER_FUNCT();
+
+	ThreadList thread_list;
+	for (int i = 0; i < m_cfg.nb_ports; ++i)
+		thread_list.push_back(new PortThread(*this, i));
+
+	m_t0 = Timestamp::now();
+	m_cb_mgr.setStartTimestamp(m_t0);
+	m_active = true;
+	acqLoop();
+	Timestamp elapsed = Timestamp::now() - m_t0;
+
+	ThreadList::iterator it, end = thread_list.end();
+	for (it = thread_list.begin(); it != end; ++it)
+		(*it)->join();
+
+	double nb_bytes = double(m_nb_frames) * m_cfg.nb_ports * m_port_size;
+	res.frame_rate = m_nb_frames / elapsed;
+	res.gbytes_per_sec = nb_bytes / elapsed / 1e9;
+
+	vector<double> l = m_latency;
+	sort(l.begin(), l.end());
+	res.latency_p50 = l[l.size() / 2];
+	res.latency_p99 = l[l.size() * 99 / 100];
+	res.latency_max = l.back();
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	int max_ports = 4;
+	FrameType nb_frames = 200;
+	double frame_rate = 0;
+	if (argc > 1) {
+		istringstream is(argv[1]);
+		is >> max_ports;
+	}
+	if (argc > 2) {
+		istringstream is(argv[2]);
+		is >> nb_frames;
+	}
+	if (argc > 3) {
+		istringstream is(argv[3]);
+		is >> frame_rate;
+	}
+	DEB_ALWAYS() << DEB_VAR3(max_ports, nb_frames, frame_rate);
+
+	IntList port_list;
+	for (int nb_ports = RecvPorts; nb_ports < max_ports; nb_ports *= 2)
+		port_list.push_back(nb_ports);
+	port_list.push_back(max_ports);
+
+	const int depth_list[] = {4, 8, 16, 32};
+	IntList::const_iterator it, end = port_list.end();
+	for (it = port_list.begin(); it != end; ++it) {
+		for (int d = 0; d < 4; ++d) {
+			for (int r = 0; r < 2; ++r) {
+				TestConfig cfg = {depth_list[d], r == 0, *it};
+				Pipeline pipeline(cfg, nb_frames, frame_rate);
+				TestResult res;
+				pipeline.run(res);
+				double lat_p50_us = res.latency_p50 * 1e6;
+				double lat_p99_us = res.latency_p99 * 1e6;
+				double lat_max_us = res.latency_max * 1e6;
+				DEB_ALWAYS() << DEB_VAR3(cfg.nb_ports, cfg.depth,
+							 cfg.raw)
+					     << ": " 
+					     << DEB_VAR2(res.frame_rate,
+							 res.gbytes_per_sec)
+					     << ", "
+					     << DEB_VAR3(lat_p50_us, lat_p99_us,
+							 lat_max_us);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,231 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+// Eiger port geometry copy microbenchmark: the reference memcpy/memset
+// loop of RecvPortGeometry::processRecvPort, followed by the in-place
+// expansion of the former PixelDepth4Corr in 4-bit mode, vs the StreamCopy
+// kernels, on a ring of frames larger than the caches. A quick check
+// by default: pass e.g. 2000 iterations for meaningful rates
+
+#include "lima/Timestamp.h"
+#include "lima/MiscUtils.h"
+#include "SlsDetectorStreamCopy.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+DEB_GLOBAL(DebModTest);
+
+static const int ChipSize = 256;
+static const int ChipGap = 2;
+static const int PortChips = 2;
+static const int HalfModuleChips = 4;
+static const int NbFrames = 32;
+
+struct PortGeom {
+	bool expand4;
+	int scw;		// source chip width
+	int dcw;		// dest chip width
+	int ilw;		// image line width
+	int offset;		// port offset in frame
+	int frame_size;
+	int port_size;
+
+	PortGeom(int depth_bits, bool raw, bool flip)
+	{
+		int depth = (depth_bits + 7) / 8;
+		scw = dcw = ChipSize * depth;
+		expand4 = (depth_bits == 4);
+		if (expand4)
+			scw /= 2;
+		int width = HalfModuleChips * ChipSize;
+		if (!raw) {
+			dcw += ChipGap * depth;
+			width += (HalfModuleChips - 1) * ChipGap;
+		}
+		ilw = width * depth;
+		frame_size = ilw * (ChipSize + ChipGap / 2);
+		port_size = ChipSize * PortChips * scw;
+		offset = raw ? 0 : dcw * PortChips;
+		if (flip) {
+			offset += (ChipSize - 1) * ilw;
+			ilw *= -1;
+		}
+	}
+};
+
+static void refCopy(const PortGeom& g, char *dest, const char *src)
+{
+	bool valid_data = (src != NULL);
+	dest += g.offset;
+	for (int i = 0; i < ChipSize; ++i, dest += g.ilw) {
+		char *d = dest;
+		for (int j = 0; j < PortChips; ++j, src += g.scw, d += g.dcw)
+			if (valid_data)
+				memcpy(d, src, g.scw);
+			else
+				memset(d, 0xff, g.scw);
+	}
+	if (!g.expand4)
+		return;
+
+	dest -= ChipSize * g.ilw;
+	for (int i = 0; i < ChipSize; ++i, dest += g.ilw) {
+		char *chip = dest;
+		for (int j = 0; j < PortChips; ++j, chip += g.dcw) {
+			char *s = chip + g.scw;
+			char *d = chip + 2 * g.scw;
+			for (int k = 0; k < g.scw; ++k) {
+				unsigned char b = *--s;
+				*--d = b >> 4;
+				*--d = b & 0xf;
+			}
+		}
+	}
+}
+
+static void streamCopy(const PortGeom& g, char *dest, const char *src,
+		       StreamCopy::CopyFunc copy, StreamCopy::FillFunc fill,
+		       StreamCopy::Expand4Func expand)
+{
+	int cw = g.expand4 ? 2 * g.scw : g.scw;
+	int val = g.expand4 ? 0xf : 0xff;
+	dest += g.offset;
+	for (int i = 0; i < ChipSize; ++i, dest += g.ilw) {
+		char *d = dest;
+		for (int j = 0; j < PortChips; ++j, d += g.dcw) {
+			if (!src) {
+				fill(d, val, cw);
+				continue;
+			}
+			if (g.expand4)
+				expand(d, src, g.scw);
+			else
+				copy(d, src, g.scw);
+			src += g.scw;
+		}
+	}
+	StreamCopy::fence();
+}
+
+typedef vector<char> CharBuffer;
+
+// level == Auto runs the reference loop
+static double runTest(const PortGeom& g, StreamCopy::Level level, bool fill,
+		      int nb_iter, vector<CharBuffer>& src_list,
+		      vector<CharBuffer>& dest_list)
+{
+	DEB_GLOBAL_FUNCT();
+
+	StreamCopy::CopyFunc copy_func = NULL;
+	StreamCopy::FillFunc fill_func = NULL;
+	StreamCopy::Expand4Func expand_func = NULL;
+	if (level != StreamCopy::Auto) {
+		copy_func = StreamCopy::getCopyFunc(level);
+		fill_func = StreamCopy::getFillFunc(level);
+		expand_func = StreamCopy::getExpand4Func(level);
+	}
+	Timestamp t0 = Timestamp::now();
+	for (int i = 0; i < nb_iter; ++i) {
+		char *dest = &dest_list[i % NbFrames][0];
+		const char *src = fill ? NULL : &src_list[i % NbFrames][0];
+		if (level == StreamCopy::Auto)
+			refCopy(g, dest, src);
+		else
+			streamCopy(g, dest, src, copy_func, fill_func,
+				   expand_func);
+	}
+	return Timestamp::now() - t0;
+}
+
+static void testGeom(int depth_bits, bool raw, bool flip, int nb_iter)
+{
+	DEB_GLOBAL_FUNCT();
+	DEB_ALWAYS() << DEB_VAR3(depth_bits, raw, flip);
+
+	PortGeom g(depth_bits, raw, flip);
+
+	vector<CharBuffer> src_list(NbFrames), dest_list(NbFrames);
+	for (int i = 0; i < NbFrames; ++i) {
+		CharBuffer& src = src_list[i];
+		src.resize(g.port_size);
+		for (int j = 0; j < g.port_size; ++j)
+			src[j] = char(i * 7 + j * 13);
+		dest_list[i].assign(g.frame_size, 0);
+	}
+
+	StreamCopy::LevelList level_list;
+	StreamCopy::getSupportedLevelList(level_list);
+	level_list.insert(level_list.begin(), StreamCopy::Auto);
+
+	CharBuffer ref_copy, ref_fill;
+	StreamCopy::LevelList::const_iterator it, end = level_list.end();
+	for (it = level_list.begin(); it != end; ++it) {
+		for (int fill = 0; fill < 2; ++fill) {
+			for (int i = 0; i < NbFrames; ++i)
+				dest_list[i].assign(g.frame_size, 0);
+			double elapsed = runTest(g, *it, fill, nb_iter,
+						 src_list, dest_list);
+			CharBuffer& ref = fill ? ref_fill : ref_copy;
+			CharBuffer& res = dest_list[(nb_iter - 1) % NbFrames];
+			if (*it == StreamCopy::Auto)
+				ref = res;
+			else if (res != ref)
+				THROW_HW_ERROR(Error) << "Copy mismatch: "
+						      << DEB_VAR2(*it, fill);
+			StreamCopy::Level level = *it;
+			double port_frame_us = elapsed * 1e6 / nb_iter;
+			double gbytes_per_sec = (double(g.port_size) * nb_iter /
+						 elapsed / 1e9);
+			DEB_ALWAYS() << "  " << DEB_VAR4(level, bool(fill),
+							 port_frame_us,
+							 gbytes_per_sec);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	int nb_iter = 20;
+	if (argc > 1) {
+		istringstream is(argv[1]);
+		is >> nb_iter;
+	}
+
+	StreamCopy::Level best_level = StreamCopy::getBestLevel();
+	DEB_ALWAYS() << DEB_VAR2(nb_iter, best_level);
+
+	int depth_list[] = {4, 8, 16, 32};
+	for (unsigned int i = 0; i < C_LIST_SIZE(depth_list); ++i) {
+		testGeom(depth_list[i], true, false, nb_iter);
+		testGeom(depth_list[i], false, false, nb_iter);
+		testGeom(depth_list[i], false, true, nb_iter);
+	}
+
+	return 0;
+}
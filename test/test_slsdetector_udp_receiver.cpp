@@ -0,0 +1,200 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+
+
+// Native UDP receiver test over loopback: Eiger v2 packets of a few port 
+// frames are sent out of order within the frames, with a missing packet, 
+// a duplicated one, an empty datagram and a whole frame lost. Frames must
+// be delivered in place, the partial one with the missing packet filled
+// with 0xff
+
+#include "SlsDetectorUdpReceiver.h"
+
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace lima;
+using namespace lima::SlsDetector;
+
+DEB_GLOBAL(DebModTest);
+
+const int PacketLen = 4096;
+const int FramePackets = 16;
+const int FrameSize = PacketLen * FramePackets;
+const int NbFrames = 6;
+
+static char dataByte(FrameType frame, int packet, int i)
+{
+	return char(frame * 31 + packet * 7 + i);
+}
+
+class TestHandler : public UdpPortReceiver::FrameHandler
+{
+	DEB_CLASS_NAMESPC(DebModTest, "TestHandler", "Test");
+
+public:
+	TestHandler() : m_buffer(size_t(NbFrames) * FrameSize)
+	{}
+
+	virtual char *getFrameBuffer(FrameType det_frame)
+	{
+		// odd frames go to the internal slot
+		if (det_frame % 2)
+			return NULL;
+		return &m_buffer[(det_frame % NbFrames) * FrameSize];
+	}
+
+	virtual void frameReceived(const FrameMetaData& md, char *dptr,
+				   uint32_t dsize)
+	{
+		DEB_MEMBER_FUNCT();
+		DEB_PARAM() << DEB_VAR1(md);
+		if (dsize != FrameSize)
+			THROW_HW_ERROR(Error) << "Invalid " << DEB_VAR1(dsize);
+		if (dptr != getFrameBuffer(md.det_frame) &&
+		    !(md.det_frame % 2))
+			THROW_HW_ERROR(Error) << "Frame not placed in buffer";
+		if (md.bunch_id != md.det_frame * 10)
+			THROW_HW_ERROR(Error) << "Invalid " << DEB_VAR1(md);
+		for (int p = 0; p < FramePackets; ++p) {
+			const char *d = dptr + p * PacketLen;
+			bool lost = !isPacketSent(md.det_frame, p);
+			for (int i = 0; i < PacketLen; ++i) {
+				char ref = lost ? char(0xff) : 
+					   dataByte(md.det_frame, p, i);
+				if (d[i] != ref)
+					THROW_HW_ERROR(Error) 
+						<< "Data mismatch: " 
+						<< DEB_VAR3(md.det_frame, 
+							    p, i);
+			}
+		}
+		m_frame_list.push_back(md.det_frame);
+		m_recv_packets_list.push_back(md.recv_packets);
+	}
+
+	static bool isPacketSent(FrameType frame, int packet)
+	{
+		return !((frame == 2) && (packet == 5));
+	}
+
+	IntList m_frame_list;
+	IntList m_recv_packets_list;
+
+private:
+	vector<char> m_buffer;
+};
+
+static void sendPacket(int fd, const sockaddr_in& sa, FrameType frame, 
+		       int packet)
+{
+	DEB_GLOBAL_FUNCT();
+
+	vector<char> buffer(sizeof(PacketHeader) + PacketLen);
+	PacketHeader h;
+	memset(&h, 0, sizeof(h));
+	h.frame = frame + 1;
+	h.packet = packet;
+	h.bunch_id = frame * 10;
+	h.timestamp = frame * 1000;
+	memcpy(&buffer[0], &h, sizeof(h));
+	char *d = &buffer[sizeof(h)];
+	for (int i = 0; i < PacketLen; ++i)
+		d[i] = dataByte(frame, packet, i);
+	if (sendto(fd, &buffer[0], buffer.size(), 0, (const sockaddr *) &sa, 
+		   sizeof(sa)) < 0)
+		THROW_HW_ERROR(Error) << "Error sending packet";
+}
+
+static void testLoopback()
+{
+	DEB_GLOBAL_FUNCT();
+
+	TestHandler handler;
+	UdpPortReceiver recv(&handler, 0, "127.0.0.1");
+	recv.prepareAcq(FrameSize, PacketLen);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(recv.getUdpPort());
+	inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+
+	for (FrameType f = 0; f < NbFrames; ++f) {
+		// frame 4 is lost
+		if (f == 4)
+			continue;
+		for (int i = 0; i < FramePackets; ++i) {
+			// swapped packet pairs
+			int p = i ^ 1;
+			if (TestHandler::isPacketSent(f, p))
+				sendPacket(fd, sa, f, p);
+			if ((f == 1) && (i == 3))
+				sendPacket(fd, sa, f, p);
+		}
+		// an empty datagram is invalid, not fatal
+		if ((f == 2) && (sendto(fd, NULL, 0, 0, (const sockaddr *) &sa,
+					sizeof(sa)) < 0))
+			THROW_HW_ERROR(Error) << "Error sending empty datagram";
+		// let the receive buffer drain
+		while (recv.poll(10e-3) > 0);
+	}
+	recv.flush();
+	close(fd);
+
+	UdpPortReceiver::Counters c;
+	recv.getCounters(c);
+	DEB_ALWAYS() << DEB_VAR2(c, recv.isGROActive());
+
+	IntList ref_frames = {0, 1, 2, 3, 5};
+	IntList ref_packets = {16, 16, 15, 16, 16};
+	if (handler.m_frame_list != ref_frames)
+		THROW_HW_ERROR(Error) << "Invalid frames: " 
+				      << PrettyIntList(handler.m_frame_list);
+	if (handler.m_recv_packets_list != ref_packets)
+		THROW_HW_ERROR(Error) << "Invalid packets: " 
+				      << PrettyIntList(
+					      handler.m_recv_packets_list);
+	if ((c.nb_frames != 5) || (c.nb_partial_frames != 1) || 
+	    (c.nb_lost_packets != 1) || (c.nb_late_packets != 1) ||
+	    (c.nb_invalid_packets != 1))
+		THROW_HW_ERROR(Error) << "Invalid counters: " << c;
+}
+
+int main()
+{
+	DEB_GLOBAL_FUNCT();
+
+	try {
+		testLoopback();
+	} catch (Exception& e) {
+		DEB_ERROR() << "Exception: " << e;
+		return 1;
+	}
+
+	return 0;
+}